@@ -4,6 +4,7 @@
 #include <machine/peripherals.h>
 #include <printk.h>
 #include <string.h>
+#include <syscall.h>
 #include <task.h>
 #include <types.h>
 
@@ -93,6 +94,7 @@ void arm64_init(void) {
     ARM64_MSR(pmcntenset_el0,
               0x8000001full);  // Enable the cycle and 5 event counters.
     ARM64_MSR(pmuserenr_el0, 0b11ull);  // Enable user access to the counters.
+    ARM64_MSR(cntkctl_el1, ARM64_MRS(cntkctl_el1) | (1 << 1));  // EL0VCTEN
 
     // FIXME: machine-specific
     bootinfo.memmap[0].base = (vaddr_t) __kernel_image_end;
@@ -106,6 +108,30 @@ void arm64_init(void) {
     }
 }
 
+/// Programs a PMU event counter. The counters are enabled and accessible from
+/// the user mode since boot.
+error_t arch_pmc_setup(unsigned counter, unsigned event) {
+    unsigned num_counters = (ARM64_MRS(pmcr_el0) >> 11) & 0b11111;
+    if (counter >= num_counters) {
+        return ERR_INVALID_ARG;
+    }
+
+    ARM64_MSR(pmselr_el0, (uint64_t) counter);
+    ARM64_MSR(pmxevtyper_el0, (uint64_t) event);
+    ARM64_MSR(pmxevcntr_el0, 0ull);
+    return OK;
+}
+
+/// Returns the current value of the virtual counter.
+uint64_t arch_timestamp(void) {
+    return ARM64_MRS(cntvct_el0);
+}
+
+/// Returns the frequency of arch_timestamp() in Hz.
+uint64_t arch_timestamp_hz(void) {
+    return ARM64_MRS(cntfrq_el0);
+}
+
 void arch_semihosting_halt(void) {
     // ARM Semihosting
     uint64_t params[] = {
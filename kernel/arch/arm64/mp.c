@@ -18,6 +18,11 @@ void mp_start(void) {
     machine_mp_start();
 }
 
+int mp_num_cpus(void) {
+    // TODO: smp
+    return 1;
+}
+
 void mp_reschedule(void) {
     // TODO:
 }
@@ -1,6 +1,7 @@
 #include <boot.h>
 #include <printk.h>
 #include <string.h>
+#include <syscall.h>
 #include <task.h>
 #include <types.h>
 
@@ -19,3 +20,15 @@ void arch_idle(void) {
 
 void arch_semihosting_halt(void) {
 }
+
+error_t arch_pmc_setup(unsigned counter, unsigned event) {
+    return ERR_UNAVAILABLE;
+}
+
+uint64_t arch_timestamp(void) {
+    return 0;
+}
+
+uint64_t arch_timestamp_hz(void) {
+    return 0;
+}
@@ -8,6 +8,10 @@ void halt(void) {
 void mp_start(void) {
 }
 
+int mp_num_cpus(void) {
+    return 1;
+}
+
 void mp_reschedule(void) {
 }
 
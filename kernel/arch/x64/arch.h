@@ -12,6 +12,9 @@
 #define IRQ_MAX    256
 #define TIMER_IRQ  0
 
+/// The maximum number of general-purpose performance counters used by a task.
+#define PMC_COUNTERS_MAX 8
+
 #define KERNEL_BASE_ADDR  0xffff800000000000
 #define STRAIGHT_MAP_ADDR 0x0000000010000000
 #define STRAIGHT_MAP_END  0xffff800000000000
@@ -24,6 +27,13 @@ struct arch_task {
     uint64_t gsbase;
     uint64_t fsbase;
     paddr_t pml4;
+    /// Performance counters set up by the task (a bitmap). They're programmed
+    /// only while the task is running.
+    uint8_t pmc_used;
+    /// IA32_PERFEVTSELx values.
+    uint64_t perfevtsel[PMC_COUNTERS_MAX];
+    /// Counter values saved when the task is switched out.
+    uint64_t pmc[PMC_COUNTERS_MAX];
 #ifdef CONFIG_HYPERVISOR
     struct vmx vmx;
 #endif
@@ -136,6 +146,7 @@ struct idtr {
 #define CR4_OSFXSR     (1ul << 9)
 #define CR4_OSXMMEXCPT (1ul << 10)
 #define CR4_VMXE       (1ul << 13)
+#define CR4_PCE        (1ul << 8)
 
 //
 //  Extended Control Register 0 (XCR0)
@@ -149,6 +160,9 @@ struct idtr {
 #define MSR_APIC_BASE        0x0000001b
 #define MSR_PERFEVTSEL(n)    (0x00000186 + (n))
 #define MSR_PERF_GLOBAL_CTRL 0x0000038f
+#define MSR_PMC(n)           (0x000000c1 + (n))
+#define MSR_A_PMC(n)         (0x000004c1 + (n))
+#define MSR_PERF_CAPS        0x00000345
 #define MSR_KERNEL_GS_BASE   0xc0000102
 #define MSR_EFER             0xc0000080
 #define MSR_STAR             0xc0000081
@@ -240,7 +254,7 @@ static inline void write_apic(paddr_t addr, uint32_t data) {
 
 // The maximum number of CPUs. Don't forget to expand the boot stack and
 // CPU-local variables space defined in kernel.ld as well!
-#define CPU_NUM_MAX     16
+#define NUM_CPUS_MAX    16
 #define CPUVAR_SIZE_MAX 0x4000  // Don't forget to update kernel.ld as well!
 
 extern char __mp_boot_trampoine[];      // paddr_t
@@ -366,6 +380,19 @@ static inline uint64_t asm_rdmsr(uint32_t reg) {
     return ((uint64_t) high << 32) | low;
 }
 
+static inline void asm_cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx,
+                             uint32_t *ecx, uint32_t *edx) {
+    __asm__ __volatile__("cpuid"
+                         : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                         : "a"(leaf), "c"(0));
+}
+
+static inline uint64_t asm_rdtsc(void) {
+    uint32_t low, high;
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t) high << 32) | low;
+}
+
 static inline void asm_invlpg(uint64_t vaddr) {
     __asm__ __volatile__("invlpg (%0)" :: "b"(vaddr) : "memory");
 }
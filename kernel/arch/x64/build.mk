@@ -1,4 +1,4 @@
-objs-y += task.o vm.o serial.o boot.o init.o interrupt.o trap.o mp.o
+objs-y += task.o vm.o serial.o boot.o init.o interrupt.o trap.o mp.o pmc.o
 objs-$(CONFIG_HYPERVISOR) += hv.o
 objs-$(CONFIG_X64_PRINTK_IN_SCREEN) += screen.o
 
@@ -106,6 +106,19 @@ static void syscall_init(void) {
     asm_wrmsr(MSR_EFER, asm_rdmsr(MSR_EFER) | EFER_SCE);
 }
 
+/// The TSC frequency in Hz.
+static uint64_t tsc_hz = 0;
+
+/// Returns the current time stamp counter.
+uint64_t arch_timestamp(void) {
+    return asm_rdtsc();
+}
+
+/// Returns the frequency of arch_timestamp() in Hz.
+uint64_t arch_timestamp_hz(void) {
+    return tsc_hz;
+}
+
 static void calibrate_apic_timer(void) {
     static uint32_t calibrated_count = 0;
 
@@ -129,6 +142,7 @@ static void calibrate_apic_timer(void) {
         // Reset the counter in APIC timer.
         write_apic(APIC_REG_TIMER_INITCNT, 0xffffffff);
         uint32_t start = read_apic(APIC_REG_TIMER_CURRENT);
+        uint64_t tsc_start = asm_rdtsc();
 
         // Wait for the PIT (it should take at least 1/TICK_HZ seconds).
         while ((asm_in8(KBC_PORT_B) & KBC_B_OUT2_STATUS) != 0) {}
@@ -136,6 +150,7 @@ static void calibrate_apic_timer(void) {
         // Compute the calibrated count.
         uint32_t end = read_apic(APIC_REG_TIMER_CURRENT);
         calibrated_count = start - end;
+        tsc_hz = (asm_rdtsc() - tsc_start) * TICK_HZ;
     }
 
     // Calibrate the APIC timer interval to fire the timer interrupt every
@@ -159,7 +174,7 @@ static void apic_init(void) {
     write_apic(APIC_REG_LVT_ERROR, 1 << 16 /* masked */);
 }
 
-static struct cpuvar x64_cpuvars[CPU_NUM_MAX];
+static struct cpuvar x64_cpuvars[NUM_CPUS_MAX];
 
 static void common_setup(void) {
     STATIC_ASSERT(sizeof(struct cpuvar) <= CPUVAR_SIZE_MAX);
@@ -172,7 +187,7 @@ static void common_setup(void) {
     asm_xsetbv(0, asm_xgetbv(0) | XCR0_SSE | XCR0_AVX);
 
     // Set RDGSBASE to enable the CPUVAR macro.
-    ASSERT(mp_self() < CPU_NUM_MAX);
+    ASSERT(mp_self() < NUM_CPUS_MAX);
     asm_wrgsbase((uint64_t) &x64_cpuvars[mp_self()]);
 
     apic_init();
@@ -252,6 +267,8 @@ __noreturn void arch_idle(void) {
 }
 
 void arch_semihosting_halt(void) {
+    serial_flush_sync();
+
     // QEMU
     __asm__ __volatile__("outw %0, %1" ::"a"((uint16_t) 0x2000),
                          "Nd"((uint16_t) 0x604));
@@ -7,6 +7,7 @@
 #include <arch.h>
 #include <kdebug.h>
 #include <printk.h>
+#include <profiler.h>
 #include <syscall.h>
 #include <task.h>
 
@@ -122,7 +123,18 @@ void x64_handle_interrupt(uint8_t vec, struct iframe *frame) {
             } else if (vec >= VECTOR_IRQ_BASE) {
                 int irq = vec - VECTOR_IRQ_BASE;
                 if (irq == TIMER_IRQ) {
+#ifdef CONFIG_PROFILER
+                    profiler_sample(frame->rip, frame->rbp,
+                                    frame->cs != KERNEL_CS);
+#endif
+                    // Drain the console in case the TX-empty interrupt
+                    // has been masked.
+                    serial_flush();
                     handle_timer_irq();
+                } else if (irq == CONSOLE_IRQ) {
+                    if (serial_handle_irq()) {
+                        handle_irq(irq);
+                    }
                 } else {
                     handle_irq(irq);
                 }
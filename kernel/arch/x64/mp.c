@@ -1,4 +1,5 @@
 #include "mp.h"
+#include "serial.h"
 #include <arch.h>
 #include <printk.h>
 #include <string.h>
@@ -161,6 +162,7 @@ void panic_unlock(void) {
 
 void halt(void) {
     halt_other_cpus();
+    serial_flush_sync();
     while (true) {
         __asm__ __volatile__("cli; hlt");
     }
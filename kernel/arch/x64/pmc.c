@@ -0,0 +1,134 @@
+#include "pmc.h"
+#include <arch.h>
+#include <syscall.h>
+#include <task.h>
+#include <types.h>
+
+// IA32_PERFEVTSELx bits.
+#define PERFEVTSEL_USR (1ul << 16)
+#define PERFEVTSEL_OS  (1ul << 17)
+#define PERFEVTSEL_EN  (1ul << 22)
+// IA32_PERF_CAPABILITIES bits.
+#define PERF_CAPS_FW_WRITE (1ul << 13)
+
+/// The architectural performance monitoring version or 0 if it's not
+/// supported. It's -1 if we've not yet checked it.
+static int pmc_version = -1;
+static unsigned pmc_num_counters = 0;
+/// Counters can be written in full-width through IA32_A_PMCx.
+static bool pmc_full_width = false;
+
+static void pmc_probe(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm_cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x0a) {
+        pmc_version = 0;
+        return;
+    }
+
+    // Architectural performance monitoring leaf.
+    asm_cpuid(0x0a, &eax, &ebx, &ecx, &edx);
+    unsigned num_counters = (eax >> 8) & 0xff;
+    pmc_num_counters = MIN(num_counters, PMC_COUNTERS_MAX);
+    pmc_version = pmc_num_counters ? (eax & 0xff) : 0;
+
+    // IA32_PERF_CAPABILITIES is available if PDCM is set.
+    asm_cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (ecx & (1 << 15)) {
+        pmc_full_width =
+            (asm_rdmsr(MSR_PERF_CAPS) & PERF_CAPS_FW_WRITE) != 0;
+    }
+}
+
+static void write_counter(unsigned counter, uint64_t value) {
+    if (pmc_full_width) {
+        asm_wrmsr(MSR_A_PMC(counter), value);
+    } else {
+        // Only the lower 32 bits (sign-extended) can be written.
+        asm_wrmsr(MSR_PMC(counter), value & 0xffffffff);
+    }
+}
+
+/// Saves the counters of `prev` and programs ones of `next` in the current CPU.
+/// RDPMC is allowed in the user mode only while a task which has set up
+/// counters is running.
+void pmc_switch(struct task *prev, struct task *next) {
+    if (!prev->arch.pmc_used && !next->arch.pmc_used) {
+        return;
+    }
+
+    for (unsigned i = 0; i < PMC_COUNTERS_MAX; i++) {
+        if (prev->arch.pmc_used & (1 << i)) {
+            asm_wrmsr(MSR_PERFEVTSEL(i), 0);
+            prev->arch.pmc[i] = asm_rdmsr(MSR_PMC(i));
+        }
+    }
+
+    if (!next->arch.pmc_used) {
+        asm_write_cr4(asm_read_cr4() & ~CR4_PCE);
+        return;
+    }
+
+    for (unsigned i = 0; i < PMC_COUNTERS_MAX; i++) {
+        if (next->arch.pmc_used & (1 << i)) {
+            write_counter(i, next->arch.pmc[i]);
+            asm_wrmsr(MSR_PERFEVTSEL(i), next->arch.perfevtsel[i]);
+        }
+    }
+
+    if (pmc_version >= 2) {
+        asm_wrmsr(MSR_PERF_GLOBAL_CTRL,
+                  asm_rdmsr(MSR_PERF_GLOBAL_CTRL) | next->arch.pmc_used);
+    }
+
+    asm_write_cr4(asm_read_cr4() | CR4_PCE);
+}
+
+/// Programs a general-purpose performance counter for the current task. `event`
+/// is the event select (bits 0-7) and the unit mask (bits 8-15) defined in the
+/// Intel SDM. The counter is saved and restored on context switches: it counts
+/// events only while the task is running on any CPU. RDPMC is enabled in the
+/// user mode so that the task can read the counter directly.
+error_t arch_pmc_setup(unsigned counter, unsigned event) {
+    if (event & ~0xffff) {
+        return ERR_INVALID_ARG;
+    }
+
+    if (pmc_version < 0) {
+        pmc_probe();
+    }
+
+    if (!pmc_version) {
+        return ERR_UNAVAILABLE;
+    }
+
+    if (counter >= pmc_num_counters) {
+        return ERR_INVALID_ARG;
+    }
+
+    struct arch_task *arch = &CURRENT->arch;
+    asm_wrmsr(MSR_PERFEVTSEL(counter), 0);
+    write_counter(counter, 0);
+    arch->pmc[counter] = 0;
+    if (!event) {
+        arch->pmc_used &= ~(1 << counter);
+        arch->perfevtsel[counter] = 0;
+        if (!arch->pmc_used) {
+            asm_write_cr4(asm_read_cr4() & ~CR4_PCE);
+        }
+
+        return OK;
+    }
+
+    arch->pmc_used |= 1 << counter;
+    arch->perfevtsel[counter] =
+        event | PERFEVTSEL_USR | PERFEVTSEL_OS | PERFEVTSEL_EN;
+    asm_wrmsr(MSR_PERFEVTSEL(counter), arch->perfevtsel[counter]);
+    if (pmc_version >= 2) {
+        asm_wrmsr(MSR_PERF_GLOBAL_CTRL,
+                  asm_rdmsr(MSR_PERF_GLOBAL_CTRL) | (1ul << counter));
+    }
+
+    asm_write_cr4(asm_read_cr4() | CR4_PCE);
+    return OK;
+}
@@ -0,0 +1,7 @@
+#ifndef __X64_PMC_H__
+#define __X64_PMC_H__
+
+struct task;
+void pmc_switch(struct task *prev, struct task *next);
+
+#endif
@@ -5,28 +5,94 @@
 #include <printk.h>
 #include <task.h>
 
+static struct tx_buf tx_buf;
+
 static void serial_write(char ch) {
     while ((asm_in8(IOPORT_SERIAL + LSR) & TX_READY) == 0) {}
     asm_out8(IOPORT_SERIAL, ch);
 }
 
+/// Enables the TX-empty interrupt only if there are pending characters.
+static void update_tx_interrupt(void) {
+    bool pending = tx_buf.head != tx_buf.tail;
+    asm_out8(IOPORT_SERIAL + IER, IER_RX | (pending ? IER_TX : 0));
+}
+
+/// Moves pending characters into the transmitter FIFO without waiting for it.
+void serial_flush(void) {
+    if (tx_buf.head == tx_buf.tail
+        || (asm_in8(IOPORT_SERIAL + LSR) & TX_READY) == 0) {
+        update_tx_interrupt();
+        return;
+    }
+
+    // The FIFO is empty: we can write up to FIFO_SIZE characters at once.
+    for (int i = 0; i < FIFO_SIZE && tx_buf.tail != tx_buf.head; i++) {
+        asm_out8(IOPORT_SERIAL, tx_buf.buf[tx_buf.tail]);
+        tx_buf.tail = (tx_buf.tail + 1) % TX_BUF_SIZE;
+    }
+
+    update_tx_interrupt();
+}
+
+/// Writes out all pending characters. Used when we can't wait for interrupts
+/// anymore (e.g. kernel panic).
+void serial_flush_sync(void) {
+    while (tx_buf.head != tx_buf.tail) {
+        serial_write(tx_buf.buf[tx_buf.tail]);
+        tx_buf.tail = (tx_buf.tail + 1) % TX_BUF_SIZE;
+    }
+
+    update_tx_interrupt();
+}
+
+/// Handles an interrupt from the serial port. Returns true if received
+/// characters are available.
+bool serial_handle_irq(void) {
+    serial_flush();
+    return (asm_in8(IOPORT_SERIAL + LSR) & RX_READY) != 0;
+}
+
+static void tx_buf_push(char ch) {
+    bool was_empty = tx_buf.head == tx_buf.tail;
+    size_t next = (tx_buf.head + 1) % TX_BUF_SIZE;
+    if (next == tx_buf.tail) {
+        // The buffer is full. Wait for the oldest character to be sent
+        // rather than dropping log messages.
+        serial_write(tx_buf.buf[tx_buf.tail]);
+        tx_buf.tail = (tx_buf.tail + 1) % TX_BUF_SIZE;
+    }
+
+    tx_buf.buf[tx_buf.head] = ch;
+    tx_buf.head = next;
+
+    // Make sure that the TX-empty interrupt drains the buffer even if the
+    // transmitter is busy when it's kicked.
+    if (was_empty) {
+        update_tx_interrupt();
+    }
+}
+
 void arch_printchar(char ch) {
 #ifdef CONFIG_X64_PRINTK_IN_SCREEN
     x64_screen_printchar(ch);
 #endif
 
-    serial_write(ch);
+    tx_buf_push(ch);
     if (ch == '\n') {
-        serial_write('\r');
+        tx_buf_push('\r');
+        // Kick the transmitter. The rest are sent from the TX-empty interrupt
+        // handler.
+        serial_flush();
     }
 }
 
 bool kdebug_is_readable(void) {
-    return (asm_in8(IOPORT_SERIAL + LSR) & 1) == 0;
+    return (asm_in8(IOPORT_SERIAL + LSR) & RX_READY) == 0;
 }
 
 int kdebug_readchar(void) {
-    if ((asm_in8(IOPORT_SERIAL + LSR) & 1) == 0) {
+    if ((asm_in8(IOPORT_SERIAL + LSR) & RX_READY) == 0) {
         return -1;
     }
 
@@ -42,7 +108,7 @@ void serial_init(void) {
     asm_out8(IOPORT_SERIAL + DLH, (divisor >> 8) & 0xff);
     asm_out8(IOPORT_SERIAL + LCR, 0x03);  // 8n1.
     asm_out8(IOPORT_SERIAL + FCR, 0x01);  // Enable FIFO.
-    asm_out8(IOPORT_SERIAL + IER, 0x01);  // Enable interrupts.
+    asm_out8(IOPORT_SERIAL + IER, IER_RX);  // Enable interrupts.
 }
 
 void serial_enable_interrupt(void) {
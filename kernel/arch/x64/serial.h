@@ -1,6 +1,8 @@
 #ifndef __X64_PRINTCHAR_H__
 #define __X64_PRINTCHAR_H__
 
+#include <types.h>
+
 #define IOPORT_SERIAL 0x3f8
 #define RBR           0
 #define DLL           0
@@ -9,9 +11,27 @@
 #define FCR           2
 #define LCR           3
 #define LSR           5
+#define RX_READY      0x01
 #define TX_READY      0x20
+#define IER_RX        0x01
+#define IER_TX        0x02
+#define FIFO_SIZE     16
+
+/// The size of the transmit buffer. Must be a power of two.
+#define TX_BUF_SIZE 4096
+
+/// The transmit (ring) buffer: printk appends characters to it and the serial
+/// TX-empty interrupt (or the timer as a fallback) drains it.
+struct tx_buf {
+    char buf[TX_BUF_SIZE];
+    size_t head;
+    size_t tail;
+};
 
 void serial_init(void);
 void serial_enable_interrupt(void);
+void serial_flush(void);
+void serial_flush_sync(void);
+bool serial_handle_irq(void);
 
 #endif
@@ -1,4 +1,6 @@
 #include "interrupt.h"
+#include "pmc.h"
+#include "task.h"
 #include "trap.h"
 #include "vm.h"
 #include <arch.h>
@@ -28,6 +30,7 @@ error_t arch_task_create(struct task *task, vaddr_t ip) {
     task->arch.xsave = xsave;
     task->arch.gsbase = 0;
     task->arch.fsbase = 0;
+    task->arch.pmc_used = 0;
 
 #ifdef CONFIG_HYPERVISOR
     task->arch.vmx.launched = false;
@@ -108,6 +111,8 @@ void arch_task_switch(struct task *prev, struct task *next) {
     uint64_t xsave_mask = asm_xgetbv(0);
     asm_xsave(prev->arch.xsave, xsave_mask);
     asm_xrstor(next->arch.xsave, xsave_mask);
+    // Switch performance counters set up by tasks.
+    pmc_switch(prev, next);
 
     // Restore registers (resume the next thread).
     switch_context(&prev->arch.rsp, &next->arch.rsp);
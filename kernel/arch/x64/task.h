@@ -1,6 +1,7 @@
 #ifndef __X64_TASK_H__
 #define __X64_TASK_H__
 
+struct task;
 void switch_fpu(void);
 
 #endif
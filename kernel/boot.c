@@ -1,5 +1,6 @@
 #include "boot.h"
 #include "kdebug.h"
+#include "kinfo.h"
 #include "printk.h"
 #include "syscall.h"
 #include "task.h"
@@ -125,6 +126,8 @@ __noreturn void kmain(struct bootinfo *bootinfo) {
     printf("\nBooting Resea " VERSION " (" GIT_REVISION ")...\n");
     task_init();
     mp_start();
+    kinfo_init();
+    bootinfo->kernel_info = kinfo_paddr();
 
     // Look for the boot elf header.
     char name[CONFIG_TASK_NAME_LEN];
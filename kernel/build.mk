@@ -1,2 +1,4 @@
-objs-y += boot.o task.o ipc.o syscall.o printk.o kdebug.o
+objs-y += boot.o task.o ipc.o syscall.o printk.o kdebug.o kinfo.o
+objs-$(CONFIG_PROFILER) += profiler.o
+objs-$(CONFIG_TRACE_BUFFER) += trace.o
 subdirs-y += arch/$(ARCH)
@@ -2,6 +2,7 @@
 #include "printk.h"
 #include "syscall.h"
 #include "task.h"
+#include "trace.h"
 #include <list.h>
 #include <string.h>
 #include <types.h>
@@ -92,11 +93,7 @@ static error_t ipc_slowpath(struct task *dst, task_t src,
 
         // Resume the receiver task.
         task_resume(dst);
-
-#ifdef CONFIG_TRACE_IPC
-        TRACE("IPC: %s: %s -> %s", msgtype2str(tmp_m.type), CURRENT->name,
-              dst->name);
-#endif
+        TRACE_EVENT(TRACE_IPC_SEND, 0, dst->tid, tmp_m.type);
     }
 
     // Receive a message.
@@ -126,6 +123,7 @@ static error_t ipc_slowpath(struct task *dst, task_t src,
         }
 
         // Received a message. Copy it into the receiver buffer.
+        TRACE_EVENT(TRACE_IPC_RECV, 0, tmp_m.src, tmp_m.type);
         if (flags & IPC_KERNEL) {
             memcpy((void *) m, &tmp_m, sizeof(struct message));
         } else {
@@ -167,11 +165,7 @@ error_t ipc(struct task *dst, task_t src, __user struct message *m,
     memcpy_from_user(&dst->m, m, sizeof(struct message));
     dst->m.src = CURRENT->tid;
     task_resume(dst);
-
-#    ifdef CONFIG_TRACE_IPC
-    TRACE("IPC: %s: %s -> %s (fastpath)", msgtype2str(dst->m.type),
-          CURRENT->name, dst->name);
-#    endif
+    TRACE_EVENT(TRACE_IPC_SEND, TRACE_FLAG_FASTPATH, dst->tid, dst->m.type);
 
     // The receive phase: wait for a message, copy it into the user's
     // buffer, and return to the user.
@@ -181,6 +175,8 @@ error_t ipc(struct task *dst, task_t src, __user struct message *m,
 
     // This user copy should not cause a page fault since we've filled the
     // page in the user copy above.
+    TRACE_EVENT(TRACE_IPC_RECV, TRACE_FLAG_FASTPATH, CURRENT->m.src,
+                CURRENT->m.type);
     memcpy_to_user(m, &CURRENT->m, sizeof(struct message));
     return OK;
 #else
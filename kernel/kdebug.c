@@ -1,7 +1,9 @@
 #include "kdebug.h"
 #include "ipc.h"
 #include "printk.h"
+#include "profiler.h"
 #include "task.h"
+#include "trace.h"
 #include <string.h>
 
 error_t kdebug_run(const char *cmdline, char *buf, size_t len) {
@@ -13,6 +15,16 @@ error_t kdebug_run(const char *cmdline, char *buf, size_t len) {
         INFO("");
         INFO("  ps - List tasks.");
         INFO("  q  - Quit the emulator.");
+#ifdef CONFIG_PROFILER
+        INFO("  prof start - Start the sampling profiler.");
+        INFO("  prof stop  - Stop the sampling profiler.");
+        INFO("  prof dump  - Print and consume the samples.");
+#endif
+#ifdef CONFIG_TRACE_BUFFER
+        INFO("  trace start - Start recording trace events.");
+        INFO("  trace stop  - Stop recording trace events.");
+        INFO("  trace dump  - Print and consume the trace events.");
+#endif
         INFO("");
     } else if (strcmp(cmdline, "ps") == 0) {
         task_dump();
@@ -21,6 +33,22 @@ error_t kdebug_run(const char *cmdline, char *buf, size_t len) {
         arch_semihosting_halt();
 #endif
         PANIC("halted by the kdebug");
+#ifdef CONFIG_PROFILER
+    } else if (strcmp(cmdline, "prof start") == 0) {
+        profiler_start();
+    } else if (strcmp(cmdline, "prof stop") == 0) {
+        profiler_stop();
+    } else if (strcmp(cmdline, "prof dump") == 0) {
+        profiler_dump();
+#endif
+#ifdef CONFIG_TRACE_BUFFER
+    } else if (strcmp(cmdline, "trace start") == 0) {
+        trace_start();
+    } else if (strcmp(cmdline, "trace stop") == 0) {
+        trace_stop();
+    } else if (strcmp(cmdline, "trace dump") == 0) {
+        trace_dump();
+#endif
     } else if (strcmp(cmdline, "_log") == 0) {
         if (!len) {
             return ERR_TOO_SMALL;
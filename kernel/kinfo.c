@@ -0,0 +1,28 @@
+#include "kinfo.h"
+#include "task.h"
+
+/// The kernel info page. It occupies a whole page since it's mapped into the
+/// user space: other kernel data must not be visible from there.
+static union {
+    struct kernel_info info;
+    uint8_t page[PAGE_SIZE];
+} kinfo __aligned(PAGE_SIZE);
+
+/// Advances the tick count. Called from the timer interrupt handler in the BSP.
+void kinfo_tick(void) {
+    kinfo.info.ticks++;
+}
+
+/// Returns the physical address of the kernel info page.
+paddr_t kinfo_paddr(void) {
+    return ptr2paddr(&kinfo);
+}
+
+/// Fills the kernel info page.
+void kinfo_init(void) {
+    kinfo.info.num_cpus = mp_num_cpus();
+    kinfo.info.tick_hz = TICK_HZ;
+    kinfo.info.timestamp_hz = arch_timestamp_hz();
+    kinfo.info.timestamp_base = arch_timestamp();
+    kinfo.info.ticks = 0;
+}
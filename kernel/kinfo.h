@@ -0,0 +1,11 @@
+#ifndef __KINFO_H__
+#define __KINFO_H__
+
+#include <kernel_info.h>
+#include <types.h>
+
+void kinfo_tick(void);
+paddr_t kinfo_paddr(void);
+void kinfo_init(void);
+
+#endif
@@ -38,6 +38,15 @@ static void printchar(__unused struct vprintf_context *ctx, char ch) {
     klog_write(ch);
 }
 
+/// Writes a string as it is (no formatting) into the console and the kernel
+/// log buffer.
+void printk_write(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        arch_printchar(s[i]);
+        klog_write(s[i]);
+    }
+}
+
 /// Prints a message. See vprintf() for detailed formatting specifications.
 void printk(const char *fmt, ...) {
     struct vprintf_context ctx = {.printchar = printchar};
@@ -15,6 +15,7 @@ struct klog {
 void klog_write(char ch);
 size_t klog_read(char *buf, size_t buf_len);
 void printk(const char *fmt, ...);
+void printk_write(const char *s, size_t len);
 
 // Implemented in arch.
 void arch_printchar(char ch);
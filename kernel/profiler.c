@@ -0,0 +1,92 @@
+#include "profiler.h"
+#include "printk.h"
+#include "task.h"
+#include <vprintf.h>
+
+/// Whether the profiler is taking samples.
+static bool enabled = false;
+/// Per-CPU sample buffers.
+static struct profiler_ring rings[NUM_CPUS_MAX];
+
+/// Reads a stack frame of the current task without triggering page faults:
+/// we're in an interrupt context and can't wait for the pager.
+static bool read_user_frame(vaddr_t fp, struct stack_frame *frame) {
+    if (!fp || !IS_ALIGNED(fp, sizeof(vaddr_t))
+        || is_kernel_addr_range(fp, sizeof(*frame))
+        || PAGE_SIZE - (fp % PAGE_SIZE) < sizeof(*frame)) {
+        return false;
+    }
+
+    paddr_t paddr = vm_resolve(CURRENT, ALIGN_DOWN(fp, PAGE_SIZE));
+    if (!paddr) {
+        return false;
+    }
+
+    *frame = *((struct stack_frame *) paddr2ptr(paddr + (fp % PAGE_SIZE)));
+    return true;
+}
+
+/// Records the interrupted context into the CPU-local ring buffer. Called from
+/// the timer interrupt handler. `fp` is the frame pointer of the interrupted
+/// context and is followed only if it's in the user space.
+void profiler_sample(vaddr_t ip, vaddr_t fp, bool user) {
+    if (!enabled) {
+        return;
+    }
+
+    struct profiler_ring *ring = &rings[mp_self()];
+    struct profiler_sample *sample = &ring->samples[ring->head];
+    sample->tid = CURRENT->tid;
+    sample->ip = ip;
+    sample->depth = 0;
+    while (user && sample->depth < CONFIG_PROFILER_BACKTRACE_DEPTH) {
+        struct stack_frame frame;
+        if (!read_user_frame(fp, &frame) || !frame.return_addr) {
+            break;
+        }
+
+        sample->frames[sample->depth++] = frame.return_addr;
+        if ((vaddr_t) frame.next <= fp) {
+            // The stack grows downwards: a frame must be above the previous
+            // one. Otherwise the frame chain is broken.
+            break;
+        }
+
+        fp = (vaddr_t) frame.next;
+    }
+
+    ring->head = (ring->head + 1) % CONFIG_PROFILER_NUM_SAMPLES;
+    if (ring->head == ring->tail) {
+        // The buffer is full. Discard the oldest sample.
+        ring->tail = (ring->tail + 1) % CONFIG_PROFILER_NUM_SAMPLES;
+    }
+}
+
+/// Starts taking samples.
+void profiler_start(void) {
+    enabled = true;
+}
+
+/// Stops taking samples.
+void profiler_stop(void) {
+    enabled = false;
+}
+
+/// Prints and consumes the samples in the ring buffers. Each line is in the
+/// form of `@prof <task> <ip> <return addresses>...` and can be converted into
+/// folded stacks by tools/prof2folded.py.
+void profiler_dump(void) {
+    for (int cpu = 0; cpu < mp_num_cpus(); cpu++) {
+        struct profiler_ring *ring = &rings[cpu];
+        while (ring->tail != ring->head) {
+            struct profiler_sample *sample = &ring->samples[ring->tail];
+            struct task *task = task_lookup_unchecked(sample->tid);
+            printk("@prof %s %p", task ? task->name : "(idle)", sample->ip);
+            for (unsigned i = 0; i < sample->depth; i++) {
+                printk(" %p", sample->frames[i]);
+            }
+            printk("\n");
+            ring->tail = (ring->tail + 1) % CONFIG_PROFILER_NUM_SAMPLES;
+        }
+    }
+}
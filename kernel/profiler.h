@@ -0,0 +1,31 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <config.h>
+#include <types.h>
+
+/// A sample taken by the profiler on a timer tick.
+struct profiler_sample {
+    /// The task ID of the interrupted task.
+    task_t tid;
+    /// The number of valid entries in `frames`.
+    unsigned depth;
+    /// The interrupted instruction pointer.
+    vaddr_t ip;
+    /// Return addresses of the interrupted task (innermost first).
+    vaddr_t frames[CONFIG_PROFILER_BACKTRACE_DEPTH];
+};
+
+/// The per-CPU sample (ring) buffer.
+struct profiler_ring {
+    struct profiler_sample samples[CONFIG_PROFILER_NUM_SAMPLES];
+    size_t head;
+    size_t tail;
+};
+
+void profiler_sample(vaddr_t ip, vaddr_t fp, bool user);
+void profiler_start(void);
+void profiler_stop(void);
+void profiler_dump(void);
+
+#endif
@@ -1,6 +1,7 @@
 #include "syscall.h"
 #include "ipc.h"
 #include "kdebug.h"
+#include "kinfo.h"
 #include "printk.h"
 #include "task.h"
 #include <arch.h>
@@ -156,6 +157,16 @@ static error_t sys_irq_release(int irq) {
     return task_unlisten_irq(irq);
 }
 
+/// Configures a hardware performance counter for the current task. `event` is
+/// an arch-specific event number. 0 disables the counter.
+static error_t sys_pmc_setup(unsigned counter, unsigned event) {
+    if (!CAPABLE(CURRENT, CAP_KDEBUG)) {
+        return ERR_NOT_PERMITTED;
+    }
+
+    return arch_pmc_setup(counter, event);
+}
+
 /// Resolves the physical memory address mapped from `vaddr`.
 static paddr_t resolve_paddr(vaddr_t vaddr) {
     if (CURRENT->tid == INIT_TASK) {
@@ -195,7 +206,12 @@ static error_t sys_vm_map(task_t tid, vaddr_t vaddr, vaddr_t src, vaddr_t kpage,
     // Please note that these paddr checks are added for debugging purpose, not
     // security: the user is able to access the kernel memory space by modifying
     // the page table directly.
-    if (is_kernel_paddr(paddr)) {
+    //
+    // The kernel info page is the only exception: it can be mapped as
+    // read-only.
+    bool is_kernel_info = paddr == kinfo_paddr()
+                          && MAP_TYPE(flags) == MAP_TYPE_READONLY;
+    if (is_kernel_paddr(paddr) && !is_kernel_info) {
         WARN_DBG("paddr %p points to a kernel memory area", paddr);
         return ERR_NOT_ACCEPTABLE;
     }
@@ -244,9 +260,8 @@ static error_t sys_console_write(__user const char *buf, size_t buf_len) {
     while (remaining > 0) {
         int copy_len = MIN(remaining, (int) sizeof(kbuf));
         memcpy_from_user(kbuf, buf, copy_len);
-        for (int i = 0; i < copy_len; i++) {
-            printk("%c", kbuf[i]);
-        }
+        printk_write(kbuf, copy_len);
+        buf += copy_len;
         remaining -= copy_len;
     }
 
@@ -350,6 +365,9 @@ long handle_syscall(int n, long a1, long a2, long a3, long a4, long a5) {
         case SYS_IRQ_RELEASE:
             ret = sys_irq_release(a1);
             break;
+        case SYS_PMC_SETUP:
+            ret = sys_pmc_setup(a1, a2);
+            break;
         case SYS_KDEBUG:
             ret = sys_kdebug((__user const char *) a1, a2, (__user char *) a3,
                              a4);
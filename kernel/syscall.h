@@ -20,5 +20,6 @@ void abi_emu_hook(trap_frame_t *frame, enum abi_hook_type type);
 // Implemented in arch.
 void arch_memcpy_from_user(void *dst, __user const void *src, size_t len);
 void arch_memcpy_to_user(__user void *dst, const void *src, size_t len);
+__mustuse error_t arch_pmc_setup(unsigned counter, unsigned event);
 
 #endif
@@ -1,8 +1,10 @@
 #include "task.h"
 #include "ipc.h"
 #include "kdebug.h"
+#include "kinfo.h"
 #include "printk.h"
 #include "syscall.h"
+#include "trace.h"
 #include <arch.h>
 #include <config.h>
 #include <list.h>
@@ -246,6 +248,7 @@ void task_switch(void) {
         return;
     }
 
+    TRACE_EVENT(TRACE_SWITCH, 0, next->tid, 0);
     CURRENT = next;
     arch_task_switch(prev, next);
 
@@ -317,6 +320,8 @@ error_t vm_unmap(struct task *task, vaddr_t vaddr) {
 void handle_timer_irq(void) {
     bool resumed_by_timeout = false;
     if (mp_is_bsp()) {
+        kinfo_tick();
+
         // Handle task timeouts.
         for (int i = 0; i < CONFIG_NUM_TASKS; i++) {
             struct task *task = &tasks[i];
@@ -344,6 +349,7 @@ void handle_timer_irq(void) {
 void handle_irq(unsigned irq) {
     struct task *owner = irq_owners[irq];
     if (owner) {
+        TRACE_EVENT(TRACE_IRQ, 0, irq, owner->tid);
         notify(owner, NOTIFY_IRQ);
         if (CURRENT == IDLE_TASK) {
             task_switch();
@@ -363,8 +369,10 @@ void handle_page_fault(vaddr_t addr, vaddr_t ip, unsigned fault) {
     m.page_fault.vaddr = addr;
     m.page_fault.ip = ip;
     m.page_fault.fault = fault;
+    TRACE_EVENT(TRACE_PAGE_FAULT, 0, addr, ip);
     error_t err = ipc(CURRENT->pager, CURRENT->pager->tid,
                       (__user struct message *) &m, IPC_CALL | IPC_KERNEL);
+    TRACE_EVENT(TRACE_PAGE_FAULT_DONE, 0, addr, 0);
     if (err != OK || m.type != PAGE_FAULT_REPLY_MSG) {
         task_exit(EXP_INVALID_MSG_FROM_PAGER);
     }
@@ -130,6 +130,8 @@ void mp_start(void);
 int mp_self(void);
 int mp_num_cpus(void);
 void mp_reschedule(void);
+uint64_t arch_timestamp(void);
+uint64_t arch_timestamp_hz(void);
 __mustuse error_t arch_task_create(struct task *task, vaddr_t ip);
 void arch_task_destroy(struct task *task);
 void arch_task_switch(struct task *prev, struct task *next);
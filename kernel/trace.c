@@ -0,0 +1,63 @@
+#include "trace.h"
+#include "printk.h"
+#include "task.h"
+
+/// Whether the kernel is recording events.
+static bool enabled = false;
+/// Per-CPU event buffers.
+static struct trace_ring rings[NUM_CPUS_MAX];
+
+/// Records an event into the CPU-local ring buffer. Use TRACE_EVENT() instead
+/// so that it compiles to nothing if the trace buffer is disabled.
+void trace_event(unsigned type, unsigned flags, uint64_t arg0, uint64_t arg1) {
+    if (!enabled) {
+        return;
+    }
+
+    struct trace_ring *ring = &rings[mp_self()];
+    struct trace_event *e = &ring->events[ring->head];
+    e->timestamp = arch_timestamp();
+    e->type = type;
+    e->flags = flags;
+    e->task = CURRENT->tid;
+    e->arg0 = arg0;
+    e->arg1 = arg1;
+
+    ring->head = (ring->head + 1) % CONFIG_TRACE_BUFFER_LEN;
+    if (ring->head == ring->tail) {
+        // The buffer is full. Discard the oldest event.
+        ring->tail = (ring->tail + 1) % CONFIG_TRACE_BUFFER_LEN;
+    }
+}
+
+/// Starts recording events.
+void trace_start(void) {
+    enabled = true;
+}
+
+/// Stops recording events.
+void trace_stop(void) {
+    enabled = false;
+}
+
+/// Prints and consumes the events in the ring buffers. The output can be
+/// converted into the Chrome trace event format by tools/trace2json.py.
+void trace_dump(void) {
+    printk("@trace-hz %p\n", arch_timestamp_hz());
+    for (int i = 0; i < CONFIG_NUM_TASKS; i++) {
+        struct task *task = task_lookup(i + 1);
+        if (task) {
+            printk("@trace-task %x %s\n", task->tid, task->name);
+        }
+    }
+
+    for (int cpu = 0; cpu < NUM_CPUS_MAX; cpu++) {
+        struct trace_ring *ring = &rings[cpu];
+        while (ring->tail != ring->head) {
+            struct trace_event *e = &ring->events[ring->tail];
+            printk("@trace %x %p %x %x %x %p %p\n", cpu, e->timestamp, e->type,
+                   e->flags, e->task, e->arg0, e->arg1);
+            ring->tail = (ring->tail + 1) % CONFIG_TRACE_BUFFER_LEN;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <config.h>
+#include <types.h>
+
+//
+//  Trace event types.
+//
+/// A message has been sent. `arg0` is the receiver and `arg1` is the message
+/// type.
+#define TRACE_IPC_SEND 1
+/// A message has been received. `arg0` is the sender and `arg1` is the message
+/// type.
+#define TRACE_IPC_RECV 2
+/// A context switch. `task` is the previous task and `arg0` is the next one.
+#define TRACE_SWITCH 3
+/// An IRQ has been notified. `arg0` is the IRQ number and `arg1` is its owner.
+#define TRACE_IRQ 4
+/// A page fault message is being sent. `arg0` is the faulted address and
+/// `arg1` is the instruction pointer.
+#define TRACE_PAGE_FAULT 5
+/// The pager has resolved the page fault. `arg0` is the faulted address.
+#define TRACE_PAGE_FAULT_DONE 6
+
+//
+//  Trace event flags.
+//
+/// The message has been delivered in the IPC fastpath.
+#define TRACE_FLAG_FASTPATH (1 << 0)
+
+/// A trace event.
+struct trace_event {
+    /// The timestamp from arch_timestamp().
+    uint64_t timestamp;
+    /// The event type (TRACE_*).
+    uint16_t type;
+    /// Flags (TRACE_FLAG_*).
+    uint16_t flags;
+    /// The current task ID.
+    task_t task;
+    /// Event-specific arguments.
+    uint64_t arg0;
+    uint64_t arg1;
+} __packed;
+
+/// The per-CPU trace event (ring) buffer.
+struct trace_ring {
+    struct trace_event events[CONFIG_TRACE_BUFFER_LEN];
+    size_t head;
+    size_t tail;
+};
+
+#ifdef CONFIG_TRACE_BUFFER
+#    define TRACE_EVENT(type, flags, arg0, arg1)                               \
+        trace_event(type, flags, (uint64_t)(arg0), (uint64_t)(arg1))
+#else
+#    define TRACE_EVENT(type, flags, arg0, arg1)
+#endif
+
+void trace_event(unsigned type, unsigned flags, uint64_t arg0, uint64_t arg1);
+void trace_start(void);
+void trace_stop(void);
+void trace_dump(void);
+
+#endif
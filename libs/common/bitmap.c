@@ -7,7 +7,7 @@ void bitmap_fill(uint8_t *bitmap, size_t size, int value) {
 
 int bitmap_get(uint8_t *bitmap, size_t size, size_t index) {
     DEBUG_ASSERT(index < size * BITS_PER_BYTE);
-    return bitmap[index / BITS_PER_BYTE] >> (index % BITS_PER_BYTE);
+    return (bitmap[index / BITS_PER_BYTE] >> (index % BITS_PER_BYTE)) & 1;
 }
 
 void bitmap_set(uint8_t *bitmap, size_t size, size_t index) {
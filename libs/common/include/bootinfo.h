@@ -26,6 +26,8 @@ struct bootinfo_memmap_entry {
 
 struct bootinfo {
     struct bootinfo_memmap_entry memmap[NUM_BOOTINFO_MEMMAP_MAX];
+    /// The physical address of the kernel info page (struct kernel_info).
+    uint64_t kernel_info;
 } __packed;
 
 // The maximum size hard-coded in start.S
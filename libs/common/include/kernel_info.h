@@ -0,0 +1,23 @@
+#ifndef __KERNEL_INFO_H__
+#define __KERNEL_INFO_H__
+
+#include <types.h>
+
+/// The kernel info page: a read-only page filled by the kernel and mapped into
+/// every task so that tasks can read the time without system calls.
+struct kernel_info {
+    /// The number of CPUs.
+    uint32_t num_cpus;
+    /// The frequency of the timer interrupt.
+    uint32_t tick_hz;
+    /// The frequency of the timestamp counter (TSC on x64) in Hz.
+    uint64_t timestamp_hz;
+    /// The timestamp counter value at boot.
+    uint64_t timestamp_base;
+    /// The number of timer ticks since boot.
+    volatile uint64_t ticks;
+} __packed;
+
+STATIC_ASSERT(sizeof(struct kernel_info) <= PAGE_SIZE);
+
+#endif
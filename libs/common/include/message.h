@@ -4,6 +4,17 @@
 #include <idl.h> /* generated by genidl.py */
 #include <types.h>
 
+/// The maximum number of segments in a vectored ool payload.
+#define OOL_IOV_MAX 16
+/// The maximum number of ool receive buffers registered in a task at once.
+#define OOL_RECV_BUFS_MAX 16
+
+/// A segment of a vectored ool payload (MSG_IOV).
+struct ool_iovec {
+    void *base;
+    size_t len;
+};
+
 #ifdef __LP64__
 #    define MESSAGE_SIZE 256
 #else
@@ -24,9 +35,12 @@ struct message {
 
         // The common header of message fields.
         struct {
-            /// The ool pointer to be sent. Used if MSG_OOL is set.
+            /// The ool pointer to be sent. Used if MSG_OOL is set. If MSG_IOV
+            /// is also set, it points to an array of `struct ool_iovec` and
+            /// the segments are sent as a contiguous payload.
             void *ool_ptr;
-            /// The size of ool payload in bytes.
+            /// The size of ool payload in bytes, or the number of segments if
+            /// MSG_IOV is set.
             size_t ool_len;
         };
 
@@ -138,6 +138,7 @@ typedef int error_t;
 #define SYS_VM_UNMAP      14
 #define SYS_IRQ_ACQUIRE   15
 #define SYS_IRQ_RELEASE   16
+#define SYS_PMC_SETUP     17
 
 // Task flags.
 #define TASK_ALL_CAPS (1 << 0)
@@ -166,6 +167,8 @@ typedef int error_t;
 // Flags in the message type (m->type).
 #define MSG_STR      (1 << 30)
 #define MSG_OOL      (1 << 29)
+#define MSG_IOV      (1 << 28)
+#define MSG_INLINE   (1 << 27)
 #define MSG_ID(type) ((type) &0xffff)
 
 // Notifications.
@@ -37,6 +37,7 @@ void vprintf_with_context(struct vprintf_context *ctx, const char *fmt,
 void printf_with_context(struct vprintf_context *ctx, const char *fmt, ...);
 int vsnprintf(char *buf, size_t size, const char *fmt, va_list vargs);
 int snprintf(char *buf, size_t size, const char *fmt, ...);
+const struct symbol *find_symbol(vaddr_t vaddr);
 void backtrace(void);
 const char *err2str(error_t err);
 const char *msgtype2str(int type);
@@ -209,7 +209,7 @@ static const struct symbol_table symbol_table = {
 /// Resolves a symbol name and the offset from the beginning of symbol.
 /// This function returns NULL if the symbol does not
 /// exist in the symbol table.
-static const struct symbol *find_symbol(vaddr_t vaddr) {
+const struct symbol *find_symbol(vaddr_t vaddr) {
     // Do a binary search.
     int32_t l = -1;
     int32_t r = symbol_table.num_symbols;
@@ -5,16 +5,18 @@
 
 /// Allocates a DMA area which is accessible from the DMA controller.
 dma_t dma_alloc(size_t len, unsigned flags) {
+    size_t num_pages = ALIGN_UP(len, PAGE_SIZE) / PAGE_SIZE;
     struct message m;
     m.type = VM_ALLOC_PAGES_MSG;
     m.vm_alloc_pages.paddr = 0;
-    m.vm_alloc_pages.num_pages = ALIGN_UP(len, PAGE_SIZE) / PAGE_SIZE;
+    m.vm_alloc_pages.num_pages = num_pages;
     error_t err = ipc_call(VM_TASK, &m);
     ASSERT_OK(err);
     ASSERT(m.type == VM_ALLOC_PAGES_REPLY_MSG);
 
     struct dma *dma = malloc(sizeof(*dma));
     dma->vaddr = m.vm_alloc_pages_reply.vaddr;
+    dma->num_pages = num_pages;
 
     // Use paddr for the device address for now.
     dma->daddr = m.vm_alloc_pages_reply.paddr;
@@ -23,7 +25,13 @@ dma_t dma_alloc(size_t len, unsigned flags) {
 
 /// Frees a DMA area.
 void dma_free(dma_t dma) {
-    // TODO:
+    struct message m;
+    m.type = VM_FREE_PAGES_MSG;
+    m.vm_free_pages.vaddr = dma->vaddr;
+    m.vm_free_pages.num_pages = dma->num_pages;
+    error_t err = ipc_call(VM_TASK, &m);
+    ASSERT_OK(err);
+    free(dma);
 }
 
 /// Performs arch-specific pre-DMA work after writing into the DMA area.
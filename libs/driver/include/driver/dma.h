@@ -8,6 +8,7 @@ typedef paddr_t daddr_t;
 struct dma {
     vaddr_t vaddr;
     daddr_t daddr;
+    size_t num_pages;
 };
 
 typedef struct dma *dma_t;
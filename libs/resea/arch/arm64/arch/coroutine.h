@@ -0,0 +1,21 @@
+#ifndef __ARCH_COROUTINE_H__
+#define __ARCH_COROUTINE_H__
+
+#include <types.h>
+
+void arch_coroutine_switch(vaddr_t *prev_sp, vaddr_t next_sp);
+
+/// Builds the initial stack frame of a coroutine: arch_coroutine_switch()
+/// restores the callee-saved registers (x19-x30) and returns to `entry` (x30).
+static inline vaddr_t arch_coroutine_init_stack(vaddr_t stack_top,
+                                                vaddr_t entry) {
+    uint64_t *sp = (uint64_t *) ALIGN_DOWN(stack_top, 16) - 12;
+    for (int i = 0; i < 12; i++) {
+        sp[i] = 0;
+    }
+
+    sp[11] = entry; // x30 (the link register)
+    return (vaddr_t) sp;
+}
+
+#endif
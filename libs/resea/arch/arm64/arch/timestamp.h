@@ -0,0 +1,13 @@
+#ifndef __ARCH_TIMESTAMP_H__
+#define __ARCH_TIMESTAMP_H__
+
+#include <types.h>
+
+/// Reads the virtual counter.
+static inline uint64_t arch_timestamp(void) {
+    uint64_t value;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+}
+
+#endif
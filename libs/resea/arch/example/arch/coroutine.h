@@ -0,0 +1,14 @@
+#ifndef __ARCH_COROUTINE_H__
+#define __ARCH_COROUTINE_H__
+
+#include <types.h>
+
+static inline void arch_coroutine_switch(vaddr_t *prev_sp, vaddr_t next_sp) {
+}
+
+static inline vaddr_t arch_coroutine_init_stack(vaddr_t stack_top,
+                                                vaddr_t entry) {
+    return stack_top;
+}
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef __ARCH_TIMESTAMP_H__
+#define __ARCH_TIMESTAMP_H__
+
+#include <types.h>
+
+static inline uint64_t arch_timestamp(void) {
+    return 0;
+}
+
+#endif
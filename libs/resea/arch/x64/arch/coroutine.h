@@ -0,0 +1,22 @@
+#ifndef __ARCH_COROUTINE_H__
+#define __ARCH_COROUTINE_H__
+
+#include <types.h>
+
+void arch_coroutine_switch(vaddr_t *prev_sp, vaddr_t next_sp);
+
+/// Builds the initial stack frame of a coroutine: arch_coroutine_switch()
+/// pops the callee-saved registers (rbp, rbx, r12-r15) and returns to `entry`.
+static inline vaddr_t arch_coroutine_init_stack(vaddr_t stack_top,
+                                                vaddr_t entry) {
+    uint64_t *sp = (uint64_t *) ALIGN_DOWN(stack_top, 16);
+    *--sp = 0;     // The return address of `entry` to stop backtracing.
+    *--sp = entry; // Popped by `ret`.
+    for (int i = 0; i < 6; i++) {
+        *--sp = 0;
+    }
+
+    return (vaddr_t) sp;
+}
+
+#endif
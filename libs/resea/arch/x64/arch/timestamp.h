@@ -0,0 +1,13 @@
+#ifndef __ARCH_TIMESTAMP_H__
+#define __ARCH_TIMESTAMP_H__
+
+#include <types.h>
+
+/// Reads the timestamp counter (TSC).
+static inline uint64_t arch_timestamp(void) {
+    uint32_t low, high;
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t) high << 32) | low;
+}
+
+#endif
@@ -1 +1 @@
-objs-y += start.o
+objs-y += start.o coroutine.o
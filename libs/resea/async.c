@@ -1,69 +1,262 @@
 #include <resea/async.h>
 #include <resea/ipc.h>
 #include <resea/malloc.h>
+#include <resea/printf.h>
 #include <string.h>
 
-#define NUM_BUCKETS 32
+/// A queue of messages sent to a task.
+struct async_queue {
+    list_t messages;
+    size_t len;
+};
 
-/// A hash table of async message queues.
-static list_t *queues[NUM_BUCKETS];
+/// Async message queues indexed by the destination task ID.
+static struct async_queue queues[CONFIG_NUM_TASKS + 1];
 
-static list_t *get_queue(task_t dst) {
-    unsigned index = dst % NUM_BUCKETS;
-    list_t *q = queues[index];
-    if (!q) {
-        q = malloc(sizeof(*q));
-        list_init(q);
-        queues[index] = q;
+static struct async_queue *get_queue(task_t dst) {
+    if (dst <= 0 || dst > CONFIG_NUM_TASKS) {
+        return NULL;
+    }
+
+    struct async_queue *q = &queues[dst];
+    if (!q->messages.next) {
+        list_init(&q->messages);
     }
 
     return q;
 }
 
+static struct async_message *pop_message(struct async_queue *q) {
+    struct async_message *am =
+        LIST_POP_FRONT(&q->messages, struct async_message, next);
+    if (am) {
+        q->len--;
+    }
+
+    return am;
+}
+
+/// Returns true if the message has a ool payload. An error message (a negative
+/// type) has no payloads.
+static bool has_ool(struct message *m) {
+    return !IS_ERROR(m->type) && (m->type & MSG_OOL);
+}
+
+/// Frees a delivered message. The ool payload is owned by the queue.
+static void free_message(struct async_message *am) {
+    if (has_ool(&am->m)) {
+        free(am->m.ool_ptr);
+    }
+
+    free(am);
+}
+
 error_t async_send(task_t dst, struct message *m) {
-    list_t *q = get_queue(dst);
+    struct async_queue *q = get_queue(dst);
+    if (!q) {
+        return ERR_INVALID_ARG;
+    }
+
     struct async_message *am = malloc(sizeof(*am));
     am->dst = dst;
     memcpy(&am->m, m, sizeof(am->m));
+    if (has_ool(m) && (m->type & (MSG_STR | MSG_IOV)) == MSG_STR) {
+        am->m.ool_len = strlen(m->ool_ptr) + 1;
+    }
+
     list_nullify(&am->next);
-    list_push_back(q, &am->next);
+    list_push_back(&q->messages, &am->next);
+    q->len++;
 
-    // Notify the destination task that a new async message is available.
-    return ipc_notify(dst, NOTIFY_ASYNC);
+    // Notify the destination task that a new async message is available. If
+    // the queue was not empty, it has already been notified.
+    return (q->len == 1) ? ipc_notify(dst, NOTIFY_ASYNC) : OK;
+}
+
+static void post_async_recv(task_t src, struct message *m) {
+    if (src != VM_TASK) {
+        return;
+    }
+
+    // We drain messages from vm: it's safe to cache lookups.
+    ipc_lookup_notify_exit();
+    if (m->type == DISCOVERY_SERVICE_EXITED_MSG) {
+        ipc_lookup_invalidate(m->discovery_service_exited.task);
+    }
 }
 
 error_t async_recv(task_t src, struct message *m) {
     m->type = ASYNC_MSG;
-    return ipc_call(src, m);
+    error_t err = ipc_call(src, m);
+    if (err == OK) {
+        post_async_recv(src, m);
+    }
+
+    return err;
 }
 
-error_t async_reply(task_t dst) {
-    bool sent = false;
-    LIST_FOR_EACH (am, get_queue(dst), struct async_message, next) {
-        if (am->dst == dst) {
-            if (sent) {
-                // Notify that we have more messages for `dst`.
-                ipc_notify(dst, NOTIFY_ASYNC);
-            } else {
-                ipc_reply(dst, &am->m);
-                list_remove(&am->next);
-                free(am);
-                sent = true;
+/// Receives up to `max` pending messages from `src` at once. The server must
+/// handle `ASYNC_BATCH_MSG` by `async_reply_batch`.
+error_t async_recv_batch(task_t src, struct message *msgs, size_t max,
+                         size_t *num_msgs) {
+    struct message m;
+    m.type = ASYNC_BATCH_MSG;
+    m.async_batch.max = MIN(max, ASYNC_BATCH_MAX);
+    OK_OR_RETURN(ipc_call(src, &m));
+    if (m.type != ASYNC_BATCH_REPLY_MSG) {
+        return ERR_INVALID_ARG;
+    }
+
+    // Each message is followed by its ool payload.
+    uint8_t *p = m.async_batch_reply.msgs;
+    uint8_t *end = p + m.async_batch_reply.msgs_len;
+    size_t num = 0;
+    while (num < m.async_batch_reply.num_msgs && num < max) {
+        struct message *msg = &msgs[num];
+        if (p + sizeof(*msg) > end) {
+            break;
+        }
+
+        memcpy(msg, p, sizeof(*msg));
+        p += sizeof(*msg);
+        msg->src = src;
+        if (has_ool(msg)) {
+            if (msg->type & (MSG_IOV | MSG_INLINE)
+                || msg->ool_len > (size_t)(end - p)) {
+                break;
             }
+
+            // Allocate an extra byte for the terminating NUL of `str`.
+            uint8_t *buf = malloc(msg->ool_len + 1);
+            memcpy(buf, p, msg->ool_len);
+            buf[msg->ool_len] = '\0';
+            msg->ool_ptr = buf;
+            p += msg->ool_len;
         }
+
+        post_async_recv(src, msg);
+        num++;
     }
 
-    // Return ER_NOT_FOUND if there're no messages asynchronously sent to `dst`
-    // in the queue.
-    return (sent) ? OK : ERR_NOT_FOUND;
+    free(m.async_batch_reply.msgs);
+    if (num < m.async_batch_reply.num_msgs) {
+        WARN_DBG("received a malformed async batch from #%d", src);
+        for (size_t i = 0; i < num; i++) {
+            if (has_ool(&msgs[i])) {
+                free(msgs[i].ool_ptr);
+            }
+        }
+
+        return ERR_INVALID_ARG;
+    }
+
+    *num_msgs = num;
+    return OK;
 }
 
-bool async_is_empty(task_t dst) {
-    LIST_FOR_EACH (am, get_queue(dst), struct async_message, next) {
-        if (am->dst == dst) {
-            return false;
+error_t async_reply(task_t dst) {
+    struct async_queue *q = get_queue(dst);
+    struct async_message *am = q ? pop_message(q) : NULL;
+    if (!am) {
+        // There're no messages asynchronously sent to `dst` in the queue.
+        return ERR_NOT_FOUND;
+    }
+
+    ipc_reply(dst, &am->m);
+    free_message(am);
+
+    // Notify that we have more messages for `dst`.
+    if (q->len > 0) {
+        ipc_notify(dst, NOTIFY_ASYNC);
+    }
+
+    return OK;
+}
+
+/// Replies to `ASYNC_BATCH_MSG` with up to `max` pending messages. Unlike
+/// `async_reply`, it replies even if there're no pending messages.
+error_t async_reply_batch(task_t dst, size_t max) {
+    struct async_queue *q = get_queue(dst);
+    if (!q) {
+        return ERR_INVALID_ARG;
+    }
+
+    // Send messages and their ool payloads as a vectored payload.
+    struct async_message *ams[ASYNC_BATCH_MAX];
+    struct ool_iovec iov[OOL_IOV_MAX];
+    size_t num_msgs = 0;
+    size_t num_iov = 0;
+    LIST_FOR_EACH (am, &q->messages, struct async_message, next) {
+        size_t num_segments = has_ool(&am->m) ? 2 : 1;
+        if (num_msgs == MIN(max, ASYNC_BATCH_MAX)
+            || num_iov + num_segments > OOL_IOV_MAX) {
+            break;
+        }
+
+        iov[num_iov].base = &am->m;
+        iov[num_iov].len = sizeof(am->m);
+        num_iov++;
+        if (has_ool(&am->m)) {
+            iov[num_iov].base = am->m.ool_ptr;
+            iov[num_iov].len = am->m.ool_len;
+            num_iov++;
         }
+
+        ams[num_msgs++] = am;
     }
 
-    return true;
+    struct message r;
+    r.type = ASYNC_BATCH_REPLY_MSG | MSG_IOV;
+    r.async_batch_reply.num_msgs = num_msgs;
+    r.async_batch_reply.msgs = iov;
+    r.async_batch_reply.msgs_len = num_iov;
+    ipc_reply(dst, &r);
+
+    for (size_t i = 0; i < num_msgs; i++) {
+        pop_message(q);
+        free_message(ams[i]);
+    }
+
+    // Notify that we have more messages for `dst`.
+    if (q->len > 0) {
+        ipc_notify(dst, NOTIFY_ASYNC);
+    }
+
+    return OK;
+}
+
+/// Replies to `dst` like `ipc_reply`. If `dst` is not waiting for the reply
+/// (it has sent the request by `ev_call`), the reply is enqueued as an async
+/// message instead of being dropped: handle `ASYNC_BATCH_MSG` in the server.
+error_t async_send_reply(task_t dst, struct message *m) {
+    DEBUG_ASSERT(!has_ool(m) || !(m->type & MSG_IOV));
+
+    error_t err = ipc_send_noblock(dst, m);
+    if (err != ERR_WOULD_BLOCK) {
+        return err;
+    }
+
+    // `async_send` takes over the ool payload: pass a copy of it.
+    struct message r;
+    memcpy(&r, m, sizeof(r));
+    if (has_ool(m)) {
+        size_t len =
+            (m->type & MSG_STR) ? strlen(m->ool_ptr) + 1 : m->ool_len;
+        r.ool_ptr = malloc(len);
+        r.ool_len = len;
+        memcpy(r.ool_ptr, m->ool_ptr, len);
+    }
+
+    return async_send(dst, &r);
+}
+
+error_t async_send_reply_err(task_t dst, error_t error) {
+    struct message m;
+    m.type = error;
+    return async_send_reply(dst, &m);
+}
+
+bool async_is_empty(task_t dst) {
+    struct async_queue *q = get_queue(dst);
+    return !q || !q->len;
 }
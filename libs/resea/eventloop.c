@@ -0,0 +1,420 @@
+#include <arch/coroutine.h>
+#include <resea/async.h>
+#include <resea/eventloop.h>
+#include <resea/ipc.h>
+#include <resea/kernel_info.h>
+#include <resea/malloc.h>
+#include <resea/printf.h>
+#include <resea/timer.h>
+#include <string.h>
+
+/// The maximum number of exited coroutines kept for reuse.
+#define NUM_IDLE_COROUTINES_MAX 8
+/// Written at the bottom of coroutine stacks to detect stack overflows.
+#define STACK_CANARY 0x5ac4ca4a5ac4ca4aULL
+
+struct coroutine {
+    /// The link of the run queue, a wait queue, or `idle_coroutines`.
+    list_elem_t next;
+    /// The saved stack pointer.
+    vaddr_t sp;
+    void (*entry)(void *arg);
+    void *arg;
+    bool exited;
+    /// The buffer to receive a message by `ev_recv`.
+    struct message *recv_buf;
+    /// Notifications waited for/received by `ev_wait_notifications`.
+    notifications_t waiting_for;
+    notifications_t notifications;
+    /// The message passed to the handler.
+    struct message m;
+    uint8_t stack[CONFIG_COROUTINE_STACK_LEN] __aligned(16);
+};
+
+/// The running coroutine or NULL if the event loop is running.
+static struct coroutine *current = NULL;
+/// The stack pointer of the event loop.
+static vaddr_t loop_sp;
+/// Runnable coroutines.
+static list_t runqueue;
+/// Exited coroutines kept for reuse.
+static list_t idle_coroutines;
+static unsigned num_idle_coroutines = 0;
+/// Pending timers sorted by the deadline.
+static list_t timers;
+/// Coroutines waiting in `ev_wait_notifications`.
+static list_t notification_waiters;
+/// Coroutines waiting in `ev_recv` indexed by the sender task ID.
+static struct coroutine *recv_waiters[CONFIG_NUM_TASKS + 1];
+/// Servers which we're waiting for a reply from in `ev_call`.
+static bool calling[CONFIG_NUM_TASKS + 1];
+static unsigned num_calls = 0;
+/// Coroutines waiting in `ev_call` for the preceding call to the same server.
+static struct ev_waitqueue call_waiters;
+static ev_handler_t handler = NULL;
+
+static void init_lists(void) {
+    if (!runqueue.next) {
+        list_init(&runqueue);
+        list_init(&idle_coroutines);
+        list_init(&timers);
+        list_init(&notification_waiters);
+        ev_waitqueue_init(&call_waiters);
+    }
+}
+
+/// The entry point of coroutines.
+static __noreturn void coroutine_main(void) {
+    current->entry(current->arg);
+    current->exited = true;
+    arch_coroutine_switch(&current->sp, loop_sp);
+    UNREACHABLE();
+}
+
+static struct coroutine *alloc_coroutine(void (*entry)(void *arg), void *arg) {
+    init_lists();
+    struct coroutine *co =
+        LIST_POP_FRONT(&idle_coroutines, struct coroutine, next);
+    if (co) {
+        num_idle_coroutines--;
+    } else {
+        co = malloc(sizeof(*co));
+        *((uint64_t *) co->stack) = STACK_CANARY;
+    }
+
+    vaddr_t stack_top = (vaddr_t) &co->stack[sizeof(co->stack)];
+    co->sp = arch_coroutine_init_stack(stack_top, (vaddr_t) coroutine_main);
+    co->entry = entry;
+    co->arg = arg;
+    co->exited = false;
+    list_nullify(&co->next);
+    return co;
+}
+
+static void free_coroutine(struct coroutine *co) {
+    if (num_idle_coroutines < NUM_IDLE_COROUTINES_MAX) {
+        list_push_back(&idle_coroutines, &co->next);
+        num_idle_coroutines++;
+    } else {
+        free(co);
+    }
+}
+
+static void resume(struct coroutine *co) {
+    list_push_back(&runqueue, &co->next);
+}
+
+static struct coroutine *get_current(void) {
+    if (!current) {
+        PANIC("tried to block outside of a coroutine");
+    }
+
+    return current;
+}
+
+/// Switches back to the event loop until the current coroutine is resumed.
+static void suspend(void) {
+    arch_coroutine_switch(&current->sp, loop_sp);
+}
+
+/// Starts a new coroutine. It runs when the event loop runs next time.
+void ev_spawn(void (*entry)(void *arg), void *arg) {
+    resume(alloc_coroutine(entry, arg));
+}
+
+/// Lets other runnable coroutines run. Note that it doesn't receive messages.
+void ev_yield(void) {
+    resume(get_current());
+    suspend();
+}
+
+static void wake_coroutine(void *arg) {
+    resume(arg);
+}
+
+/// Blocks the current coroutine for `timeout` milliseconds.
+void ev_sleep(msec_t timeout) {
+    struct ev_timer timer;
+    ev_timer_init(&timer, wake_coroutine, get_current());
+    ev_timer_set(&timer, timeout);
+    suspend();
+}
+
+/// Blocks the current coroutine until a message from `src` arrives. Messages
+/// from `src` are passed to the handler if no coroutines wait for them.
+error_t ev_recv(task_t src, struct message *m) {
+    DEBUG_ASSERT(src > 0 && src <= CONFIG_NUM_TASKS);
+    ASSERT(!recv_waiters[src]);
+
+    struct coroutine *co = get_current();
+    recv_waiters[src] = co;
+    co->recv_buf = m;
+    suspend();
+    return (m->type < 0) ? m->type : OK;
+}
+
+/// Sends a request to `dst` and blocks the current coroutine until the reply
+/// arrives. Unlike `ipc_call`, the event loop keeps handling other messages in
+/// the meantime. `dst` must reply by `async_send_reply`: the reply is queued if
+/// the event loop is not in `ipc_recv`, and we pull it on `NOTIFY_ASYNC`.
+///
+/// A reply doesn't tell which request it's for, so requests to the same server
+/// are sent one at a time.
+error_t ev_call(task_t dst, struct message *m) {
+    DEBUG_ASSERT(dst > 0 && dst <= CONFIG_NUM_TASKS);
+
+    init_lists();
+    while (calling[dst]) {
+        ev_wait(&call_waiters);
+    }
+
+    calling[dst] = true;
+    num_calls++;
+    error_t err = ipc_send(dst, m);
+    if (err == OK) {
+        err = ev_recv(dst, m);
+    }
+
+    calling[dst] = false;
+    num_calls--;
+    ev_wake_all(&call_waiters);
+    return err;
+}
+
+/// Blocks the current coroutine until one of `notifications` arrives. Returns
+/// the received ones. NOTIFY_TIMER is reserved for timers.
+notifications_t ev_wait_notifications(notifications_t notifications) {
+    DEBUG_ASSERT(!(notifications & NOTIFY_TIMER));
+
+    init_lists();
+    struct coroutine *co = get_current();
+    co->waiting_for = notifications;
+    co->notifications = 0;
+    list_push_back(&notification_waiters, &co->next);
+    suspend();
+    return co->notifications;
+}
+
+void ev_waitqueue_init(struct ev_waitqueue *wq) {
+    list_init(&wq->waiters);
+}
+
+/// Blocks the current coroutine until it's woken up by `ev_wake_one` or
+/// `ev_wake_all`.
+void ev_wait(struct ev_waitqueue *wq) {
+    list_push_back(&wq->waiters, &get_current()->next);
+    suspend();
+}
+
+void ev_wake_one(struct ev_waitqueue *wq) {
+    struct coroutine *co = LIST_POP_FRONT(&wq->waiters, struct coroutine, next);
+    if (co) {
+        resume(co);
+    }
+}
+
+void ev_wake_all(struct ev_waitqueue *wq) {
+    struct coroutine *co;
+    while ((co = LIST_POP_FRONT(&wq->waiters, struct coroutine, next))) {
+        resume(co);
+    }
+}
+
+/// Initializes a timer. `callback` is called in the event loop, i.e., it must
+/// not block.
+void ev_timer_init(struct ev_timer *timer, void (*callback)(void *arg),
+                   void *arg) {
+    list_nullify(&timer->next);
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+/// Programs the kernel timer for the earliest deadline.
+static void arm_timer(void) {
+    if (list_is_empty(&timers)) {
+        return;
+    }
+
+    struct ev_timer *first = LIST_CONTAINER(timers.next, struct ev_timer, next);
+    msec_t timeout = first->deadline - uptime();
+    OOPS_OK(timer_set(MAX(timeout, 1)));
+}
+
+/// Sets (or resets) a oneshot timer which fires after `timeout` milliseconds.
+void ev_timer_set(struct ev_timer *timer, msec_t timeout) {
+    init_lists();
+    list_remove(&timer->next);
+    timer->deadline = uptime() + timeout;
+
+    // Keep the list sorted by the deadline.
+    list_elem_t *prev = &timers;
+    LIST_FOR_EACH (t, &timers, struct ev_timer, next) {
+        if (timer->deadline - t->deadline < 0) {
+            break;
+        }
+
+        prev = &t->next;
+    }
+
+    list_insert(prev, prev->next, &timer->next);
+    if (prev == &timers) {
+        arm_timer();
+    }
+}
+
+/// Cancels a timer. It does nothing if the timer is not pending.
+void ev_timer_cancel(struct ev_timer *timer) {
+    list_remove(&timer->next);
+}
+
+static void fire_timers(void) {
+    // Move expired timers into another list first: a callback may set a timer
+    // again.
+    list_t expired;
+    list_init(&expired);
+    msec_t now = uptime();
+    LIST_FOR_EACH (timer, &timers, struct ev_timer, next) {
+        if (timer->deadline - now > 0) {
+            break;
+        }
+
+        list_remove(&timer->next);
+        list_push_back(&expired, &timer->next);
+    }
+
+    struct ev_timer *timer;
+    while ((timer = LIST_POP_FRONT(&expired, struct ev_timer, next))) {
+        timer->callback(timer->arg);
+    }
+
+    arm_timer();
+}
+
+/// Runs runnable coroutines until all of them exit or block.
+void ev_run_ready(void) {
+    ASSERT(!current);
+
+    init_lists();
+    struct coroutine *co;
+    while ((co = LIST_POP_FRONT(&runqueue, struct coroutine, next))) {
+        current = co;
+        arch_coroutine_switch(&loop_sp, co->sp);
+        current = NULL;
+
+        if (*((uint64_t *) co->stack) != STACK_CANARY) {
+            PANIC("coroutine stack overflow (stack=%p)", co->stack);
+        }
+
+        if (co->exited) {
+            free_coroutine(co);
+        }
+    }
+}
+
+static void run_handler(void *arg) {
+    handler(arg);
+}
+
+/// Runs the handler for the message in a new coroutine.
+static void spawn_handler(struct message *m) {
+    if (!handler) {
+        discard_unknown_message(m);
+        return;
+    }
+
+    struct coroutine *co = alloc_coroutine(run_handler, NULL);
+    memcpy(&co->m, m, sizeof(*m));
+    co->arg = &co->m;
+    resume(co);
+}
+
+/// Pulls replies queued by `async_send_reply`. We don't know which server has
+/// notified us, so ask all servers we're calling.
+static void pull_replies(void) {
+    for (task_t dst = 1; num_calls > 0 && dst <= CONFIG_NUM_TASKS; dst++) {
+        if (!calling[dst] || !recv_waiters[dst]) {
+            continue;
+        }
+
+        struct message msgs[ASYNC_BATCH_MAX];
+        size_t num_msgs;
+        error_t err = async_recv_batch(dst, msgs, ASYNC_BATCH_MAX, &num_msgs);
+        if (err != OK) {
+            // Abort the call.
+            struct coroutine *co = recv_waiters[dst];
+            recv_waiters[dst] = NULL;
+            co->recv_buf->type = err;
+            resume(co);
+            continue;
+        }
+
+        for (size_t i = 0; i < num_msgs; i++) {
+            if (!ev_dispatch(&msgs[i])) {
+                spawn_handler(&msgs[i]);
+            }
+        }
+    }
+}
+
+/// Passes a received message to coroutines waiting for it and fires timers.
+/// Returns false if the message is not consumed. In that case, unconsumed
+/// notifications are left in `m`.
+bool ev_dispatch(struct message *m) {
+    init_lists();
+    if (m->type == NOTIFICATIONS_MSG) {
+        notifications_t notifications = m->notifications.data;
+        if (notifications & NOTIFY_TIMER) {
+            fire_timers();
+            notifications &= ~NOTIFY_TIMER;
+        }
+
+        // Others may have sent NOTIFY_ASYNC too: leave it for them.
+        if (notifications & NOTIFY_ASYNC) {
+            pull_replies();
+        }
+
+        notifications_t consumed = 0;
+        LIST_FOR_EACH (co, &notification_waiters, struct coroutine, next) {
+            if (co->waiting_for & notifications) {
+                co->notifications = co->waiting_for & notifications;
+                consumed |= co->notifications;
+                list_remove(&co->next);
+                resume(co);
+            }
+        }
+
+        m->notifications.data = notifications & ~consumed;
+        return m->notifications.data == 0;
+    }
+
+    if (m->src > 0 && m->src <= CONFIG_NUM_TASKS && recv_waiters[m->src]) {
+        struct coroutine *co = recv_waiters[m->src];
+        recv_waiters[m->src] = NULL;
+        memcpy(co->recv_buf, m, sizeof(*m));
+        resume(co);
+        return true;
+    }
+
+    return false;
+}
+
+/// Receives messages and runs `handler` in a new coroutine for each message
+/// not consumed by `ev_dispatch`. It never returns.
+__noreturn void ev_run(ev_handler_t h) {
+    handler = h;
+    while (true) {
+        ev_run_ready();
+
+        struct message m;
+        bzero(&m, sizeof(m));
+        error_t err = ipc_recv(IPC_ANY, &m);
+        if (IS_ERROR(err) && err != m.type) {
+            WARN_DBG("ipc_recv returned an error: %s", err2str(err));
+            continue;
+        }
+
+        if (!ev_dispatch(&m)) {
+            spawn_handler(&m);
+        }
+    }
+}
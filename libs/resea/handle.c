@@ -1,99 +1,158 @@
-#include <list.h>
 #include <resea/handle.h>
 #include <resea/malloc.h>
 #include <resea/printf.h>
 
-// The number of buckets in `handles`.
-#define NUM_BUCKETS 32
+// A handle consists of the slot index plus one (so that 0 is never a valid
+// handle) and the generation of the slot. Handles are always positive.
+#define HANDLE_INDEX_BITS 20
+#define HANDLE_GEN_BITS   11
+#define HANDLE_INDEX_MASK ((1 << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GEN_MASK   ((1 << HANDLE_GEN_BITS) - 1)
 // The maximum number of handles per task.
-#define HANDLE_MAX 128
+#define HANDLE_MAX HANDLE_INDEX_MASK
+// The initial number of slots in a handle table.
+#define INITIAL_NUM_SLOTS 8
+// Marks the end of a free list.
+#define NO_FREE_SLOT 0xffffffff
 
-/// A hash table of handles.
-static list_t *handles[NUM_BUCKETS];
-
-struct handle_entry {
-    list_elem_t next;
-    task_t owner;
+struct handle_slot {
     void *data;
-    handle_t handle;
+    /// The next free slot index or NO_FREE_SLOT. Valid only if it's not in use.
+    uint32_t next_free;
+    /// Incremented every time the slot is freed to reject stale handles.
+    uint16_t generation;
+    bool in_use;
+};
+
+/// Handles owned by a task.
+struct handle_table {
+    struct handle_slot *slots;
+    uint32_t num_slots;
+    uint32_t free_head;
 };
 
-static struct handle_entry *get_entry(task_t owner, handle_t handle) {
-    unsigned index = handle % NUM_BUCKETS;
-    list_t *list = handles[index];
-    if (!list) {
+/// Handle tables indexed by the owner task ID.
+static struct handle_table tables[CONFIG_NUM_TASKS + 1];
+
+static struct handle_table *get_table(task_t owner) {
+    if (owner <= 0 || owner > CONFIG_NUM_TASKS) {
         return NULL;
     }
 
-    LIST_FOR_EACH (e, list, struct handle_entry, next) {
-        if (e->owner == owner && e->handle == handle) {
-            return e;
-        }
+    return &tables[owner];
+}
+
+static struct handle_slot *get_slot(task_t owner, handle_t handle) {
+    struct handle_table *table = get_table(owner);
+    if (!table || handle <= 0) {
+        return NULL;
+    }
+
+    uint32_t index = (handle & HANDLE_INDEX_MASK) - 1;
+    uint16_t generation = (handle >> HANDLE_INDEX_BITS) & HANDLE_GEN_MASK;
+    if (index >= table->num_slots) {
+        return NULL;
+    }
+
+    struct handle_slot *slot = &table->slots[index];
+    if (!slot->in_use || slot->generation != generation) {
+        return NULL;
     }
 
-    return NULL;
+    return slot;
+}
+
+/// Doubles the number of slots and pushes new ones into the free list.
+static error_t grow_table(struct handle_table *table) {
+    uint32_t old_num = table->num_slots;
+    uint32_t new_num =
+        old_num ? MIN(old_num * 2, HANDLE_MAX) : INITIAL_NUM_SLOTS;
+    if (new_num <= old_num) {
+        return ERR_NO_MEMORY;
+    }
+
+    table->slots = realloc(table->slots, new_num * sizeof(*table->slots));
+    table->num_slots = new_num;
+
+    // Push in the reverse order so that lower indices are used first.
+    for (uint32_t i = new_num; i > old_num; i--) {
+        struct handle_slot *slot = &table->slots[i - 1];
+        slot->data = NULL;
+        slot->generation = 0;
+        slot->in_use = false;
+        slot->next_free = table->free_head;
+        table->free_head = i - 1;
+    }
+
+    return OK;
 }
 
 handle_t handle_alloc(task_t owner) {
-    // Look for an unused handle ID for the task.
-    handle_t new_handle = 0;
-    for (handle_t handle = 1; handle <= HANDLE_MAX; handle++) {
-        if (!get_entry(owner, handle)) {
-            new_handle = handle;
-            break;
-        }
+    struct handle_table *table = get_table(owner);
+    if (!table) {
+        return ERR_INVALID_ARG;
     }
 
-    if (!new_handle) {
-        return ERR_NO_MEMORY;
+    if (!table->slots) {
+        table->free_head = NO_FREE_SLOT;
     }
 
-    // Allocate a bucket if needed.
-    unsigned index = new_handle % NUM_BUCKETS;
-    list_t *list = handles[index];
-    if (!list) {
-        list = malloc(sizeof(*list));
-        list_init(list);
-        handles[index] = list;
+    if (table->free_head == NO_FREE_SLOT) {
+        OK_OR_RETURN(grow_table(table));
     }
 
-    // Add a handle entry into the bucket.
-    struct handle_entry *e = malloc(sizeof(*e));
-    e->handle = new_handle;
-    e->owner = owner;
-    e->data = NULL;
-    list_push_back(list, &e->next);
-    return new_handle;
+    uint32_t index = table->free_head;
+    struct handle_slot *slot = &table->slots[index];
+    table->free_head = slot->next_free;
+    slot->in_use = true;
+    slot->data = NULL;
+    return (slot->generation << HANDLE_INDEX_BITS) | (index + 1);
 }
 
 void *handle_get(task_t owner, handle_t handle) {
-    struct handle_entry *e = get_entry(owner, handle);
-    return e ? e->data : NULL;
+    struct handle_slot *slot = get_slot(owner, handle);
+    return slot ? slot->data : NULL;
 }
 
 void handle_set(task_t owner, handle_t handle, void *data) {
-    struct handle_entry *e = get_entry(owner, handle);
-    ASSERT(e);
-    e->data = data;
+    struct handle_slot *slot = get_slot(owner, handle);
+    ASSERT(slot);
+    slot->data = data;
 }
 
 void handle_free(task_t owner, handle_t handle) {
-    struct handle_entry *e = get_entry(owner, handle);
-    if (!e) {
+    struct handle_slot *slot = get_slot(owner, handle);
+    if (!slot) {
         return;
     }
 
-    list_remove(&e->next);
-    free(e);
+    struct handle_table *table = get_table(owner);
+    slot->in_use = false;
+    slot->data = NULL;
+    slot->generation = (slot->generation + 1) & HANDLE_GEN_MASK;
+    slot->next_free = table->free_head;
+    table->free_head = slot - table->slots;
 }
 
 void handle_free_all(task_t owner, void (*before_free)(void *data)) {
-    for (handle_t handle = 1; handle <= HANDLE_MAX; handle++) {
-        struct handle_entry *e = get_entry(owner, handle);
-        if (e && e->owner == owner) {
-            before_free(e->data);
-            list_remove(&e->next);
-            free(e);
+    struct handle_table *table = get_table(owner);
+    if (!table || !table->slots) {
+        return;
+    }
+
+    // Keep the slots: the generations reject handles from before the owner
+    // task ID is reused.
+    table->free_head = NO_FREE_SLOT;
+    for (uint32_t i = table->num_slots; i > 0; i--) {
+        struct handle_slot *slot = &table->slots[i - 1];
+        if (slot->in_use) {
+            before_free(slot->data);
+            slot->in_use = false;
+            slot->data = NULL;
+            slot->generation = (slot->generation + 1) & HANDLE_GEN_MASK;
         }
+
+        slot->next_free = table->free_head;
+        table->free_head = i - 1;
     }
 }
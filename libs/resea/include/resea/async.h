@@ -5,6 +5,10 @@
 #include <message.h>
 #include <types.h>
 
+/// The maximum number of messages delivered by a `async_recv_batch` call. A
+/// message with a ool payload takes two segments in the vectored reply.
+#define ASYNC_BATCH_MAX (OOL_IOV_MAX / 2)
+
 struct async_message {
     list_elem_t next;
     task_t dst;
@@ -13,7 +17,12 @@ struct async_message {
 
 error_t async_send(task_t dst, struct message *m);
 error_t async_recv(task_t src, struct message *m);
+error_t async_recv_batch(task_t src, struct message *msgs, size_t max,
+                         size_t *num_msgs);
 bool async_is_empty(task_t dst);
 error_t async_reply(task_t dst);
+error_t async_reply_batch(task_t dst, size_t max);
+error_t async_send_reply(task_t dst, struct message *m);
+error_t async_send_reply_err(task_t dst, error_t error);
 
 #endif
@@ -0,0 +1,44 @@
+#ifndef __RESEA_EVENTLOOP_H__
+#define __RESEA_EVENTLOOP_H__
+
+#include <list.h>
+#include <message.h>
+#include <types.h>
+
+/// A list of coroutines waiting for an event.
+struct ev_waitqueue {
+    list_t waiters;
+};
+
+/// A oneshot timer. It's owned by the caller: initialize it by `ev_timer_init`
+/// and keep it alive until it fires or is canceled.
+struct ev_timer {
+    list_elem_t next;
+    msec_t deadline;
+    void (*callback)(void *arg);
+    void *arg;
+};
+
+/// A message handler. It runs in a coroutine so it can block (e.g. `ev_sleep`)
+/// and reply to the message later.
+typedef void (*ev_handler_t)(struct message *m);
+
+void ev_spawn(void (*entry)(void *arg), void *arg);
+void ev_yield(void);
+void ev_sleep(msec_t timeout);
+error_t ev_recv(task_t src, struct message *m);
+error_t ev_call(task_t dst, struct message *m);
+notifications_t ev_wait_notifications(notifications_t notifications);
+void ev_waitqueue_init(struct ev_waitqueue *wq);
+void ev_wait(struct ev_waitqueue *wq);
+void ev_wake_one(struct ev_waitqueue *wq);
+void ev_wake_all(struct ev_waitqueue *wq);
+void ev_timer_init(struct ev_timer *timer, void (*callback)(void *arg),
+                   void *arg);
+void ev_timer_set(struct ev_timer *timer, msec_t timeout);
+void ev_timer_cancel(struct ev_timer *timer);
+void ev_run_ready(void);
+bool ev_dispatch(struct message *m);
+__noreturn void ev_run(ev_handler_t handler);
+
+#endif
@@ -15,6 +15,8 @@ error_t ipc_send_err(task_t dst, error_t error);
 error_t ipc_replyrecv(task_t dst, struct message *m);
 error_t ipc_serve(const char *name);
 task_t ipc_lookup(const char *name);
+void ipc_lookup_notify_exit(void);
+void ipc_lookup_invalidate(task_t server);
 void discard_unknown_message(struct message *m);
 
 #endif
@@ -0,0 +1,14 @@
+#ifndef __RESEA_KERNEL_INFO_H__
+#define __RESEA_KERNEL_INFO_H__
+
+#include <kernel_info.h>
+#include <types.h>
+
+/// The read-only kernel info page. The pager maps it on the first access.
+extern const struct kernel_info __kernel_info;
+
+msec_t uptime(void);
+uint64_t monotonic_ns(void);
+unsigned num_cpus(void);
+
+#endif
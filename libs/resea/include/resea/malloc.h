@@ -4,22 +4,73 @@
 #include <config.h>
 #include <types.h>
 
-#define MALLOC_FREE        0x0a110ced0a110cedULL /* hexspeak of "alloced" */
-#define MALLOC_IN_USE      0xdea110cddea110cdULL /* hexspeak of "deallocd" */
-#define MALLOC_REDZONE_LEN 16
-#define MALLOC_FRAME_LEN   (sizeof(struct malloc_chunk) + MALLOC_REDZONE_LEN)
+#define MALLOC_FREE   0x0a110ced0a110cedULL /* hexspeak of "alloced" */
+#define MALLOC_IN_USE 0xdea110cddea110cdULL /* hexspeak of "deallocd" */
+#ifdef CONFIG_MALLOC_REDZONE
+#    define MALLOC_REDZONE_LEN 16
+#else
+#    define MALLOC_REDZONE_LEN 0
+#endif
+#define MALLOC_FRAME_LEN (sizeof(struct malloc_chunk) + MALLOC_REDZONE_LEN)
 
 #define MALLOC_REDZONE_UNDFLOW_MARKER 0x5a
 #define MALLOC_REDZONE_OVRFLOW_MARKER 0x5b
 
+/// Requests up to MALLOC_SMALL_MAX bytes are served from per-size-class slabs
+/// (16, 32, ..., 2048 bytes). Larger ones are carved out of the heap directly.
+#define MALLOC_MIN_CLASS_SHIFT 4
+#define MALLOC_MAX_CLASS_SHIFT 11
+#define MALLOC_NUM_CLASSES                                                     \
+    (MALLOC_MAX_CLASS_SHIFT - MALLOC_MIN_CLASS_SHIFT + 1)
+#define MALLOC_SMALL_MAX       (1 << MALLOC_MAX_CLASS_SHIFT)
+/// The minimum length of a slab and the minimum number of chunks in it.
+#define MALLOC_SLAB_LEN        4096
+#define MALLOC_SLAB_MIN_CHUNKS 4
+
+/// Allocations from a call site (CONFIG_MALLOC_PROFILE).
+struct malloc_site {
+    vaddr_t caller;
+    size_t num_allocs;
+    size_t total_bytes;
+    size_t live_allocs;
+    size_t live_bytes;
+    size_t peak_bytes;
+};
+
+/// The heap statistics. Sizes are in bytes.
+struct malloc_stats {
+    /// The total length of heap regions.
+    size_t heap_len;
+    /// The total capacity of allocated chunks.
+    size_t in_use;
+    size_t peak_in_use;
+    /// The number of allocated chunks.
+    size_t num_allocs;
+    /// The total capacity of free chunks except the ones in slabs.
+    size_t free_len;
+    size_t largest_free;
+};
+
 /// The header of allocated/free memory chunks. The data area follows
 //  immediately after this header (`data` points to the area).
 struct malloc_chunk {
+    /// The free list link.
     struct malloc_chunk *next;
+    union {
+        /// The previous free chunk. Used only by large chunks.
+        struct malloc_chunk *prev;
+        /// The allocation site of an in-use chunk (CONFIG_MALLOC_PROFILE).
+        struct malloc_site *site;
+    };
+    /// The length (including the frame) of the physically preceding chunk or
+    /// 0 if it's the first one in the heap. Used only by large chunks.
+    size_t prev_len;
     size_t capacity;
     size_t size;
     uint64_t magic;
+#ifdef CONFIG_MALLOC_REDZONE
     uint8_t underflow_redzone[MALLOC_REDZONE_LEN];
+#endif
     uint8_t data[];
     // `overflow_redzone` follows immediately after `data`.
     // uint8_t overflow_redzone[MALLOC_REDZONE_LEN];
@@ -28,7 +79,7 @@ struct malloc_chunk {
 #ifdef ARCH_X64
 /// Ensure that it's aligned to 16 bytes for performance (SSE instructions
 /// requires 128-bit-aligned memory address).
-STATIC_ASSERT(sizeof(struct malloc_chunk) == 48);
+STATIC_ASSERT(IS_ALIGNED(sizeof(struct malloc_chunk), 16));
 #endif
 
 void *malloc(size_t size);
@@ -36,6 +87,8 @@ void *realloc(void *ptr, size_t size);
 void free(void *ptr);
 char *strndup(const char *s, size_t n);
 char *strdup(const char *s);
+void malloc_stats(struct malloc_stats *stats);
+void malloc_dump(void);
 void malloc_init(void);
 
 #endif
@@ -21,5 +21,6 @@ error_t sys_irq_release(unsigned irq);
 error_t sys_console_write(const char *buf, size_t len);
 int sys_console_read(char *buf, size_t len);
 error_t sys_kdebug(const char *cmd, size_t cmd_len, char *buf, size_t buf_len);
+error_t sys_pmc_setup(unsigned counter, unsigned event);
 
 #endif
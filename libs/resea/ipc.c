@@ -4,10 +4,33 @@
 #include <resea/syscall.h>
 #include <string.h>
 
-/// The internal buffer to receive ool payloads.
+// The number of entries in `lookup_cache`.
+#define LOOKUP_CACHE_SIZE 8
+// The maximum length of a cached service name (including the NUL character).
+#define LOOKUP_CACHE_NAME_LEN 32
+
+/// Services looked up previously. vm reuses task IDs, so an entry is kept
+/// only if vm notifies us when the server exits (`discovery.service_exited`):
+/// otherwise it might point to an unrelated task which has got the same ID. An
+/// entry is also invalidated when an IPC to the server fails because it has
+/// exited.
+static struct {
+    task_t task;
+    char name[LOOKUP_CACHE_NAME_LEN];
+} lookup_cache[LOOKUP_CACHE_SIZE];
+static unsigned lookup_cache_next = 0;
+/// Ask vm to notify us when a looked up server exits. It's enabled once we
+/// receive async messages from vm.
+static bool lookup_notify_exit = false;
+
+/// The internal buffers to receive ool payloads registered in vm. NULL if the
+/// slot is not registered.
 #ifndef CONFIG_NOMMU
-static void *ool_ptr = NULL;
+static void *ool_bufs[CONFIG_OOL_NUM_RECV_BUFS];
+static unsigned num_ool_bufs = 0;
 static const size_t ool_len = CONFIG_OOL_BUFFER_LEN;
+/// Larger payloads are received in dedicated pages up to this length.
+static const size_t ool_max_len = CONFIG_OOL_MAX_LEN;
 #endif
 
 // for sparse
@@ -24,26 +47,42 @@ __weak error_t ipc_call_pager(struct message *m) {
 }
 
 #ifndef CONFIG_NOMMU
-static void ool_recv(vaddr_t ptr, size_t len) {
+static void ool_recv(vaddr_t *bufs, size_t num_bufs, size_t len,
+                     size_t max_len) {
     struct message m;
     m.type = OOL_RECV_MSG;
-    m.ool_recv.addr = ptr;
+    m.ool_recv.bufs = (vaddr_t) bufs;
+    m.ool_recv.num_bufs = num_bufs;
     m.ool_recv.len = len;
+    m.ool_recv.max_len = max_len;
     error_t err = ipc_call_pager(&m);
     ASSERT_OK(err);
     ASSERT(m.type == OOL_RECV_REPLY_MSG);
 }
 
-static vaddr_t ool_send(task_t dst, vaddr_t ptr, size_t len) {
+static error_t ool_send(task_t dst, vaddr_t ptr, size_t len, vaddr_t *id) {
     struct message m;
     m.type = OOL_SEND_MSG;
     m.ool_send.dst = dst;
     m.ool_send.addr = ptr;
     m.ool_send.len = len;
-    error_t err = ipc_call_pager(&m);
-    ASSERT_OK(err);
+    OK_OR_RETURN(ipc_call_pager(&m));
     ASSERT(m.type == OOL_SEND_REPLY_MSG);
-    return m.ool_send_reply.id;
+    *id = m.ool_send_reply.id;
+    return OK;
+}
+
+static error_t ool_sendv(task_t dst, struct ool_iovec *iov, size_t iov_count,
+                         vaddr_t *id) {
+    struct message m;
+    m.type = OOL_SENDV_MSG;
+    m.ool_sendv.dst = dst;
+    m.ool_sendv.iov = (vaddr_t) iov;
+    m.ool_sendv.iov_count = iov_count;
+    OK_OR_RETURN(ipc_call_pager(&m));
+    ASSERT(m.type == OOL_SENDV_REPLY_MSG);
+    *id = m.ool_sendv_reply.id;
+    return OK;
 }
 
 static vaddr_t ool_verify(task_t src, vaddr_t ptr, size_t len) {
@@ -60,52 +99,192 @@ static vaddr_t ool_verify(task_t src, vaddr_t ptr, size_t len) {
     ASSERT(m.type == OOL_VERIFY_REPLY_MSG);
     return m.ool_verify_reply.received_at;
 }
+
+/// Moves a payload larger than the receive buffer into the heap. The vm server
+/// have allocated dedicated pages for it. `len` is at most `ool_max_len`: vm
+/// rejects larger ones.
+static void *recv_large_ool(vaddr_t vaddr, size_t len) {
+    DEBUG_ASSERT(len <= MAX(ool_max_len, ool_len));
+
+    void *buf = malloc(len + 1);
+    memcpy(buf, (void *) vaddr, len);
+
+    struct message m;
+    m.type = VM_FREE_PAGES_MSG;
+    m.vm_free_pages.vaddr = vaddr;
+    m.vm_free_pages.num_pages = ALIGN_UP(len, PAGE_SIZE) / PAGE_SIZE;
+    OOPS_OK(ipc_call_pager(&m));
+    return buf;
+}
+#endif
+
+#ifndef CONFIG_NOMMU
+/// The size of message fields indexed by the message ID. A small ool payload
+/// is inlined into the message right after the fields.
+static const size_t *fields_lens = IDL_MSGID2FIELDS_LEN;
+
+/// Copies the ool payload into the message if it fits in the unused bytes.
+/// Returns false if it doesn't.
+static bool inline_ool(struct message *m) {
+    int id = MSG_ID(m->type);
+    if (id > IDL_MSGID_MAX || !fields_lens[id]) {
+        return false;
+    }
+
+    size_t offset = fields_lens[id];
+    size_t avail = sizeof(m->raw) - offset;
+    uint8_t *dst = &m->raw[offset];
+    if (m->type & MSG_IOV) {
+        struct ool_iovec *iov = m->ool_ptr;
+        size_t len = 0;
+        for (size_t i = 0; i < m->ool_len; i++) {
+            len += iov[i].len;
+            if (len > avail) {
+                return false;
+            }
+        }
+
+        for (size_t i = 0; i < m->ool_len; i++) {
+            memcpy(dst, iov[i].base, iov[i].len);
+            dst += iov[i].len;
+        }
+
+        m->type &= ~MSG_IOV;
+        m->ool_len = len;
+    } else {
+        if (m->ool_len > avail) {
+            return false;
+        }
+
+        memcpy(dst, m->ool_ptr, m->ool_len);
+    }
+
+    m->type |= MSG_INLINE;
+    return true;
+}
+
+/// Moves an inlined payload into a buffer as if it's received by OoL.
+static error_t recv_inline_ool(struct message *m) {
+    m->type &= ~MSG_INLINE;
+    int id = MSG_ID(m->type);
+    if (id > IDL_MSGID_MAX || !fields_lens[id]
+        || m->ool_len > sizeof(m->raw) - fields_lens[id]) {
+        return ERR_INVALID_ARG;
+    }
+
+    void *buf = malloc(m->ool_len + 1);
+    memcpy(buf, &m->raw[fields_lens[id]], m->ool_len);
+    m->ool_ptr = buf;
+    return OK;
+}
 #endif
 
-static void pre_send(task_t dst, struct message *m) {
+static error_t pre_send(task_t dst, struct message *m) {
 #ifndef CONFIG_NOMMU
     if (!IS_ERROR(m->type) && m->type & MSG_OOL) {
-        if (m->type & MSG_STR) {
+        if ((m->type & (MSG_STR | MSG_IOV)) == MSG_STR) {
             m->ool_len = strlen(m->ool_ptr) + 1;
         }
 
-        m->ool_ptr = (void *) ool_send(dst, (vaddr_t) m->ool_ptr, m->ool_len);
+        // A small payload doesn't need vm calls at all.
+        if (inline_ool(m)) {
+            return OK;
+        }
+
+        vaddr_t id;
+        if (m->type & MSG_IOV) {
+            // Send the segments as a contiguous payload.
+            struct ool_iovec *iov = m->ool_ptr;
+            size_t len = 0;
+            for (size_t i = 0; i < m->ool_len; i++) {
+                len += iov[i].len;
+            }
+
+            OK_OR_RETURN(ool_sendv(dst, iov, m->ool_len, &id));
+            m->type &= ~MSG_IOV;
+            m->ool_len = len;
+        } else {
+            OK_OR_RETURN(ool_send(dst, (vaddr_t) m->ool_ptr, m->ool_len, &id));
+        }
+
+        m->ool_ptr = (void *) id;
     }
 #endif
+    return OK;
 }
 
 static void pre_recv(void) {
 #ifndef CONFIG_NOMMU
-    if (!ool_ptr) {
-        ool_ptr = malloc(ool_len);
-        ool_recv((vaddr_t) ool_ptr, ool_len);
+    // Refill the receive buffers in a batch once half of them are consumed so
+    // that back-to-back payloads don't wait for us to register a new one.
+    if (num_ool_bufs > CONFIG_OOL_NUM_RECV_BUFS / 2) {
+        return;
+    }
+
+    vaddr_t bufs[CONFIG_OOL_NUM_RECV_BUFS];
+    size_t num_bufs = 0;
+    for (int i = 0; i < CONFIG_OOL_NUM_RECV_BUFS; i++) {
+        if (!ool_bufs[i]) {
+            // Allocate an extra byte for the terminating NUL of `str`.
+            ool_bufs[i] = malloc(ool_len + 1);
+            bufs[num_bufs++] = (vaddr_t) ool_bufs[i];
+        }
     }
+
+    ool_recv(bufs, num_bufs, ool_len, MAX(ool_max_len, ool_len));
+    num_ool_bufs += num_bufs;
 #endif
 }
 
+#ifndef CONFIG_NOMMU
+/// Takes the receive buffer at `addr` (consumed by a received payload). Returns
+/// NULL if it's not a receive buffer.
+static void *take_ool_buf(vaddr_t addr) {
+    for (int i = 0; i < CONFIG_OOL_NUM_RECV_BUFS; i++) {
+        if ((vaddr_t) ool_bufs[i] == addr) {
+            void *buf = ool_bufs[i];
+            ool_bufs[i] = NULL;
+            num_ool_bufs--;
+            return buf;
+        }
+    }
+
+    return NULL;
+}
+#endif
+
 static error_t post_recv(error_t err, struct message *m) {
 #ifndef CONFIG_NOMMU
-    if (!IS_ERROR(m->type) && m->type & MSG_OOL) {
+    if (!IS_ERROR(m->type) && m->type & MSG_INLINE) {
+        if (recv_inline_ool(m) != OK) {
+            WARN_DBG("received an invalid inlined payload from #%d", m->src);
+            m->type = INVALID_MSG;
+            return OK;
+        }
+    } else if (!IS_ERROR(m->type) && m->type & MSG_OOL) {
         // Received a ool payload.
-        m->ool_ptr =
-            (void *) ool_verify(m->src, (vaddr_t) m->ool_ptr, m->ool_len);
-        if (!m->ool_ptr) {
+        vaddr_t received_at =
+            ool_verify(m->src, (vaddr_t) m->ool_ptr, m->ool_len);
+        if (!received_at) {
             WARN_DBG("received an invalid oolcopy payload from #%d: %s", m->src,
                      err2str(err));
             m->type = INVALID_MSG;
             return OK;
         }
 
-        // We've consumed `ool_ptr` so set NULL to it
-        // and reallocate the receiver buffer later.
-        ool_ptr = NULL;
-
-        // A mitigation for a non-terminated (malicious) string payload.
-        if (m->type & MSG_STR) {
-            char *str = m->ool_ptr;
-            str[m->ool_len] = '\0';
+        // The buffer is handed over to the caller: we'll register a new one
+        // later.
+        m->ool_ptr = take_ool_buf(received_at);
+        if (!m->ool_ptr) {
+            m->ool_ptr = recv_large_ool(received_at, m->ool_len);
         }
     }
+
+    // A mitigation for a non-terminated (malicious) string payload.
+    if (!IS_ERROR(m->type) && m->type & MSG_STR) {
+        char *str = m->ool_ptr;
+        str[m->ool_len] = '\0';
+    }
 #endif
 
     // Handle the case when m.type is negative: a message represents an error
@@ -113,19 +292,42 @@ static error_t post_recv(error_t err, struct message *m) {
     return (IS_OK(err) && m->type < 0) ? m->type : err;
 }
 
+/// Forgets the cached lookup if `dst` no longer exists.
+static error_t check_dst(task_t dst, error_t err) {
+    if (err == ERR_INVALID_TASK || err == ERR_ABORTED) {
+        ipc_lookup_invalidate(dst);
+    }
+
+    return err;
+}
+
 error_t ipc_send(task_t dst, struct message *m) {
+    int saved_type = m->type;
     void *saved_ool_ptr = m->ool_ptr;
-    pre_send(dst, m);
-    error_t err = sys_ipc(dst, 0, m, IPC_SEND);
+    size_t saved_ool_len = m->ool_len;
+    error_t err = pre_send(dst, m);
+    if (err == OK) {
+        err = check_dst(dst, sys_ipc(dst, 0, m, IPC_SEND));
+    }
+
+    m->type = saved_type;
     m->ool_ptr = saved_ool_ptr;
+    m->ool_len = saved_ool_len;
     return err;
 }
 
 error_t ipc_send_noblock(task_t dst, struct message *m) {
+    int saved_type = m->type;
     void *saved_ool_ptr = m->ool_ptr;
-    pre_send(dst, m);
-    error_t err = sys_ipc(dst, 0, m, IPC_SEND | IPC_NOBLOCK);
+    size_t saved_ool_len = m->ool_len;
+    error_t err = pre_send(dst, m);
+    if (err == OK) {
+        err = check_dst(dst, sys_ipc(dst, 0, m, IPC_SEND | IPC_NOBLOCK));
+    }
+
+    m->type = saved_type;
     m->ool_ptr = saved_ool_ptr;
+    m->ool_len = saved_ool_len;
     return err;
 }
 
@@ -158,14 +360,14 @@ error_t ipc_recv(task_t src, struct message *m) {
 
 error_t ipc_call(task_t dst, struct message *m) {
     pre_recv();
-    pre_send(dst, m);
-    error_t err = sys_ipc(dst, dst, m, IPC_CALL);
+    OK_OR_RETURN(pre_send(dst, m));
+    error_t err = check_dst(dst, sys_ipc(dst, dst, m, IPC_CALL));
     return post_recv(err, m);
 }
 
 error_t ipc_replyrecv(task_t dst, struct message *m) {
     pre_recv();
-    pre_send(dst, m);
+    OK_OR_RETURN(pre_send(dst, m));
     unsigned flags = (dst < 0) ? IPC_RECV : (IPC_SEND | IPC_RECV | IPC_NOBLOCK);
     error_t err = sys_ipc(dst, IPC_ANY, m, flags);
     return post_recv(err, m);
@@ -179,9 +381,17 @@ error_t ipc_serve(const char *name) {
 }
 
 task_t ipc_lookup(const char *name) {
+    for (int i = 0; i < LOOKUP_CACHE_SIZE; i++) {
+        if (lookup_cache[i].task
+            && !strncmp(lookup_cache[i].name, name, LOOKUP_CACHE_NAME_LEN)) {
+            return lookup_cache[i].task;
+        }
+    }
+
     struct message m;
     m.type = DISCOVERY_LOOKUP_MSG;
     m.discovery_lookup.name = (char *) name;
+    m.discovery_lookup.notify_exit = lookup_notify_exit;
 
     error_t err = ipc_call_pager(&m);
     if (IS_ERROR(err)) {
@@ -189,11 +399,70 @@ task_t ipc_lookup(const char *name) {
     }
 
     ASSERT_OK(m.type == DISCOVERY_LOOKUP_REPLY_MSG);
-    return m.discovery_lookup_reply.task;
+    task_t server = m.discovery_lookup_reply.task;
+    if (lookup_notify_exit && strlen(name) < LOOKUP_CACHE_NAME_LEN) {
+        unsigned i = lookup_cache_next++ % LOOKUP_CACHE_SIZE;
+        lookup_cache[i].task = server;
+        strncpy2(lookup_cache[i].name, name, LOOKUP_CACHE_NAME_LEN);
+    }
+
+    return server;
+}
+
+/// Makes vm notify us when a looked up server exits and enables the lookup
+/// cache. It's called automatically when we receive an async message from vm.
+/// Call it at startup if the task receives async messages from vm
+/// (`async_recv(VM_TASK, ...)`) on `NOTIFY_ASYNC`.
+void ipc_lookup_notify_exit(void) {
+    lookup_notify_exit = true;
+}
+
+/// Forgets cached lookups for the `server`.
+void ipc_lookup_invalidate(task_t server) {
+    for (int i = 0; i < LOOKUP_CACHE_SIZE; i++) {
+        if (lookup_cache[i].task == server) {
+            lookup_cache[i].task = 0;
+        }
+    }
+}
+
+/// Replies to a heap statistics request on behalf of the server.
+static void handle_heap_message(struct message *m) {
+    struct message r;
+    switch (m->type) {
+        case HEAP_STATS_MSG: {
+            struct malloc_stats stats;
+            malloc_stats(&stats);
+            r.type = HEAP_STATS_REPLY_MSG;
+            r.heap_stats_reply.heap_len = stats.heap_len;
+            r.heap_stats_reply.in_use = stats.in_use;
+            r.heap_stats_reply.peak_in_use = stats.peak_in_use;
+            r.heap_stats_reply.num_allocs = stats.num_allocs;
+            r.heap_stats_reply.free_len = stats.free_len;
+            r.heap_stats_reply.largest_free = stats.largest_free;
+            break;
+        }
+        case HEAP_DUMP_MSG:
+            malloc_dump();
+            r.type = HEAP_DUMP_REPLY_MSG;
+            break;
+    }
+
+    ipc_reply(m->src, &r);
 }
 
 /// Discards an unknown message.
 void discard_unknown_message(struct message *m) {
+    switch (m->type) {
+        case DISCOVERY_SERVICE_EXITED_MSG:
+            // Already handled in `async_recv`.
+            return;
+        case HEAP_STATS_MSG:
+        case HEAP_DUMP_MSG:
+            handle_heap_message(m);
+            return;
+    }
+
     OOPS("received an unknown message (%s [%d]%s)", msgtype2str(m->type),
          MSG_ID(m->type), (m->type & MSG_OOL) ? ", ool" : "",
          (m->type & MSG_STR) ? ", str" : "");
@@ -0,0 +1,26 @@
+#include <arch/timestamp.h>
+#include <resea/kernel_info.h>
+
+/// Returns the elapsed time since boot in milliseconds.
+msec_t uptime(void) {
+    return (__kernel_info.ticks * 1000) / __kernel_info.tick_hz;
+}
+
+/// Returns the elapsed time since boot in nanoseconds. It's computed from the
+/// timestamp counter so it's finer-grained than uptime().
+uint64_t monotonic_ns(void) {
+    uint64_t hz = __kernel_info.timestamp_hz;
+    if (!hz) {
+        // The timestamp counter is not available.
+        return (__kernel_info.ticks * 1000000000) / __kernel_info.tick_hz;
+    }
+
+    // Split into seconds and the remainder to avoid an overflow.
+    uint64_t delta = arch_timestamp() - __kernel_info.timestamp_base;
+    return (delta / hz) * 1000000000 + ((delta % hz) * 1000000000) / hz;
+}
+
+/// Returns the number of CPUs.
+unsigned num_cpus(void) {
+    return __kernel_info.num_cpus;
+}
@@ -1,19 +1,71 @@
 #include <list.h>
+#include <resea/ipc.h>
 #include <resea/malloc.h>
 #include <resea/printf.h>
+#include <resea/syscall.h>
 #include <string.h>
+#include <vprintf.h>
+
+/// Large free chunks are kept in bins by the floor of log2 of their capacity.
+#define NUM_LARGE_BINS 64
+/// The minimum capacity of a large chunk.
+#define LARGE_MIN (MALLOC_SMALL_MAX + 16)
+/// The minimum length of a region added to the heap when it runs out.
+#define HEAP_GROW_LEN (64 * 1024)
+/// Allocations larger than this are served from dedicated pages so that they
+/// are returned to the vm server as soon as they're freed.
+#define DIRECT_ALLOC_MIN (128 * 1024)
 
-#define NUM_BINS 16
 extern char __heap[];
 extern char __heap_end[];
 
-static struct malloc_chunk *bins[NUM_BINS];
+/// Free chunks of each size class.
+static struct malloc_chunk *classes[MALLOC_NUM_CLASSES];
+/// Free large chunks. The bit `i` in `large_bitmap` is set if `large_bins[i]`
+/// is not empty.
+static struct malloc_chunk *large_bins[NUM_LARGE_BINS];
+static uint64_t large_bitmap = 0;
+/// The first chunk in the small bootstrap heap from the linker script. Unlike
+/// regions allocated from the vm server, it's never returned.
+static struct malloc_chunk *static_region = NULL;
+/// An entirely free region kept in the heap instead of being returned to the
+/// vm server so that repeatedly allocating and freeing a region's worth of
+/// memory doesn't go to vm every time. It's stale once the region is in use.
+static struct malloc_chunk *spare_region = NULL;
+/// The heap statistics. `largest_free` is computed in malloc_stats().
+static struct malloc_stats stats;
+#ifdef CONFIG_MALLOC_PROFILE
+/// Allocation sites hashed by the caller address. Sites which don't fit in the
+/// table are accounted to the extra last entry.
+static struct malloc_site sites[CONFIG_MALLOC_PROFILE_NUM_SITES + 1];
+#endif
+
+static int log2_floor(size_t value) {
+    return 63 - __builtin_clzll(value);
+}
 
-static void check_buffer_overflow(struct malloc_chunk *chunk) {
-    if (chunk->magic == MALLOC_FREE) {
-        return;
+static int get_class_from_size(size_t size) {
+    ASSERT(size > 0 && size <= MALLOC_SMALL_MAX);
+    if (size <= (1 << MALLOC_MIN_CLASS_SHIFT)) {
+        return 0;
     }
 
+    return log2_floor(size - 1) + 1 - MALLOC_MIN_CLASS_SHIFT;
+}
+
+static bool is_large(struct malloc_chunk *chunk) {
+    return chunk->capacity > MALLOC_SMALL_MAX;
+}
+
+#ifdef CONFIG_MALLOC_REDZONE
+static void fill_redzones(struct malloc_chunk *chunk) {
+    memset(chunk->underflow_redzone, MALLOC_REDZONE_UNDFLOW_MARKER,
+           MALLOC_REDZONE_LEN);
+    memset(&chunk->data[chunk->capacity], MALLOC_REDZONE_OVRFLOW_MARKER,
+           MALLOC_REDZONE_LEN);
+}
+
+static void check_buffer_overflow(struct malloc_chunk *chunk) {
     for (size_t i = 0; i < MALLOC_REDZONE_LEN; i++) {
         if (chunk->underflow_redzone[i] != MALLOC_REDZONE_UNDFLOW_MARKER) {
             PANIC("detected a malloc buffer underflow: ptr=%p", chunk->data);
@@ -26,59 +78,357 @@ static void check_buffer_overflow(struct malloc_chunk *chunk) {
         }
     }
 }
+#else
+static void fill_redzones(struct malloc_chunk *chunk) {
+}
+
+static void check_buffer_overflow(struct malloc_chunk *chunk) {
+}
+#endif
 
-static struct malloc_chunk *insert(void *ptr, size_t len) {
-    ASSERT(len > MALLOC_FRAME_LEN);
-    struct malloc_chunk *new_chunk = ptr;
-    new_chunk->magic = MALLOC_FREE;
-    new_chunk->capacity = len - MALLOC_FRAME_LEN;
-    new_chunk->size = 0;
-    new_chunk->next = NULL;
+static size_t chunk_len(struct malloc_chunk *chunk) {
+    return MALLOC_FRAME_LEN + chunk->capacity;
+}
 
-    // Append the new chunk into the linked list.
-    struct malloc_chunk **chunk = &bins[NUM_BINS - 1];
-    while (*chunk != NULL) {
-        check_buffer_overflow(*chunk);
-        chunk = &(*chunk)->next;
+/// Returns the physically next chunk. Every heap region ends with an in-use
+/// sentinel chunk so that it always exists for a large chunk.
+static struct malloc_chunk *next_chunk(struct malloc_chunk *chunk) {
+    return (struct malloc_chunk *) ((uintptr_t) chunk + chunk_len(chunk));
+}
+
+static struct malloc_chunk *prev_chunk(struct malloc_chunk *chunk) {
+    if (!chunk->prev_len) {
+        return NULL;
+    }
+
+    return (struct malloc_chunk *) ((uintptr_t) chunk - chunk->prev_len);
+}
+
+static void set_capacity(struct malloc_chunk *chunk, size_t capacity) {
+    chunk->capacity = capacity;
+    next_chunk(chunk)->prev_len = chunk_len(chunk);
+}
+
+static void large_insert(struct malloc_chunk *chunk) {
+    int bin = log2_floor(chunk->capacity);
+    chunk->magic = MALLOC_FREE;
+    chunk->prev = NULL;
+    chunk->next = large_bins[bin];
+    if (chunk->next) {
+        chunk->next->prev = chunk;
     }
-    *chunk = new_chunk;
 
-    return new_chunk;
+    large_bins[bin] = chunk;
+    large_bitmap |= 1ULL << bin;
+    stats.free_len += chunk->capacity;
 }
 
-static struct malloc_chunk *split(struct malloc_chunk *chunk, size_t len) {
-    size_t new_chunk_len = MALLOC_FRAME_LEN + len;
-    ASSERT(chunk->capacity >= new_chunk_len);
+static void large_remove(struct malloc_chunk *chunk) {
+    int bin = log2_floor(chunk->capacity);
+    if (chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        large_bins[bin] = chunk->next;
+    }
 
-    void *new_chunk_ptr =
-        &chunk->data[chunk->capacity + MALLOC_REDZONE_LEN - new_chunk_len];
-    chunk->capacity -= new_chunk_len;
+    if (chunk->next) {
+        chunk->next->prev = chunk->prev;
+    }
 
-    ASSERT(new_chunk_len > MALLOC_FRAME_LEN);
+    if (!large_bins[bin]) {
+        large_bitmap &= ~(1ULL << bin);
+    }
 
-    struct malloc_chunk *new_chunk = new_chunk_ptr;
-    new_chunk->magic = MALLOC_FREE;
-    new_chunk->capacity = len;
-    new_chunk->size = 0;
-    new_chunk->next = NULL;
+    chunk->next = NULL;
+    chunk->prev = NULL;
+    stats.free_len -= chunk->capacity;
+}
 
-    return new_chunk;
+/// Adds a memory region to the heap as a large free chunk followed by an
+/// in-use sentinel chunk. Returns the free chunk.
+static struct malloc_chunk *add_region(void *base, size_t len) {
+    uintptr_t start = ALIGN_UP((uintptr_t) base, 16);
+    uintptr_t end = ALIGN_DOWN((uintptr_t) base + len, 16);
+    ASSERT(end - start >= 2 * MALLOC_FRAME_LEN + LARGE_MIN);
+
+    struct malloc_chunk *chunk = (struct malloc_chunk *) start;
+    chunk->prev_len = 0;
+    chunk->capacity = end - start - 2 * MALLOC_FRAME_LEN;
+    chunk->size = 0;
+
+    struct malloc_chunk *sentinel = next_chunk(chunk);
+    sentinel->magic = MALLOC_IN_USE;
+    sentinel->capacity = 0;
+    sentinel->size = 0;
+    sentinel->prev_len = chunk_len(chunk);
+    sentinel->next = NULL;
+    sentinel->prev = NULL;
+
+    stats.heap_len += end - start;
+    large_insert(chunk);
+    return chunk;
 }
 
-static int get_bin_idx_from_size(size_t size) {
-    // If requested size is less or equal to the size of second largest chunk
-    // (the last fixed chunk).
-    for (size_t i = 0; i < NUM_BINS - 1; i++) {
-        if (size <= 1 << i) {
-            return i;
+#ifndef CONFIG_NOMMU
+// for sparse
+vaddr_t malloc_alloc_pages(size_t num_pages);
+
+/// Allocates memory pages for the heap. Returns 0 on failure. The vm server
+/// overrides this since it can't ask itself for memory.
+__weak vaddr_t malloc_alloc_pages(size_t num_pages) {
+    // Don't use ipc_call(): it may allocate receive buffers from the heap.
+    struct message m;
+    m.type = VM_ALLOC_PAGES_MSG;
+    m.vm_alloc_pages.num_pages = num_pages;
+    m.vm_alloc_pages.paddr = 0;
+    error_t err = sys_ipc(VM_TASK, VM_TASK, &m, IPC_CALL);
+    if (err != OK || m.type != VM_ALLOC_PAGES_REPLY_MSG) {
+        return 0;
+    }
+
+    return m.vm_alloc_pages_reply.vaddr;
+}
+#endif
+
+/// Adds a new region allocated from the vm server large enough for a chunk
+/// of `capacity` bytes. Returns NULL if it's not available.
+static struct malloc_chunk *grow_heap(size_t capacity) {
+#ifdef CONFIG_NOMMU
+    return NULL;
+#else
+    size_t len = MAX(capacity + 2 * MALLOC_FRAME_LEN, HEAP_GROW_LEN);
+    len = ALIGN_UP(len, PAGE_SIZE);
+    vaddr_t vaddr = malloc_alloc_pages(len / PAGE_SIZE);
+    if (!vaddr) {
+        return NULL;
+    }
+
+    return add_region((void *) vaddr, len);
+#endif
+}
+
+#ifndef CONFIG_NOMMU
+// for sparse
+error_t malloc_free_pages(vaddr_t vaddr, size_t num_pages);
+
+/// Returns memory pages allocated by malloc_alloc_pages(). If it fails, the
+/// pages are not returned and the region stays in the heap. The vm server
+/// overrides this since it can't ask itself to free memory.
+__weak error_t malloc_free_pages(vaddr_t vaddr, size_t num_pages) {
+    struct message m;
+    m.type = VM_FREE_PAGES_MSG;
+    m.vm_free_pages.vaddr = vaddr;
+    m.vm_free_pages.num_pages = num_pages;
+    error_t err = sys_ipc(VM_TASK, VM_TASK, &m, IPC_CALL);
+    if (IS_OK(err) && m.type < 0) {
+        err = m.type;
+    }
+
+    return err;
+}
+#endif
+
+/// Returns an entirely free region allocated by grow_heap() to the vm server.
+/// Returns false if it's kept in the heap.
+static bool free_region(struct malloc_chunk *chunk) {
+#ifdef CONFIG_NOMMU
+    return false;
+#else
+    size_t len = chunk_len(chunk) + MALLOC_FRAME_LEN;
+    error_t err = malloc_free_pages((vaddr_t) chunk, len / PAGE_SIZE);
+    if (err != OK) {
+        WARN_DBG("failed to return a heap region to vm: %s", err2str(err));
+        return false;
+    }
+
+    stats.heap_len -= len;
+    return true;
+#endif
+}
+
+/// Returns true if `chunk` is a free chunk spanning an entire region. The
+/// sentinel is the only chunk with no capacity.
+static bool is_free_region(struct malloc_chunk *chunk) {
+    return chunk->magic == MALLOC_FREE && !chunk->prev_len
+           && !next_chunk(chunk)->capacity;
+}
+
+/// Returns a free large chunk into the bins, merging it with its free
+/// neighbors.
+static void large_free(struct malloc_chunk *chunk) {
+    chunk->magic = MALLOC_FREE;
+    struct malloc_chunk *next = next_chunk(chunk);
+    if (next->magic == MALLOC_FREE) {
+        large_remove(next);
+        set_capacity(chunk, chunk->capacity + chunk_len(next));
+    }
+
+    struct malloc_chunk *prev = prev_chunk(chunk);
+    if (prev && prev->magic == MALLOC_FREE) {
+        large_remove(prev);
+        set_capacity(prev, prev->capacity + chunk_len(chunk));
+        chunk = prev;
+    }
+
+    // Return the region to the vm server if it has become entirely free,
+    // unless there's no other spare region: keep it for the next allocation.
+    if (is_free_region(chunk) && chunk != static_region
+        && chunk != spare_region) {
+        if (!spare_region || !is_free_region(spare_region)) {
+            spare_region = chunk;
+        } else if (free_region(chunk)) {
+            return;
         }
     }
 
-    // Return -1 indicating the last, dynamic-sized chunk
-    return -1;
+    large_insert(chunk);
 }
 
-void *malloc(size_t size) {
+/// Shrinks an in-use large chunk to `capacity` bytes and frees the rest if
+/// it's large enough to be a chunk.
+static void trim(struct malloc_chunk *chunk, size_t capacity) {
+    if (chunk->capacity < capacity + MALLOC_FRAME_LEN + LARGE_MIN) {
+        return;
+    }
+
+    size_t rest_capacity = chunk->capacity - capacity - MALLOC_FRAME_LEN;
+    set_capacity(chunk, capacity);
+    struct malloc_chunk *rest = next_chunk(chunk);
+    rest->prev_len = chunk_len(chunk);
+    set_capacity(rest, rest_capacity);
+    large_free(rest);
+}
+
+static struct malloc_chunk *find_free_chunk(size_t capacity) {
+    // Look for the first fit in the bin the size belongs to. A chunk in a
+    // larger bin always fits.
+    int bin = log2_floor(capacity);
+    struct malloc_chunk *chunk = large_bins[bin];
+    while (chunk && chunk->capacity < capacity) {
+        chunk = chunk->next;
+    }
+
+    if (!chunk) {
+        uint64_t larger_bins = large_bitmap & ~((2ULL << bin) - 1);
+        if (!larger_bins) {
+            return NULL;
+        }
+
+        chunk = large_bins[__builtin_ctzll(larger_bins)];
+    }
+
+    return chunk;
+}
+
+static struct malloc_chunk *large_alloc(size_t capacity) {
+    if (capacity >= DIRECT_ALLOC_MIN) {
+        // Don't trim a dedicated region: the rest would be shared with other
+        // allocations and keep the region from being returned. Reuse the
+        // spare region if it fits without wasting more than a heap growth.
+        struct malloc_chunk *chunk = NULL;
+        if (spare_region && is_free_region(spare_region)
+            && spare_region->capacity >= capacity
+            && spare_region->capacity - capacity < HEAP_GROW_LEN) {
+            chunk = spare_region;
+            spare_region = NULL;
+        } else {
+            chunk = grow_heap(capacity);
+        }
+
+        if (chunk) {
+            large_remove(chunk);
+            chunk->magic = MALLOC_IN_USE;
+            return chunk;
+        }
+    }
+
+    struct malloc_chunk *chunk = find_free_chunk(capacity);
+    if (!chunk) {
+        chunk = grow_heap(capacity);
+        if (!chunk) {
+            return NULL;
+        }
+    }
+
+    ASSERT(chunk->magic == MALLOC_FREE);
+    large_remove(chunk);
+    chunk->magic = MALLOC_IN_USE;
+    trim(chunk, capacity);
+    return chunk;
+}
+
+/// Carves a new slab out of the heap and fills the free list of the size
+/// class with its chunks.
+static error_t refill_class(int class) {
+    size_t capacity = 1 << (class + MALLOC_MIN_CLASS_SHIFT);
+    size_t len = MALLOC_FRAME_LEN + capacity;
+    struct malloc_chunk *slab =
+        large_alloc(MAX(MALLOC_SLAB_LEN, MALLOC_SLAB_MIN_CHUNKS * len));
+    if (!slab) {
+        return ERR_NO_MEMORY;
+    }
+
+    // The slab itself is never freed.
+    slab->size = slab->capacity;
+    for (size_t off = 0; off + len <= slab->capacity; off += len) {
+        struct malloc_chunk *chunk = (struct malloc_chunk *) &slab->data[off];
+        chunk->magic = MALLOC_FREE;
+        chunk->capacity = capacity;
+        chunk->size = 0;
+        chunk->prev_len = 0;
+        chunk->prev = NULL;
+        chunk->next = classes[class];
+        classes[class] = chunk;
+    }
+
+    return OK;
+}
+
+#ifdef CONFIG_MALLOC_PROFILE
+static struct malloc_site *lookup_site(vaddr_t caller) {
+    size_t start = (caller >> 2) % CONFIG_MALLOC_PROFILE_NUM_SITES;
+    for (size_t i = 0; i < CONFIG_MALLOC_PROFILE_NUM_SITES; i++) {
+        struct malloc_site *site =
+            &sites[(start + i) % CONFIG_MALLOC_PROFILE_NUM_SITES];
+        if (!site->caller) {
+            site->caller = caller;
+        }
+
+        if (site->caller == caller) {
+            return site;
+        }
+    }
+
+    return &sites[CONFIG_MALLOC_PROFILE_NUM_SITES];
+}
+#endif
+
+static void account_alloc(struct malloc_chunk *chunk, vaddr_t caller) {
+    stats.in_use += chunk->capacity;
+    stats.peak_in_use = MAX(stats.peak_in_use, stats.in_use);
+    stats.num_allocs++;
+#ifdef CONFIG_MALLOC_PROFILE
+    struct malloc_site *site = lookup_site(caller);
+    site->num_allocs++;
+    site->total_bytes += chunk->capacity;
+    site->live_allocs++;
+    site->live_bytes += chunk->capacity;
+    site->peak_bytes = MAX(site->peak_bytes, site->live_bytes);
+    chunk->site = site;
+#endif
+}
+
+static void account_free(struct malloc_chunk *chunk) {
+    stats.in_use -= chunk->capacity;
+    stats.num_allocs--;
+#ifdef CONFIG_MALLOC_PROFILE
+    chunk->site->live_allocs--;
+    chunk->site->live_bytes -= chunk->capacity;
+    chunk->site = NULL;
+#endif
+}
+
+static void *alloc(size_t size, vaddr_t caller) {
     if (!size) {
         size = 1;
     }
@@ -87,60 +437,33 @@ void *malloc(size_t size) {
     // size == 0), allocate 16 bytes.
     size = ALIGN_UP(size, 16);
 
-    int bin_idx = get_bin_idx_from_size(size);
-
-    if (bin_idx != -1 && bins[bin_idx] != NULL) {
-        // Check the list corresponding to that size for a free chunk.
-        struct malloc_chunk *allocated = bins[bin_idx];
-        ASSERT(allocated->magic == MALLOC_FREE);
-
-        allocated->magic = MALLOC_IN_USE;
-        allocated->size = size;
-        memset(allocated->underflow_redzone, MALLOC_REDZONE_UNDFLOW_MARKER,
-               MALLOC_REDZONE_LEN);
-        memset(&allocated->data[allocated->capacity],
-               MALLOC_REDZONE_OVRFLOW_MARKER, MALLOC_REDZONE_LEN);
-
-        bins[bin_idx] = allocated->next;
-        allocated->next = NULL;
-        return allocated->data;
-    }
-
-    struct malloc_chunk *prev = NULL;
-    for (struct malloc_chunk *chunk = bins[NUM_BINS - 1]; chunk;
-         chunk = chunk->next) {
-        ASSERT(chunk->magic == MALLOC_FREE);
-
-        struct malloc_chunk *allocated = NULL;
-        size_t chunk_size = bin_idx < 0 ? size : (1 << bin_idx);
-        if (chunk->capacity > chunk_size + MALLOC_FRAME_LEN) {
-            allocated = split(chunk, chunk_size);
-        } else if (chunk->capacity >= chunk_size) {
-            allocated = chunk;
-            // Remove chunk from the linked list.
-            if (prev) {
-                // If it was not at the head of the list.
-                prev->next = chunk->next;
-            } else {
-                // If it was at the head of the list.
-                bins[NUM_BINS - 1] = bins[NUM_BINS - 1]->next;
-            }
+    struct malloc_chunk *allocated;
+    if (size <= MALLOC_SMALL_MAX) {
+        int class = get_class_from_size(size);
+        if (!classes[class] && refill_class(class) != OK) {
+            PANIC("out of memory");
         }
 
-        if (allocated) {
-            allocated->magic = MALLOC_IN_USE;
-            allocated->size = size;
-            memset(allocated->underflow_redzone, MALLOC_REDZONE_UNDFLOW_MARKER,
-                   MALLOC_REDZONE_LEN);
-            memset(&allocated->data[allocated->capacity],
-                   MALLOC_REDZONE_OVRFLOW_MARKER, MALLOC_REDZONE_LEN);
-            allocated->next = NULL;
-            return allocated->data;
+        allocated = classes[class];
+        ASSERT(allocated->magic == MALLOC_FREE);
+        classes[class] = allocated->next;
+    } else {
+        allocated = large_alloc(size);
+        if (!allocated) {
+            PANIC("out of memory");
         }
-        prev = chunk;
     }
 
-    PANIC("out of memory");
+    allocated->magic = MALLOC_IN_USE;
+    allocated->size = size;
+    allocated->next = NULL;
+    fill_redzones(allocated);
+    account_alloc(allocated, caller);
+    return allocated->data;
+}
+
+void *malloc(size_t size) {
+    return alloc(size, (vaddr_t) __builtin_return_address(0));
 }
 
 static struct malloc_chunk *get_chunk_from_ptr(void *ptr) {
@@ -148,6 +471,10 @@ static struct malloc_chunk *get_chunk_from_ptr(void *ptr) {
         (struct malloc_chunk *) ((uintptr_t) ptr - sizeof(struct malloc_chunk));
 
     // Check its magic and underflow/overflow redzones.
+    if (chunk->magic == MALLOC_FREE) {
+        PANIC("double-free bug!");
+    }
+
     ASSERT(chunk->magic == MALLOC_IN_USE);
     check_buffer_overflow(chunk);
     return chunk;
@@ -157,44 +484,58 @@ void free(void *ptr) {
     if (!ptr) {
         return;
     }
+
     struct malloc_chunk *chunk = get_chunk_from_ptr(ptr);
-    if (chunk->magic == MALLOC_FREE) {
-        PANIC("double-free bug!");
+    account_free(chunk);
+    if (is_large(chunk)) {
+        large_free(chunk);
+        return;
     }
 
+    int class = get_class_from_size(chunk->capacity);
     chunk->magic = MALLOC_FREE;
-
-    int bin_idx = get_bin_idx_from_size(chunk->capacity);
-    bin_idx = bin_idx < 0 ? NUM_BINS - 1 : bin_idx;
-
-    struct malloc_chunk *head = bins[bin_idx];
-    if (head) {
-        chunk->next = head;
-    }
-    bins[bin_idx] = chunk;
+    chunk->next = classes[class];
+    classes[class] = chunk;
 }
 
 void *realloc(void *ptr, size_t size) {
+    vaddr_t caller = (vaddr_t) __builtin_return_address(0);
     if (!ptr) {
-        return malloc(size);
+        return alloc(size, caller);
     }
 
     struct malloc_chunk *chunk = get_chunk_from_ptr(ptr);
     size_t prev_size = chunk->size;
     if (size <= chunk->capacity) {
         // There's enough room. Keep using the current chunk.
+        chunk->size = size;
+        return ptr;
+    }
+
+    // Try growing a large chunk in place by merging the next free chunk.
+    size_t new_capacity = ALIGN_UP(size, 16);
+    struct malloc_chunk *next = is_large(chunk) ? next_chunk(chunk) : NULL;
+    if (next && next->magic == MALLOC_FREE
+        && chunk->capacity + chunk_len(next) >= new_capacity) {
+        account_free(chunk);
+        large_remove(next);
+        set_capacity(chunk, chunk->capacity + chunk_len(next));
+        trim(chunk, new_capacity);
+        chunk->size = new_capacity;
+        fill_redzones(chunk);
+        account_alloc(chunk, caller);
         return ptr;
     }
 
     // There's not enough room. Allocate a new space and copy old data.
-    void *new_ptr = malloc(size);
+    void *new_ptr = alloc(size, caller);
     memcpy(new_ptr, ptr, prev_size);
     free(ptr);
     return new_ptr;
 }
 
 char *strndup(const char *s, size_t n) {
-    char *new_s = malloc(n + 1);
+    char *new_s = alloc(n + 1, (vaddr_t) __builtin_return_address(0));
     strncpy2(new_s, s, n + 1);
     return new_s;
 }
@@ -203,6 +544,67 @@ char *strdup(const char *s) {
     return strndup(s, strlen(s));
 }
 
+void malloc_stats(struct malloc_stats *stats_out) {
+    // The largest free chunk is in the highest non-empty bin.
+    size_t largest_free = 0;
+    if (large_bitmap) {
+        struct malloc_chunk *chunk = large_bins[log2_floor(large_bitmap)];
+        for (; chunk; chunk = chunk->next) {
+            largest_free = MAX(largest_free, chunk->capacity);
+        }
+    }
+
+    *stats_out = stats;
+    stats_out->largest_free = largest_free;
+}
+
+/// Prints the heap statistics and allocation sites in descending order of
+/// their live bytes.
+void malloc_dump(void) {
+    struct malloc_stats s;
+    malloc_stats(&s);
+    INFO("heap: %d bytes in %d chunks (peak: %d bytes), %d bytes mapped",
+         s.in_use, s.num_allocs, s.peak_in_use, s.heap_len);
+    INFO("heap: %d bytes free (largest: %d bytes)", s.free_len,
+         s.largest_free);
+
+#ifdef CONFIG_MALLOC_PROFILE
+    static struct malloc_site *sorted[CONFIG_MALLOC_PROFILE_NUM_SITES + 1];
+    size_t num_sites = 0;
+    for (size_t i = 0; i < CONFIG_MALLOC_PROFILE_NUM_SITES + 1; i++) {
+        if (!sites[i].num_allocs) {
+            continue;
+        }
+
+        // Insertion sort.
+        size_t j = num_sites++;
+        while (j > 0 && sorted[j - 1]->live_bytes < sites[i].live_bytes) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = &sites[i];
+    }
+
+    for (size_t i = 0; i < num_sites; i++) {
+        struct malloc_site *site = sorted[i];
+        const char *name = "(other sites)";
+        size_t offset = 0;
+        if (site->caller) {
+            const struct symbol *symbol = find_symbol(site->caller);
+            name = symbol ? symbol->name : "(invalid address)";
+            offset = symbol ? site->caller - symbol->addr : 0;
+        }
+
+        INFO("%p %s()+0x%x: live: %d bytes in %d chunks, peak: %d bytes, "
+             "total: %d bytes in %d chunks",
+             site->caller, name, offset, site->live_bytes, site->live_allocs,
+             site->peak_bytes, site->total_bytes, site->num_allocs);
+    }
+#else
+    INFO("heap: enable CONFIG_MALLOC_PROFILE to track allocation sites");
+#endif
+}
+
 void malloc_init(void) {
-    insert(__heap, (size_t) __heap_end - (size_t) __heap);
+    static_region = add_region(__heap, (size_t) __heap_end - (size_t) __heap);
 }
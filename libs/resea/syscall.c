@@ -65,3 +65,7 @@ error_t sys_kdebug(const char *cmd, size_t cmd_len, char *buf, size_t buf_len) {
     return syscall(SYS_KDEBUG, (uintptr_t) cmd, cmd_len, (uintptr_t) buf,
                    buf_len, 0);
 }
+
+error_t sys_pmc_setup(unsigned counter, unsigned event) {
+    return syscall(SYS_PMC_SETUP, counter, event, 0, 0, 0);
+}
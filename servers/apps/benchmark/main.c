@@ -12,31 +12,69 @@ static inline uint64_t cycle_counter(void) {
     return (((uint64_t) edx) << 32) | eax;
 }
 
+// Intel PMC events (available since Sandy Bridge): (unit mask << 8) | event.
+#    define PMC_L1D_REPLACEMENT 0x0151  // L1D.REPLACEMENT
+#    define PMC_L2_REFERENCES   0xff24  // L2_RQSTS.REFERENCES
+#    define PMC_ALL_LOADS       0x81d0  // MEM_UOPS_RETIRED.ALL_LOADS
+#    define PMC_DTLB_WALKS      0x0108  // DTLB_LOAD_MISSES.MISS_CAUSES_A_WALK
+
+static const unsigned pmc_events[] = {
+    PMC_L1D_REPLACEMENT,
+    PMC_L2_REFERENCES,
+    PMC_ALL_LOADS,
+    PMC_DTLB_WALKS,
+};
+
+static bool pmc_enabled = false;
+
+static void pmc_init(void) {
+    for (unsigned i = 0; i < sizeof(pmc_events) / sizeof(*pmc_events); i++) {
+        error_t err = sys_pmc_setup(i, pmc_events[i]);
+        if (err != OK) {
+            WARN("performance counters are not available: %s", err2str(err));
+            return;
+        }
+    }
+
+    pmc_enabled = true;
+}
+
+static inline uint64_t read_pmc(unsigned counter) {
+    if (!pmc_enabled) {
+        return 0;
+    }
+
+    uint32_t eax, edx;
+    __asm__ __volatile__("rdpmc" : "=a"(eax), "=d"(edx) : "c"(counter));
+    return (((uint64_t) edx) << 32) | eax;
+}
+
+// Note that it counts L1D misses (replacements), not accesses.
 static inline uint64_t l1d_cache_counter(void) {
-    // TODO:
-    return 0;
+    return read_pmc(0);
 }
 
 static inline uint64_t l2d_cache_counter(void) {
-    // TODO:
-    return 0;
+    return read_pmc(1);
 }
 
 static inline uint64_t mem_access_counter(void) {
-    // TODO:
-    return 0;
+    return read_pmc(2);
 }
 
 static inline uint64_t exception_counter(void) {
-    // TODO:
+    // No common event on x64.
     return 0;
 }
 
 static inline uint64_t l1_tlb_refill_counter(void) {
-    // TODO:
-    return 0;
+    return read_pmc(3);
 }
 #elif __aarch64__
+static void pmc_init(void) {
+    // The kernel has already configured the counters.
+}
+
 static inline uint64_t cycle_counter(void) {
     uint64_t value;
     __asm__ __volatile__("mrs %0, pmccntr_el0" : "=r"(value));
@@ -185,6 +223,7 @@ inline static void end(int i) {
 
 void main(void) {
     INFO("starting IPC benchmark...");
+    pmc_init();
     task_t server_task = ipc_lookup("benchmark_server");
 
     for (int i = 0; i < NUM_ITERS; i++) {
@@ -238,15 +277,14 @@ void main(void) {
     //  IPC round-trip benchmark (with small ool payload)
     //
     for (int i = 0; i < NUM_ITERS; i++) {
-        // Since we don't access the data (ool_payload) to be sent, the kernel
-        // internally handles the page fault on the first message passing. Thus
-        // it should take signficantly long on the first time.
+        // The payload is small enough to be inlined in the message: it's
+        // sent without vm calls.
         static char ool_payload[1] = "A";
 
         struct message m;
         m.type = BENCHMARK_NOP_WITH_OOL_MSG;
         m.benchmark_nop_with_ool.data = ool_payload;
-        m.benchmark_nop_with_ool.data_len = PAGE_SIZE;
+        m.benchmark_nop_with_ool.data_len = sizeof(ool_payload);
 
         begin(i);
         ipc_call(server_task, &m);
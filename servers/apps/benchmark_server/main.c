@@ -18,6 +18,10 @@ void main(void) {
                 free(m.benchmark_nop_with_ool.data);
                 m.type = BENCHMARK_NOP_WITH_OOL_REPLY_MSG;
                 break;
+            default:
+                discard_unknown_message(&m);
+                ipc_recv(IPC_ANY, &m);
+                continue;
         }
 
         ipc_replyrecv(m.src, &m);
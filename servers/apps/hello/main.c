@@ -15,6 +15,8 @@ void main(void) {
         if (m.type == NOTIFICATIONS_MSG) {
             TRACE("Hello, World! (i=%d)", i++);
             timer_set(1000);
+        } else {
+            discard_unknown_message(&m);
         }
     }
 #endif
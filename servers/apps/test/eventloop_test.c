@@ -0,0 +1,63 @@
+#include "test.h"
+#include <resea/eventloop.h>
+#include <resea/ipc.h>
+#include <resea/kernel_info.h>
+#include <resea/printf.h>
+#include <string.h>
+
+static char trace[16];
+static int trace_len = 0;
+static struct ev_waitqueue wq;
+
+static void yielder(void *arg) {
+    for (int i = 0; i < 3; i++) {
+        trace[trace_len++] = (char) (vaddr_t) arg;
+        ev_yield();
+    }
+}
+
+static void waiter(void *arg) {
+    ev_wait(&wq);
+    (*((int *) arg))++;
+}
+
+static void sleeper(void *arg) {
+    ev_sleep(10);
+    *((bool *) arg) = true;
+}
+
+void eventloop_test(void) {
+    // Coroutines run in turn.
+    ev_spawn(yielder, (void *) 'a');
+    ev_spawn(yielder, (void *) 'b');
+    ev_run_ready();
+    TEST_ASSERT(trace_len == 6 && !memcmp(trace, "ababab", 6));
+
+    // Wait queues.
+    int num_woken = 0;
+    ev_waitqueue_init(&wq);
+    for (int i = 0; i < 3; i++) {
+        ev_spawn(waiter, &num_woken);
+    }
+    ev_run_ready();
+    TEST_ASSERT(num_woken == 0);
+    ev_wake_one(&wq);
+    ev_run_ready();
+    TEST_ASSERT(num_woken == 1);
+    ev_wake_all(&wq);
+    ev_run_ready();
+    TEST_ASSERT(num_woken == 3);
+
+    // Timers.
+    bool done = false;
+    msec_t started_at = uptime();
+    ev_spawn(sleeper, &done);
+    ev_run_ready();
+    while (!done) {
+        struct message m;
+        ASSERT_OK(ipc_recv(IPC_ANY, &m));
+        ev_dispatch(&m);
+        ev_run_ready();
+    }
+    TEST_ASSERT(uptime() - started_at >= 10);
+}
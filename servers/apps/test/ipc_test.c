@@ -36,6 +36,19 @@ void ipc_test(void) {
     TEST_ASSERT(err == OK);
     TEST_ASSERT(m.type == BENCHMARK_NOP_WITH_OOL_REPLY_MSG);
 
+    // A vectored ool IPC call.
+    struct ool_iovec iov[] = {
+        {.base = "hello ", .len = 6},
+        {.base = page, .len = sizeof(page)},
+        {.base = "world", .len = 6},
+    };
+    m.type = BENCHMARK_NOP_WITH_OOL_MSG | MSG_IOV;
+    m.benchmark_nop_with_ool.data = iov;
+    m.benchmark_nop_with_ool.data_len = 3;
+    err = ipc_call(VM_TASK, &m);
+    TEST_ASSERT(err == OK);
+    TEST_ASSERT(m.type == BENCHMARK_NOP_WITH_OOL_REPLY_MSG);
+
     // A ool IPC call (with empty payload).
     m.type = BENCHMARK_NOP_WITH_OOL_MSG;
     m.benchmark_nop_with_ool.data = NULL;
@@ -1,6 +1,12 @@
 #include "test.h"
+#include <resea/handle.h>
+#include <resea/kernel_info.h>
 #include <resea/malloc.h>
 #include <resea/printf.h>
+#include <resea/task.h>
+
+static void handle_test_before_free(void *data) {
+}
 
 void libresea_test(void) {
     // malloc
@@ -11,4 +17,33 @@ void libresea_test(void) {
     ptr = malloc(1);
     TEST_ASSERT(ptr != NULL);
     free(ptr);
+
+    // handles
+    task_t self = task_self();
+    handle_t handles[200];
+    for (int i = 0; i < 200; i++) {
+        handles[i] = handle_alloc(self);
+        TEST_ASSERT(handles[i] > 0);
+        handle_set(self, handles[i], &handles[i]);
+    }
+    TEST_ASSERT(handle_get(self, handles[150]) == &handles[150]);
+    handle_t stale = handles[10];
+    handle_free(self, stale);
+    TEST_ASSERT(handle_get(self, stale) == NULL);
+    handles[10] = handle_alloc(self);
+    TEST_ASSERT(handles[10] != stale);
+    TEST_ASSERT(handle_get(self, stale) == NULL);
+    handle_free_all(self, handle_test_before_free);
+    TEST_ASSERT(handle_get(self, handles[0]) == NULL);
+    handle_t reused = handle_alloc(self);
+    TEST_ASSERT(reused != handles[0]);
+    TEST_ASSERT(handle_get(self, handles[0]) == NULL);
+    handle_free(self, reused);
+
+    // kernel info page
+    TEST_ASSERT(num_cpus() >= 1);
+    msec_t uptime_before = uptime();
+    uint64_t ns_before = monotonic_ns();
+    TEST_ASSERT(uptime() >= uptime_before);
+    TEST_ASSERT(monotonic_ns() >= ns_before);
 }
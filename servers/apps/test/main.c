@@ -18,6 +18,8 @@ void main(void) {
     malloc_test();
     datetime_test();
     shm_test();
+    vm_test();
+    eventloop_test();
 
     if (failed) {
         WARN("Failed %d tests", failed);
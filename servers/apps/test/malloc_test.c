@@ -40,4 +40,28 @@ void malloc_test(void) {
     }
     memset(ptr[NUM_PTRS - 1], 0xaa, (1 << 15) + 8);
     free(ptr[NUM_PTRS - 1]);
+
+    // A freed chunk should be reused by the next allocation of the same size.
+    void *small = malloc(100);
+    free(small);
+    TEST_ASSERT(malloc(100) == small);
+
+    // realloc should keep the contents while moving to a larger chunk.
+    memset(small, 0xbb, 100);
+    uint8_t *large = realloc(small, 8192);
+    TEST_ASSERT(large[0] == 0xbb && large[99] == 0xbb);
+    free(large);
+
+    // Statistics.
+    struct malloc_stats before, after;
+    malloc_stats(&before);
+    void *p = malloc(100);
+    malloc_stats(&after);
+    TEST_ASSERT(after.num_allocs == before.num_allocs + 1);
+    TEST_ASSERT(after.in_use >= before.in_use + 100);
+    TEST_ASSERT(after.peak_in_use >= after.in_use);
+    free(p);
+    malloc_stats(&after);
+    TEST_ASSERT(after.num_allocs == before.num_allocs);
+    TEST_ASSERT(after.in_use == before.in_use);
 }
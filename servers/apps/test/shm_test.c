@@ -68,7 +68,43 @@ void shm_access_test(void) {
     TEST_ASSERT(strcmp(TEST_DATA, buf) == 0);
 }
 
+void shm_multi_page_test(void) {
+    struct message m;
+    m.type = SHM_CREATE_MSG;
+    m.shm_create.size = 3 * PAGE_SIZE;
+    ASSERT_OK(ipc_call(INIT_TASK, &m));
+    int shm_id = m.shm_create_reply.shm_id;
+
+    bzero(&m, sizeof(m));
+    m.type = SHM_MAP_MSG;
+    m.shm_map.shm_id = shm_id;
+    m.shm_map.writable = true;
+    ASSERT_OK(ipc_call(INIT_TASK, &m));
+    char *writable = (char *) m.shm_map_reply.vaddr;
+
+    bzero(&m, sizeof(m));
+    m.type = SHM_MAP_MSG;
+    m.shm_map.shm_id = shm_id;
+    m.shm_map.writable = false;
+    ASSERT_OK(ipc_call(INIT_TASK, &m));
+    char *readonly = (char *) m.shm_map_reply.vaddr;
+
+    // All pages are shared between the mappings.
+    TEST_ASSERT(readonly[2 * PAGE_SIZE] == 0);
+    strncpy2(&writable[2 * PAGE_SIZE], TEST_DATA, PAGE_SIZE);
+    TEST_ASSERT(strcmp(&readonly[2 * PAGE_SIZE], TEST_DATA) == 0);
+
+    bzero(&m, sizeof(m));
+    m.type = SHM_CLOSE_MSG;
+    m.shm_close.shm_id = shm_id;
+    TEST_ASSERT(ipc_call(INIT_TASK, &m) == OK);
+    m.type = SHM_CLOSE_MSG;
+    m.shm_close.shm_id = shm_id;
+    TEST_ASSERT(ipc_call(INIT_TASK, &m) == ERR_NOT_FOUND);
+}
+
 void shm_test(void) {
     shm_util_test();
     shm_access_test();
+    shm_multi_page_test();
 }
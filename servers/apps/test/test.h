@@ -18,4 +18,6 @@ void libresea_test(void);
 void malloc_test(void);
 void datetime_test(void);
 void shm_test(void);
+void vm_test(void);
+void eventloop_test(void);
 #endif
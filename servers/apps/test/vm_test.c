@@ -0,0 +1,122 @@
+#include "test.h"
+#include <resea/ipc.h>
+#include <resea/malloc.h>
+#include <resea/task.h>
+#include <string.h>
+
+/// The number of pages the test task may allocate after `page_limit_test`.
+#define PAGE_LIMIT_SLACK 65536
+
+static void *alloc_pages(size_t num_pages) {
+    struct message m;
+    m.type = VM_ALLOC_PAGES_MSG;
+    m.vm_alloc_pages.num_pages = num_pages;
+    m.vm_alloc_pages.paddr = 0;
+    ASSERT_OK(ipc_call(INIT_TASK, &m));
+    return (void *) m.vm_alloc_pages_reply.vaddr;
+}
+
+static error_t free_pages(void *ptr, size_t num_pages) {
+    struct message m;
+    m.type = VM_FREE_PAGES_MSG;
+    m.vm_free_pages.vaddr = (vaddr_t) ptr;
+    m.vm_free_pages.num_pages = num_pages;
+    return ipc_call(INIT_TASK, &m);
+}
+
+static void *clone_pages(void *ptr, size_t num_pages) {
+    struct message m;
+    m.type = VM_CLONE_PAGES_MSG;
+    m.vm_clone_pages.dst = task_self();
+    m.vm_clone_pages.vaddr = (vaddr_t) ptr;
+    m.vm_clone_pages.num_pages = num_pages;
+    ASSERT_OK(ipc_call(INIT_TASK, &m));
+    return (void *) m.vm_clone_pages_reply.vaddr;
+}
+
+static void cow_test(void) {
+    char *original = alloc_pages(2);
+    strncpy2(original, "first page", PAGE_SIZE);
+    strncpy2(&original[PAGE_SIZE], "second page", PAGE_SIZE);
+
+    char *clone = clone_pages(original, 2);
+    TEST_ASSERT(clone != original);
+    TEST_ASSERT(!strcmp(clone, "first page"));
+    TEST_ASSERT(!strcmp(&clone[PAGE_SIZE], "second page"));
+
+    // Writes are not visible from the other side.
+    strncpy2(clone, "written in the clone", PAGE_SIZE);
+    TEST_ASSERT(!strcmp(original, "first page"));
+    strncpy2(&original[PAGE_SIZE], "written in the original", PAGE_SIZE);
+    TEST_ASSERT(!strcmp(&clone[PAGE_SIZE], "second page"));
+    TEST_ASSERT(!strcmp(clone, "written in the clone"));
+}
+
+static void free_pages_test(void) {
+    char *ptr = alloc_pages(4);
+    strncpy2(ptr, "hello", PAGE_SIZE);
+    TEST_ASSERT(free_pages(ptr, 4) == OK);
+
+    // The freed virtual address range is reused.
+    TEST_ASSERT(alloc_pages(4) == ptr);
+    TEST_ASSERT(free_pages(ptr, 4) == OK);
+
+    // Double free.
+    TEST_ASSERT(free_pages(ptr, 4) == ERR_INVALID_ARG);
+}
+
+static size_t resident_pages(void) {
+    struct message m;
+    m.type = VM_STATS_MSG;
+    m.vm_stats.task = task_self();
+    ASSERT_OK(ipc_call(INIT_TASK, &m));
+    return m.vm_stats_reply.resident_pages;
+}
+
+static error_t set_page_limit(size_t max_pages) {
+    struct message m;
+    m.type = VM_SET_PAGE_LIMIT_MSG;
+    m.vm_set_page_limit.task = task_self();
+    m.vm_set_page_limit.max_pages = max_pages;
+    return ipc_call(INIT_TASK, &m);
+}
+
+static void page_limit_test(void) {
+    size_t before = resident_pages();
+    char *ptr = alloc_pages(4);
+    TEST_ASSERT(resident_pages() == before + 4);
+    TEST_ASSERT(free_pages(ptr, 4) == OK);
+    TEST_ASSERT(resident_pages() == before);
+
+    // A task can't lift its own limit, so leave enough room for other tests.
+    size_t limit = before + PAGE_LIMIT_SLACK;
+    TEST_ASSERT(set_page_limit(limit) == OK);
+    struct message m;
+    m.type = VM_ALLOC_PAGES_MSG;
+    m.vm_alloc_pages.num_pages = PAGE_LIMIT_SLACK + 1;
+    m.vm_alloc_pages.paddr = 0;
+    TEST_ASSERT(ipc_call(INIT_TASK, &m) == ERR_NO_MEMORY);
+
+    // Only the pager can raise or remove the limit.
+    TEST_ASSERT(set_page_limit(limit + 1) == ERR_NOT_PERMITTED);
+    TEST_ASSERT(set_page_limit(0) == ERR_NOT_PERMITTED);
+    TEST_ASSERT(set_page_limit(limit) == OK);
+}
+
+static void heap_test(void) {
+    // A huge allocation is served from dedicated pages and they're returned to
+    // vm once it's freed.
+    size_t before = resident_pages();
+    char *ptr = malloc(1024 * 1024);
+    memset(ptr, 0xaa, 1024 * 1024);
+    TEST_ASSERT(resident_pages() >= before + 256);
+    free(ptr);
+    TEST_ASSERT(resident_pages() < before + 256);
+}
+
+void vm_test(void) {
+    cow_test();
+    free_pages_test();
+    page_limit_test();
+    heap_test();
+}
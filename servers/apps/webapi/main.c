@@ -130,6 +130,56 @@ static void tcp_read(handle_t handle) {
     }
 }
 
+static void handle_async_message(struct message *m) {
+    switch (m->type) {
+        case TCPIP_RECEIVED_MSG:
+            tcp_read(m->tcpip_received.handle);
+            break;
+        case TCPIP_NEW_CLIENT_MSG: {
+            struct message r;
+            r.type = TCPIP_ACCEPT_MSG;
+            r.tcpip_accept.handle = m->tcpip_new_client.handle;
+            ASSERT_OK(ipc_call(tcpip_server, &r));
+            handle_t new_handle = r.tcpip_accept_reply.new_handle;
+
+            struct client *client = malloc(sizeof(*client));
+            client->handle = new_handle;
+            client->request = NULL;
+            client->request_len = 0;
+            client->done = false;
+            list_push_back(&clients, &client->next);
+            tcp_read(client->handle);
+            break;
+        }
+        case TCPIP_CLOSED_MSG: {
+            LIST_FOR_EACH (c, &clients, struct client, next) {
+                if (c->handle == m->tcpip_closed.handle) {
+                    list_remove(&c->next);
+                    break;
+                }
+            }
+            break;
+        }
+    }
+}
+
+/// Handles messages from tcpip. NOTIFY_ASYNC doesn't mean that tcpip has
+/// messages for us (it may be sent by others), so don't block on tcpip.
+static void receive_async_messages(void) {
+    struct message msgs[ASYNC_BATCH_MAX];
+    size_t num_msgs;
+    error_t err =
+        async_recv_batch(tcpip_server, msgs, ASYNC_BATCH_MAX, &num_msgs);
+    if (err != OK) {
+        WARN_DBG("failed to receive async messages: %s", err2str(err));
+        return;
+    }
+
+    for (size_t i = 0; i < num_msgs; i++) {
+        handle_async_message(&msgs[i]);
+    }
+}
+
 void main(void) {
     TRACE("starting...");
     tcpip_server = ipc_lookup("tcpip");
@@ -148,37 +198,7 @@ void main(void) {
         switch (m.type) {
             case NOTIFICATIONS_MSG: {
                 if (m.notifications.data & NOTIFY_ASYNC) {
-                    ASSERT_OK(async_recv(tcpip_server, &m));
-                    switch (m.type) {
-                        case TCPIP_RECEIVED_MSG:
-                            tcp_read(m.tcpip_received.handle);
-                            break;
-                        case TCPIP_NEW_CLIENT_MSG: {
-                            m.type = TCPIP_ACCEPT_MSG;
-                            m.tcpip_accept.handle = m.tcpip_new_client.handle;
-                            ASSERT_OK(ipc_call(tcpip_server, &m));
-                            handle_t new_handle =
-                                m.tcpip_accept_reply.new_handle;
-
-                            struct client *client = malloc(sizeof(*client));
-                            client->handle = new_handle;
-                            client->request = NULL;
-                            client->request_len = 0;
-                            client->done = false;
-                            list_push_back(&clients, &client->next);
-                            tcp_read(client->handle);
-                            break;
-                        }
-                        case TCPIP_CLOSED_MSG: {
-                            LIST_FOR_EACH (c, &clients, struct client, next) {
-                                if (c->handle == m.tcpip_closed.handle) {
-                                    list_remove(&c->next);
-                                    break;
-                                }
-                            }
-                            break;
-                        }
-                    }
+                    receive_async_messages();
                 }
                 break;
             };
@@ -12,6 +12,8 @@ static list_t devices;
 
 void main(void) {
     TRACE("starting...");
+    // We receive async messages from vm.
+    ipc_lookup_notify_exit();
     list_init(&devices);
     pci_init();
 
@@ -1,5 +1,6 @@
 #include "ide.h"
 #include <driver/io.h>
+#include <resea/async.h>
 #include <resea/ipc.h>
 #include <resea/malloc.h>
 #include <resea/printf.h>
@@ -65,21 +66,21 @@ void main(void) {
                 size_t sector = m.blk_read.sector;
                 size_t len = m.blk_read.num_sectors * SECTOR_SIZE;
                 if (len > BUF_SIZE) {
-                    ipc_reply_err(m.src, ERR_NOT_ACCEPTABLE);
+                    async_send_reply_err(m.src, ERR_NOT_ACCEPTABLE);
                     break;
                 }
 
                 uint8_t buf[BUF_SIZE];
                 error_t err = ide_read(sector, buf, len);
                 if (err != OK) {
-                    ipc_reply_err(m.src, err);
+                    async_send_reply_err(m.src, err);
                     break;
                 }
 
                 m.type = BLK_READ_REPLY_MSG;
                 m.blk_read_reply.data = buf;
                 m.blk_read_reply.data_len = len;
-                ipc_reply(m.src, &m);
+                OOPS_OK(async_send_reply(m.src, &m));
                 break;
             }
             case BLK_WRITE_MSG: {
@@ -87,16 +88,19 @@ void main(void) {
                                         m.blk_write.data_len);
                 free(m.blk_write.data);
                 if (err != OK) {
-                    ipc_reply_err(m.src, err);
+                    async_send_reply_err(m.src, err);
                     break;
                 }
 
                 m.type = BLK_WRITE_REPLY_MSG;
-                ipc_reply(m.src, &m);
+                OOPS_OK(async_send_reply(m.src, &m));
                 break;
             }
+            case ASYNC_BATCH_MSG:
+                async_reply_batch(m.src, m.async_batch.max);
+                break;
             default:
-                TRACE("unknown message %d", m.type);
+                discard_unknown_message(&m);
         }
     }
 }
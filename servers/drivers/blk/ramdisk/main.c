@@ -1,3 +1,4 @@
+#include <resea/async.h>
 #include <resea/ipc.h>
 #include <resea/malloc.h>
 #include <resea/printf.h>
@@ -22,14 +23,14 @@ void main(void) {
                 size_t offset = m.blk_read.sector * SECTOR_SIZE;
                 size_t len = m.blk_read.num_sectors * SECTOR_SIZE;
                 if (offset + len > disk_size || offset + len < offset) {
-                    ipc_reply_err(m.src, ERR_NOT_ACCEPTABLE);
+                    async_send_reply_err(m.src, ERR_NOT_ACCEPTABLE);
                     break;
                 }
 
                 m.type = BLK_READ_REPLY_MSG;
                 m.blk_read_reply.data = &__image[offset];
                 m.blk_read_reply.data_len = len;
-                ipc_reply(m.src, &m);
+                OOPS_OK(async_send_reply(m.src, &m));
                 break;
             }
             case BLK_WRITE_MSG: {
@@ -37,7 +38,7 @@ void main(void) {
                 size_t len = m.blk_write.data_len;
                 if (offset + len > disk_size || offset + len < offset
                     || !IS_ALIGNED(len, SECTOR_SIZE)) {
-                    ipc_reply_err(m.src, ERR_NOT_ACCEPTABLE);
+                    async_send_reply_err(m.src, ERR_NOT_ACCEPTABLE);
                     break;
                 }
 
@@ -45,11 +46,14 @@ void main(void) {
                 free(m.blk_write.data);
 
                 m.type = BLK_WRITE_REPLY_MSG;
-                ipc_reply(m.src, &m);
+                OOPS_OK(async_send_reply(m.src, &m));
                 break;
             }
+            case ASYNC_BATCH_MSG:
+                async_reply_batch(m.src, m.async_batch.max);
+                break;
             default:
-                TRACE("unknown message %d", m.type);
+                discard_unknown_message(&m);
         }
     }
 }
@@ -298,7 +298,7 @@ void main(void) {
 #endif
                 break;
             default:
-                TRACE("unknown message %d", m.type);
+                discard_unknown_message(&m);
         }
     }
 }
@@ -156,7 +156,7 @@ void main(void) {
                     handle_keyboard_irq();
                 }
             default:
-                TRACE("unknown message %s", msgtype2str(m.type));
+                discard_unknown_message(&m);
         }
     }
 }
@@ -19,11 +19,14 @@ static void receive(const void *payload, size_t len) {
 }
 
 static void transmit(void) {
-    struct message m;
-    ASSERT_OK(async_recv(tcpip_tid, &m));
-    ASSERT(m.type == NET_TX_MSG);
-    e1000_transmit(m.net_tx.payload, m.net_tx.payload_len);
-    free(m.net_tx.payload);
+    struct message msgs[ASYNC_BATCH_MAX];
+    size_t num_msgs;
+    ASSERT_OK(async_recv_batch(tcpip_tid, msgs, ASYNC_BATCH_MAX, &num_msgs));
+    for (size_t i = 0; i < num_msgs; i++) {
+        ASSERT(msgs[i].type == NET_TX_MSG);
+        e1000_transmit(msgs[i].net_tx.payload, msgs[i].net_tx.payload_len);
+        free(msgs[i].net_tx.payload);
+    }
 }
 
 void main(void) {
@@ -88,7 +91,7 @@ void main(void) {
                 }
                 break;
             default:
-                TRACE("unknown message %d", m.type);
+                discard_unknown_message(&m);
         }
     }
 }
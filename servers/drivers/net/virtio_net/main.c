@@ -90,15 +90,9 @@ static void receive(const void *payload, size_t len) {
     ASSERT_OK(err);
 }
 
-static void transmit(void) {
-    // Receive a packet to be sent.
-    struct message m;
-    ASSERT_OK(async_recv(tcpip_task, &m));
-    ASSERT(m.type == NET_TX_MSG);
-
+static void push_tx_packet(const void *payload, size_t len) {
     // Fill the request.
     int index = tx_ring_index++ % tx_virtq->num_descs;
-    size_t len = m.net_tx.payload_len;
     paddr_t paddr;
     struct virtio_net_buffer *buf = get_buffer(tx_buffers_dma, index, &paddr);
     ASSERT(len <= sizeof(buf->payload));
@@ -108,19 +102,31 @@ static void transmit(void) {
     buf->header.checksum_start = 0;
     buf->header.checksum_offset = 0;
     buf->header.num_buffers = 0;
-    memcpy((uint8_t *) &buf->payload, m.net_tx.payload, len);
+    memcpy((uint8_t *) &buf->payload, payload, len);
 
     // Construct a descriptor chain for the reqeust.
     struct virtio_chain_entry chain[1];
     chain[0].addr = paddr;
     chain[0].len = sizeof(struct virtio_net_header) + len;
     chain[0].device_writable = false;
-
-    // Kick the device.
     OOPS_OK(virtio->virtq_push(tx_virtq, chain, 1));
-    virtio->virtq_notify(tx_virtq);
+}
 
-    free(m.net_tx.payload);
+static void transmit(void) {
+    // Receive packets to be sent.
+    struct message msgs[ASYNC_BATCH_MAX];
+    size_t num_msgs;
+    ASSERT_OK(async_recv_batch(tcpip_task, msgs, ASYNC_BATCH_MAX, &num_msgs));
+    for (size_t i = 0; i < num_msgs; i++) {
+        ASSERT(msgs[i].type == NET_TX_MSG);
+        push_tx_packet(msgs[i].net_tx.payload, msgs[i].net_tx.payload_len);
+        free(msgs[i].net_tx.payload);
+    }
+
+    // Kick the device.
+    if (num_msgs > 0) {
+        virtio->virtq_notify(tx_virtq);
+    }
 }
 
 void main(void) {
@@ -197,7 +203,7 @@ void main(void) {
                 }
                 break;
             default:
-                TRACE("unknown message %d", m.type);
+                discard_unknown_message(&m);
         }
     }
 }
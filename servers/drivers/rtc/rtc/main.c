@@ -87,7 +87,7 @@ void main(void) {
                 break;
             }
             default:
-                TRACE("unknown message %d", m.type);
+                discard_unknown_message(&m);
         }
     }
 }
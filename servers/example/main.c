@@ -13,7 +13,7 @@ void main(void) {
 
         switch (m.type) {
             default:
-                TRACE("unknown message %d", m.type);
+                discard_unknown_message(&m);
         }
     }
 }
@@ -1,21 +1,35 @@
 #include "fat.h"
+#include <resea/eventloop.h>
 #include <resea/handle.h>
 #include <resea/ipc.h>
 #include <resea/malloc.h>
 #include <resea/printf.h>
 #include <string.h>
 
+/// The maximum length of a fs.read reply. Payloads larger than the client's
+/// receive buffer are transferred in pages allocated by vm.
+#define READ_LEN_MAX (256 * 1024)
+
 static task_t ramdisk_server;
+static struct fat fs;
+/// Requests are handled in coroutines, and they're suspended while waiting for
+/// the disk. `fat_create` and `fat_write` update the FAT and directories, so
+/// they take the lock exclusively. `fat_open` and `fat_read` only walk them and
+/// can run concurrently with each other.
+static bool fs_writing = false;
+static unsigned fs_readers = 0;
+static struct ev_waitqueue fs_lock_waiters;
 
 void blk_read(size_t sector, void *buf, size_t num_sectors) {
     struct message m;
     m.type = BLK_READ_MSG;
     m.blk_read.sector = sector;
     m.blk_read.num_sectors = num_sectors;
-    error_t err = ipc_call(ramdisk_server, &m);
+    error_t err = ev_call(ramdisk_server, &m);
     ASSERT(IS_OK(err));
     ASSERT(m.type == BLK_READ_REPLY_MSG);
     memcpy(buf, m.blk_read_reply.data, m.blk_read_reply.data_len);
+    free(m.blk_read_reply.data);
 }
 
 void blk_write(size_t sector, const void *buf, size_t num_sectors) {
@@ -24,18 +38,141 @@ void blk_write(size_t sector, const void *buf, size_t num_sectors) {
     m.blk_write.sector = sector;
     m.blk_write.data = (void *) buf;
     m.blk_write.data_len = num_sectors * SECTOR_SIZE;
-    error_t err = ipc_call(ramdisk_server, &m);
+    error_t err = ev_call(ramdisk_server, &m);
     ASSERT(IS_OK(err));
     ASSERT(m.type == BLK_WRITE_REPLY_MSG);
 }
 
-void main(void) {
-    TRACE("starting...");
+static void lock_fs(void) {
+    while (fs_writing || fs_readers > 0) {
+        ev_wait(&fs_lock_waiters);
+    }
 
-    ramdisk_server = ipc_lookup("disk");
-    ASSERT_OK(ramdisk_server);
+    fs_writing = true;
+}
+
+static void unlock_fs(void) {
+    fs_writing = false;
+    ev_wake_all(&fs_lock_waiters);
+}
+
+static void lock_fs_shared(void) {
+    while (fs_writing) {
+        ev_wait(&fs_lock_waiters);
+    }
+
+    fs_readers++;
+}
+
+static void unlock_fs_shared(void) {
+    DEBUG_ASSERT(fs_readers > 0);
+    fs_readers--;
+    if (!fs_readers) {
+        ev_wake_all(&fs_lock_waiters);
+    }
+}
+
+/// Handles a request in a coroutine. Other requests are handled while it's
+/// waiting for the disk.
+static void handler(struct message *m) {
+    switch (m->type) {
+        case FS_OPEN_MSG: {
+            struct fat_file *file = malloc(sizeof(*file));
+            lock_fs_shared();
+            error_t err = fat_open(&fs, file, m->fs_open.path);
+            unlock_fs_shared();
+            if (IS_ERROR(err)) {
+                free(file);
+                ipc_reply_err(m->src, err);
+                break;
+            }
+
+            handle_t handle = handle_alloc(m->src);
+            handle_set(m->src, handle, file);
+
+            m->type = FS_OPEN_REPLY_MSG;
+            m->fs_open_reply.handle = handle;
+            ipc_reply(m->src, m);
+            break;
+        }
+        case FS_CREATE_MSG: {
+            struct fat_file *file = malloc(sizeof(*file));
+            lock_fs();
+            error_t err = fat_create(&fs, file, m->fs_create.path,
+                                     m->fs_create.exist_ok);
+            unlock_fs();
+            if (IS_ERROR(err)) {
+                free(file);
+                ipc_reply_err(m->src, err);
+                break;
+            }
+
+            handle_t handle = handle_alloc(m->src);
+            handle_set(m->src, handle, file);
+
+            m->type = FS_CREATE_REPLY_MSG;
+            m->fs_create_reply.handle = handle;
+            ipc_reply(m->src, m);
+            break;
+        }
+        case FS_READ_MSG: {
+            struct fat_file *file = handle_get(m->src, m->fs_read.handle);
+            if (!file) {
+                ipc_reply_err(m->src, ERR_NOT_FOUND);
+                break;
+            }
+
+            size_t max_len = MIN(READ_LEN_MAX, m->fs_read.len);
+            void *buf = malloc(max_len);
+            lock_fs_shared();
+            int len_or_err =
+                fat_read(&fs, file, m->fs_read.offset, buf, max_len);
+            unlock_fs_shared();
+            if (IS_ERROR(len_or_err)) {
+                free(buf);
+                ipc_reply_err(m->src, len_or_err);
+                break;
+            }
+
+            m->type = FS_READ_REPLY_MSG;
+            m->fs_read_reply.data = buf;
+            m->fs_read_reply.data_len = len_or_err;
+            ipc_reply(m->src, m);
+            free(buf);
+            break;
+        }
+        case FS_WRITE_MSG: {
+            struct fat_file *file = handle_get(m->src, m->fs_write.handle);
+            if (!file) {
+                ipc_reply_err(m->src, ERR_NOT_FOUND);
+                break;
+            }
+
+            lock_fs();
+            error_t err = fat_write(&fs, file, m->fs_write.offset,
+                                    m->fs_write.data, m->fs_write.data_len);
+            unlock_fs();
+            if (IS_ERROR(err)) {
+                ipc_reply_err(m->src, err);
+                break;
+            }
 
-    struct fat fs;
+            m->type = FS_WRITE_REPLY_MSG;
+            ipc_reply(m->src, m);
+            break;
+        }
+        case NOTIFICATIONS_MSG:
+            // NOTIFY_ASYNC from the disk server: its replies have been
+            // delivered to `ev_call`.
+            break;
+        default:
+            discard_unknown_message(m);
+    }
+}
+
+/// Mounts the file system. It reads the disk by `ev_call`, so it runs in a
+/// coroutine.
+static void init(void *arg) {
     if (IS_ERROR(fat_probe(&fs, blk_read, blk_write))) {
         PANIC("failed to locate a FAT file system");
     }
@@ -52,93 +189,16 @@ void main(void) {
     DBG("---------------------------------------------------");
 
     ASSERT_OK(ipc_serve("fs"));
-
     TRACE("ready");
-    while (true) {
-        struct message m;
-        bzero(&m, sizeof(m));
-        error_t err = ipc_recv(IPC_ANY, &m);
-        ASSERT_OK(err);
-
-        switch (m.type) {
-            case FS_OPEN_MSG: {
-                struct fat_file *file = malloc(sizeof(*file));
-                error_t err = fat_open(&fs, file, m.fs_open.path);
-                if (IS_ERROR(err)) {
-                    free(file);
-                    ipc_reply_err(m.src, err);
-                    break;
-                }
-
-                handle_t handle = handle_alloc(m.src);
-                handle_set(m.src, handle, file);
-
-                m.type = FS_OPEN_REPLY_MSG;
-                m.fs_open_reply.handle = handle;
-                ipc_reply(m.src, &m);
-                break;
-            }
-            case FS_CREATE_MSG: {
-                struct fat_file *file = malloc(sizeof(*file));
-                error_t err = fat_create(&fs, file, m.fs_create.path,
-                                         m.fs_create.exist_ok);
-                if (IS_ERROR(err)) {
-                    free(file);
-                    ipc_reply_err(m.src, err);
-                    break;
-                }
-
-                handle_t handle = handle_alloc(m.src);
-                handle_set(m.src, handle, file);
-
-                m.type = FS_CREATE_REPLY_MSG;
-                m.fs_create_reply.handle = handle;
-                ipc_reply(m.src, &m);
-                break;
-            }
-            case FS_READ_MSG: {
-                struct fat_file *file = handle_get(m.src, m.fs_read.handle);
-                if (!file) {
-                    ipc_reply_err(m.src, ERR_NOT_FOUND);
-                    break;
-                }
-
-                size_t max_len = MIN(8192, m.fs_read.len);
-                void *buf = malloc(max_len);
-                int len_or_err =
-                    fat_read(&fs, file, m.fs_read.offset, buf, max_len);
-                if (IS_ERROR(len_or_err)) {
-                    ipc_reply_err(m.src, len_or_err);
-                    break;
-                }
-
-                m.type = FS_READ_REPLY_MSG;
-                m.fs_read_reply.data = buf;
-                m.fs_read_reply.data_len = len_or_err;
-                ipc_reply(m.src, &m);
-                free(buf);
-                break;
-            }
-            case FS_WRITE_MSG: {
-                struct fat_file *file = handle_get(m.src, m.fs_write.handle);
-                if (!file) {
-                    ipc_reply_err(m.src, ERR_NOT_FOUND);
-                    break;
-                }
-
-                error_t err = fat_write(&fs, file, m.fs_write.offset,
-                                        m.fs_write.data, m.fs_write.data_len);
-                if (IS_ERROR(err)) {
-                    ipc_reply_err(m.src, err);
-                    break;
-                }
-
-                m.type = FS_WRITE_REPLY_MSG;
-                ipc_reply(m.src, &m);
-                break;
-            }
-            default:
-                TRACE("unknown message %d", m.type);
-        }
-    }
+}
+
+void main(void) {
+    TRACE("starting...");
+
+    ramdisk_server = ipc_lookup("disk");
+    ASSERT_OK(ramdisk_server);
+
+    ev_waitqueue_init(&fs_lock_waiters);
+    ev_spawn(init, NULL);
+    ev_run(handler);
 }
@@ -9,6 +9,10 @@ extern char __tarball[];
 extern char __tarball_end[];
 static list_t files;
 
+/// The maximum length of a fs.read reply. Payloads larger than the client's
+/// receive buffer are transferred in pages allocated by vm.
+#define READ_LEN_MAX (256 * 1024)
+
 #define TAR_TYPE_NORMAL  '0'
 #define TAR_TYPE_SYMLINK '2'
 #define TAR_TYPE_DIR     '5'
@@ -156,9 +160,9 @@ void main(void) {
                     break;
                 }
 
-                size_t max_len = MIN(8192, m.fs_read.len);
+                size_t max_len = MIN(READ_LEN_MAX, m.fs_read.len);
                 void *buf = malloc(max_len);
-                int read_len = read(file, m.fs_read.offset, buf, m.fs_read.len);
+                int read_len = read(file, m.fs_read.offset, buf, max_len);
                 m.type = FS_READ_REPLY_MSG;
                 m.fs_read_reply.data = buf;
                 m.fs_read_reply.data_len = read_len;
@@ -167,7 +171,7 @@ void main(void) {
                 break;
             }
             default:
-                TRACE("unknown message %d", m.type);
+                discard_unknown_message(&m);
         }
     }
 }
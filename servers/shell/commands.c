@@ -39,15 +39,96 @@ static void ps_command(__unused int argc, __unused char **argv) {
     kdebug("ps");
 }
 
+static void mem_command(__unused int argc, __unused char **argv) {
+    bool printed_free = false;
+    for (task_t tid = 1; tid <= CONFIG_NUM_TASKS; tid++) {
+        struct message m;
+        m.type = VM_STATS_MSG;
+        m.vm_stats.task = tid;
+        if (ipc_call(VM_TASK, &m) != OK) {
+            continue;
+        }
+
+        if (!printed_free) {
+            INFO("free: %d/%d pages", m.vm_stats_reply.free_pages,
+                 m.vm_stats_reply.total_pages);
+            printed_free = true;
+        }
+
+        if (m.vm_stats_reply.max_pages) {
+            INFO("#%d: %d pages (limit: %d)", tid,
+                 m.vm_stats_reply.resident_pages, m.vm_stats_reply.max_pages);
+        } else {
+            INFO("#%d: %d pages", tid, m.vm_stats_reply.resident_pages);
+        }
+    }
+}
+
+static void heap_command(int argc, char **argv) {
+    if (argc < 2) {
+        WARN("heap: too few arguments");
+        return;
+    }
+
+    task_t tid = atoi(argv[1]);
+    struct message m;
+    m.type = HEAP_STATS_MSG;
+    error_t err = ipc_call(tid, &m);
+    if (err != OK) {
+        WARN("heap: failed to get stats from #%d: %s", tid, err2str(err));
+        return;
+    }
+
+    size_t free_len = m.heap_stats_reply.free_len;
+    size_t largest_free = m.heap_stats_reply.largest_free;
+    INFO("#%d: %d bytes in %d chunks (peak: %d bytes), %d bytes mapped", tid,
+         m.heap_stats_reply.in_use, m.heap_stats_reply.num_allocs,
+         m.heap_stats_reply.peak_in_use, m.heap_stats_reply.heap_len);
+    INFO("#%d: %d bytes free, fragmentation: %d%%", tid, free_len,
+         free_len ? 100 - largest_free * 100 / free_len : 0);
+
+    if (argc >= 3 && !strcmp(argv[2], "dump")) {
+        // The task prints allocation sites into its log.
+        m.type = HEAP_DUMP_MSG;
+        ipc_call(tid, &m);
+    }
+}
+
 static void quit_command(__unused int argc, __unused char **argv) {
     kdebug("q");
 }
 
+static void prof_command(int argc, char **argv) {
+    if (argc < 2) {
+        WARN("prof: too few arguments");
+        return;
+    }
+
+    char cmd[32];
+    snprintf(cmd, sizeof(cmd), "prof %s", argv[1]);
+    kdebug(cmd);
+}
+
+static void trace_command(int argc, char **argv) {
+    if (argc < 2) {
+        WARN("trace: too few arguments");
+        return;
+    }
+
+    char cmd[32];
+    snprintf(cmd, sizeof(cmd), "trace %s", argv[1]);
+    kdebug(cmd);
+}
+
 static void help_command(__unused int argc, __unused char **argv) {
     INFO("help              -  Print this message.");
     INFO("<task> cmdline... -  Launch a task.");
     INFO("ps                -  List tasks.");
+    INFO("mem               -  List memory usage per task.");
+    INFO("heap tid [dump]   -  Show (and dump) the heap usage of a task.");
     INFO("q                 -  Halt the computer.");
+    INFO("prof start|stop|dump -  Control the sampling profiler.");
+    INFO("trace start|stop|dump - Control the kernel trace buffer.");
     INFO("fs-read path      -  Read a file.");
     INFO("fs-write path str -  Write a string into a file.");
     INFO("http-get url      -  Peform a HTTP GET request.");
@@ -56,7 +137,11 @@ static void help_command(__unused int argc, __unused char **argv) {
 struct command commands[] = {
     {.name = "help", .run = help_command},
     {.name = "ps", .run = ps_command},
+    {.name = "mem", .run = mem_command},
+    {.name = "heap", .run = heap_command},
     {.name = "q", .run = quit_command},
+    {.name = "prof", .run = prof_command},
+    {.name = "trace", .run = trace_command},
     {.name = "fs-read", .run = fs_read_command},
     {.name = "fs-write", .run = fs_write_command},
     {.name = "http-get", .run = http_get_command},
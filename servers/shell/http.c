@@ -100,6 +100,43 @@ static error_t resolve_url(const char *url, uint32_t *ip_addr, uint16_t *port,
     return OK;
 }
 
+static void handle_async_message(handle_t handle, struct message *m) {
+    switch (m->type) {
+        case TCPIP_RECEIVED_MSG: {
+            struct message r;
+            r.type = TCPIP_READ_MSG;
+            r.tcpip_read.handle = m->tcpip_received.handle;
+            r.tcpip_read.len = 4096;
+            ASSERT_OK(ipc_call(tcpip_server, &r));
+
+            uint8_t *buf = (uint8_t *) r.tcpip_read_reply.data;
+            size_t len = r.tcpip_read_reply.data_len;
+            received(handle, buf, len);
+            free(buf);
+            break;
+        }
+        default:
+            WARN("unknown async message type (type=%d)", m->type);
+    }
+}
+
+/// Handles messages from tcpip. NOTIFY_ASYNC doesn't mean that tcpip has
+/// messages for us (it may be sent by others), so don't block on tcpip.
+static void receive_async_messages(handle_t handle) {
+    struct message msgs[ASYNC_BATCH_MAX];
+    size_t num_msgs;
+    error_t err =
+        async_recv_batch(tcpip_server, msgs, ASYNC_BATCH_MAX, &num_msgs);
+    if (err != OK) {
+        WARN_DBG("failed to receive async messages: %s", err2str(err));
+        return;
+    }
+
+    for (size_t i = 0; i < num_msgs; i++) {
+        handle_async_message(handle, &msgs[i]);
+    }
+}
+
 void http_get(const char *url) {
     tcpip_server = ipc_lookup("tcpip");
 
@@ -130,24 +167,7 @@ void http_get(const char *url) {
         switch (m.type) {
             case NOTIFICATIONS_MSG: {
                 if (m.notifications.data & NOTIFY_ASYNC) {
-                    ASSERT_OK(async_recv(tcpip_server, &m));
-                    switch (m.type) {
-                        case TCPIP_RECEIVED_MSG: {
-                            m.type = TCPIP_READ_MSG;
-                            m.tcpip_read.handle = m.tcpip_received.handle;
-                            m.tcpip_read.len = 4096;
-                            ASSERT_OK(ipc_call(tcpip_server, &m));
-
-                            uint8_t *buf = (uint8_t *) m.tcpip_read_reply.data;
-                            size_t len = m.tcpip_read_reply.data_len;
-                            received(handle, buf, len);
-                            free(buf);
-                            break;
-                        }
-                        default:
-                            WARN("unknown async message type (type=%d)",
-                                 m.type);
-                    }
+                    receive_async_messages(handle);
                 }
                 break;
             };
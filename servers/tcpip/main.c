@@ -9,6 +9,7 @@
 #include <resea/async.h>
 #include <resea/handle.h>
 #include <resea/ipc.h>
+#include <resea/kernel_info.h>
 #include <resea/malloc.h>
 #include <resea/printf.h>
 #include <resea/timer.h>
@@ -29,7 +30,6 @@ static unsigned next_driver_id = 0;
 static list_t drivers;
 static list_t dns_requests;
 static uint16_t next_dns_query_id = 1;
-static msec_t uptime = 0;
 
 static struct driver *get_driver_by_tid(task_t tid) {
     LIST_FOR_EACH (driver, &drivers, struct driver, next) {
@@ -141,7 +141,7 @@ void sys_process_event(struct event *e) {
 }
 
 msec_t sys_uptime(void) {
-    return uptime;
+    return uptime();
 }
 
 static void free_handle(void *data) {
@@ -151,6 +151,8 @@ static void free_handle(void *data) {
 
 void main(void) {
     TRACE("starting...");
+    // We receive async messages from vm.
+    ipc_lookup_notify_exit();
     list_init(&drivers);
     list_init(&dns_requests);
 
@@ -178,7 +180,6 @@ void main(void) {
                 if ((m.notifications.data & NOTIFY_TIMER) != 0) {
                     error_t err = timer_set(TIMER_INTERVAL);
                     ASSERT_OK(err);
-                    uptime += TIMER_INTERVAL;
                 }
 
                 if ((m.notifications.data & NOTIFY_ASYNC) != 0) {
@@ -197,6 +198,9 @@ void main(void) {
             case ASYNC_MSG:
                 async_reply(m.src);
                 break;
+            case ASYNC_BATCH_MSG:
+                async_reply_batch(m.src, m.async_batch.max);
+                break;
             case TCPIP_CONNECT_MSG: {
                 tcp_sock_t sock = tcp_new();
                 ipaddr_t dst_addr;
@@ -259,7 +263,7 @@ void main(void) {
                 break;
             }
             case TCPIP_READ_MSG: {
-                size_t max_len = MIN(4096, m.tcpip_read.len);
+                size_t max_len = MIN(TCP_RX_BUF_SIZE, m.tcpip_read.len);
                 struct client *c = handle_get(m.src, m.tcpip_read.handle);
                 if (!c) {
                     ipc_send_err(m.src, ERR_INVALID_ARG);
@@ -0,0 +1,169 @@
+#include "avl.h"
+#include <print_macros.h>
+
+static int height(struct avl_node *node) {
+    return node ? node->height : 0;
+}
+
+static void update_height(struct avl_node *node) {
+    node->height = 1 + MAX(height(node->left), height(node->right));
+}
+
+static struct avl_node *rotate_left(struct avl_node *node) {
+    struct avl_node *right = node->right;
+    node->right = right->left;
+    right->left = node;
+    update_height(node);
+    update_height(right);
+    return right;
+}
+
+static struct avl_node *rotate_right(struct avl_node *node) {
+    struct avl_node *left = node->left;
+    node->left = left->right;
+    left->right = node;
+    update_height(node);
+    update_height(left);
+    return left;
+}
+
+/// Restores the AVL invariant at `node` and returns the new subtree root.
+static struct avl_node *rebalance(struct avl_node *node) {
+    update_height(node);
+    int balance = height(node->left) - height(node->right);
+    if (balance > 1) {
+        if (height(node->left->left) < height(node->left->right)) {
+            node->left = rotate_left(node->left);
+        }
+        return rotate_right(node);
+    }
+
+    if (balance < -1) {
+        if (height(node->right->right) < height(node->right->left)) {
+            node->right = rotate_right(node->right);
+        }
+        return rotate_left(node);
+    }
+
+    return node;
+}
+
+static bool less_than(struct avl_node *a, struct avl_node *b) {
+    return a->key < b->key || (a->key == b->key && a < b);
+}
+
+static struct avl_node *insert_node(struct avl_node *root,
+                                    struct avl_node *node) {
+    if (!root) {
+        return node;
+    }
+
+    if (less_than(node, root)) {
+        root->left = insert_node(root->left, node);
+    } else {
+        root->right = insert_node(root->right, node);
+    }
+
+    return rebalance(root);
+}
+
+static struct avl_node *remove_min(struct avl_node *root,
+                                   struct avl_node **min) {
+    if (!root->left) {
+        *min = root;
+        return root->right;
+    }
+
+    root->left = remove_min(root->left, min);
+    return rebalance(root);
+}
+
+static struct avl_node *remove_node(struct avl_node *root,
+                                    struct avl_node *node) {
+    ASSERT(root);
+    if (root == node) {
+        if (!root->right) {
+            return root->left;
+        }
+
+        struct avl_node *min;
+        struct avl_node *right = remove_min(root->right, &min);
+        min->left = root->left;
+        min->right = right;
+        return rebalance(min);
+    }
+
+    if (less_than(node, root)) {
+        root->left = remove_node(root->left, node);
+    } else {
+        root->right = remove_node(root->right, node);
+    }
+
+    return rebalance(root);
+}
+
+void avl_init(struct avl_tree *tree) {
+    tree->root = NULL;
+}
+
+void avl_insert(struct avl_tree *tree, struct avl_node *node, uintptr_t key) {
+    node->left = NULL;
+    node->right = NULL;
+    node->height = 1;
+    node->key = key;
+    tree->root = insert_node(tree->root, node);
+}
+
+void avl_remove(struct avl_tree *tree, struct avl_node *node) {
+    tree->root = remove_node(tree->root, node);
+}
+
+/// Returns the first node with the given key or NULL if it does not exist.
+struct avl_node *avl_find(struct avl_tree *tree, uintptr_t key) {
+    struct avl_node *found = NULL;
+    struct avl_node *node = tree->root;
+    while (node) {
+        if (node->key >= key) {
+            if (node->key == key) {
+                found = node;
+            }
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    return found;
+}
+
+/// Returns the node with the largest key less than or equal to `key`.
+struct avl_node *avl_find_le(struct avl_tree *tree, uintptr_t key) {
+    struct avl_node *found = NULL;
+    struct avl_node *node = tree->root;
+    while (node) {
+        if (node->key <= key) {
+            found = node;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+
+    return found;
+}
+
+/// Returns the node with the smallest key greater than or equal to `key`.
+struct avl_node *avl_find_ge(struct avl_tree *tree, uintptr_t key) {
+    struct avl_node *found = NULL;
+    struct avl_node *node = tree->root;
+    while (node) {
+        if (node->key >= key) {
+            found = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    return found;
+}
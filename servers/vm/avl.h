@@ -0,0 +1,29 @@
+#ifndef __AVL_H__
+#define __AVL_H__
+
+#include <types.h>
+
+/// An intrusive AVL tree node. Nodes are ordered by `key` and then by their
+/// addresses so that duplicated keys are allowed.
+struct avl_node {
+    struct avl_node *left;
+    struct avl_node *right;
+    int height;
+    uintptr_t key;
+};
+
+struct avl_tree {
+    struct avl_node *root;
+};
+
+#define AVL_CONTAINER(node, container, field)                                  \
+    ((container *) ((vaddr_t)(node) -offsetof(container, field)))
+
+void avl_init(struct avl_tree *tree);
+void avl_insert(struct avl_tree *tree, struct avl_node *node, uintptr_t key);
+void avl_remove(struct avl_tree *tree, struct avl_node *node);
+struct avl_node *avl_find(struct avl_tree *tree, uintptr_t key);
+struct avl_node *avl_find_le(struct avl_tree *tree, uintptr_t key);
+struct avl_node *avl_find_ge(struct avl_tree *tree, uintptr_t key);
+
+#endif
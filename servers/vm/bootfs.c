@@ -1,15 +1,50 @@
 #include "bootfs.h"
+#include "page_alloc.h"
+#include <resea/malloc.h>
 #include <string.h>
 
 extern char __bootfs[];
 static struct bootfs_file *files;
 static unsigned num_files;
+/// Per-file caches of read-only pages. Each entry holds a reference to the
+/// page.
+static paddr_t **page_caches;
 
 void read_file(struct bootfs_file *file, offset_t off, void *buf, size_t len) {
     void *p = (void *) (((uintptr_t) __bootfs) + file->offset + off);
     memcpy(buf, p, len);
 }
 
+/// Returns a page filled with the file data at `off`. The page is shared
+/// among callers and must not be modified. Returns zero if we've run out of
+/// memory.
+paddr_t bootfs_cached_page(struct bootfs_file *file, offset_t off) {
+    DEBUG_ASSERT(IS_ALIGNED(off, PAGE_SIZE) && off < file->len);
+
+    unsigned index = file - files;
+    if (!page_caches[index]) {
+        size_t num_pages = ALIGN_UP(file->len, PAGE_SIZE) / PAGE_SIZE;
+        page_caches[index] = malloc(sizeof(paddr_t) * num_pages);
+        memset(page_caches[index], 0, sizeof(paddr_t) * num_pages);
+    }
+
+    paddr_t *cached = &page_caches[index][off / PAGE_SIZE];
+    if (!*cached) {
+        paddr_t paddr = page_try_alloc(1);
+        if (!paddr) {
+            return 0;
+        }
+
+        uint8_t *page = paddr2ptr(paddr);
+        size_t len = MIN(PAGE_SIZE, file->len - off);
+        read_file(file, off, page, len);
+        memset(page + len, 0, PAGE_SIZE - len);
+        *cached = paddr;
+    }
+
+    return *cached;
+}
+
 struct bootfs_file *bootfs_open(unsigned index) {
     if (index >= num_files) {
         return NULL;
@@ -23,4 +58,6 @@ void bootfs_init(void) {
     num_files = header->num_files;
     files =
         (struct bootfs_file *) (((uintptr_t) &__bootfs) + header->files_off);
+    page_caches = malloc(sizeof(*page_caches) * num_files);
+    memset(page_caches, 0, sizeof(*page_caches) * num_files);
 }
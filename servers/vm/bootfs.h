@@ -19,6 +19,7 @@ struct bootfs_file {
 
 struct bootfs_file *bootfs_open(unsigned index);
 void read_file(struct bootfs_file *file, offset_t off, void *buf, size_t len);
+paddr_t bootfs_cached_page(struct bootfs_file *file, offset_t off);
 void bootfs_init(void);
 
 #endif
@@ -4,6 +4,7 @@
 #include "page_fault.h"
 #include "shm.h"
 #include "task.h"
+#include "worker.h"
 #include <elf/elf.h>
 #include <list.h>
 #include <resea/async.h>
@@ -28,6 +29,7 @@ error_t ipc_call_pager(struct message *m) {
             err = handle_ool_verify(m);
             break;
         case OOL_SEND_MSG:
+        case OOL_SENDV_MSG:
             err = handle_ool_send(m);
             break;
         default:
@@ -46,6 +48,11 @@ static void spawn_servers(void) {
     int num_launched = 0;
     struct bootfs_file *file;
     for (int i = 0; (file = bootfs_open(i)) != NULL; i++) {
+        // Pager workers are spawned by `worker_init`.
+        if (!strcmp(file->name, "vm_worker")) {
+            continue;
+        }
+
         // Autostart server names (separated by whitespace).
         char *startups = AUTOSTARTS;
 
@@ -77,10 +84,15 @@ static void spawn_servers(void) {
 void main(void) {
     TRACE("starting...");
     bootfs_init();
-    page_alloc_init();
     task_init();
+    page_alloc_init();
     page_fault_init();
-    spawn_servers();
+
+    // Servers are spawned once all workers become ready so that they're paged
+    // by workers.
+    if (!worker_init()) {
+        spawn_servers();
+    }
 
     timer_set(5000);
 
@@ -105,10 +117,17 @@ void main(void) {
                 if (m.notifications.data & NOTIFY_TIMER) {
                     service_warn_deadlocked_tasks();
                 }
+
+                if (m.notifications.data & NOTIFY_ASYNC) {
+                    worker_poll();
+                }
                 break;
             case ASYNC_MSG:
                 async_reply(m.src);
                 break;
+            case ASYNC_BATCH_MSG:
+                async_reply_batch(m.src, m.async_batch.max);
+                break;
             case OOL_RECV_MSG: {
                 task_t src = m.src;
                 error_t err = handle_ool_recv(&m);
@@ -137,7 +156,8 @@ void main(void) {
                 }
                 break;
             }
-            case OOL_SEND_MSG: {
+            case OOL_SEND_MSG:
+            case OOL_SENDV_MSG: {
                 task_t src = m.src;
                 error_t err = handle_ool_send(&m);
                 switch (err) {
@@ -174,15 +194,7 @@ void main(void) {
                 ASSERT(task);
                 ASSERT(task->pager == vm_task->tid);
                 ASSERT(m.exception.task == task->tid);
-
-                if (m.exception.exception == EXP_GRACE_EXIT) {
-                    INFO("%s: terminated its execution", task->name);
-                } else {
-                    WARN("%s: exception occurred, killing the task...",
-                         task->name);
-                }
-
-                task_kill(task);
+                task_handle_exception(task, m.exception.exception);
                 break;
             }
             case PAGE_FAULT_MSG: {
@@ -197,20 +209,17 @@ void main(void) {
                 ASSERT(task->pager == vm_task->tid);
                 ASSERT(m.page_fault.task == task->tid);
 
-                paddr_t paddr =
-                    handle_page_fault(task, m.page_fault.vaddr, m.page_fault.ip,
-                                      m.page_fault.fault);
-                if (!paddr) {
-                    ipc_reply_err(m.src, ERR_NOT_FOUND);
+                // If it fails (e.g. no memory for page tables), the kernel
+                // kills the task.
+                error_t err =
+                    page_fault_resolve(task, m.page_fault.vaddr,
+                                       m.page_fault.ip, m.page_fault.fault);
+                if (err != OK) {
+                    ipc_reply_err(m.src, err);
                     break;
                 }
 
-                vaddr_t aligned_vaddr =
-                    ALIGN_DOWN(m.page_fault.vaddr, PAGE_SIZE);
-                ASSERT_OK(map_page(task, aligned_vaddr, paddr,
-                                   MAP_TYPE_READWRITE, false));
                 r.type = PAGE_FAULT_REPLY_MSG;
-
                 ipc_reply(task->tid, &r);
                 break;
             }
@@ -222,7 +231,8 @@ void main(void) {
                 break;
             }
             case DISCOVERY_LOOKUP_MSG: {
-                task_t server = service_wait(caller, m.discovery_lookup.name);
+                task_t server = service_wait(caller, m.discovery_lookup.name,
+                                             m.discovery_lookup.notify_exit);
                 free(m.discovery_lookup.name);
                 if (IS_OK(server)) {
                     r.type = DISCOVERY_LOOKUP_REPLY_MSG;
@@ -250,6 +260,118 @@ void main(void) {
                 ipc_reply(m.src, &r);
                 break;
             }
+            case VM_FREE_PAGES_MSG: {
+                struct task *task = task_lookup(m.src);
+                ASSERT(task);
+
+                // Shared pages (e.g. a shared memory region) must be released
+                // by their own API such as `shm.close`.
+                if (task_page_range_is_shared(task, m.vm_free_pages.vaddr,
+                                              m.vm_free_pages.num_pages)) {
+                    ipc_reply_err(m.src, ERR_NOT_PERMITTED);
+                    break;
+                }
+
+                error_t err = task_page_free_range(task, m.vm_free_pages.vaddr,
+                                                   m.vm_free_pages.num_pages);
+                if (err != OK) {
+                    ipc_reply_err(m.src, err);
+                    break;
+                }
+
+                r.type = VM_FREE_PAGES_REPLY_MSG;
+                ipc_reply(m.src, &r);
+                break;
+            }
+            case VM_CLONE_PAGES_MSG: {
+                struct task *dst = task_find(m.vm_clone_pages.dst);
+                if (!dst) {
+                    ipc_reply_err(m.src, ERR_NOT_FOUND);
+                    break;
+                }
+
+                // Pages can be cloned only into the caller itself or a task
+                // paged by the caller.
+                if ((dst != caller && dst->pager != caller->tid)
+                    || !task_is_paged_by_vm(caller)) {
+                    ipc_reply_err(m.src, ERR_NOT_PERMITTED);
+                    break;
+                }
+
+                vaddr_t vaddr;
+                error_t err = task_page_clone(caller, m.vm_clone_pages.vaddr,
+                                              m.vm_clone_pages.num_pages, dst,
+                                              &vaddr);
+                if (err != OK) {
+                    ipc_reply_err(m.src, err);
+                    break;
+                }
+
+                r.type = VM_CLONE_PAGES_REPLY_MSG;
+                r.vm_clone_pages_reply.vaddr = vaddr;
+                ipc_reply(m.src, &r);
+                break;
+            }
+            case VM_SET_PAGE_LIMIT_MSG: {
+                struct task *task = task_find(m.vm_set_page_limit.task);
+                if (!task) {
+                    ipc_reply_err(m.src, ERR_NOT_FOUND);
+                    break;
+                }
+
+                // The pager may set any limit. The task itself may only lower
+                // its own limit: it must not lift one set by its pager.
+                size_t max_pages = m.vm_set_page_limit.max_pages;
+                size_t current = task->max_resident_pages;
+                bool lowers = max_pages && (!current || max_pages <= current);
+                if (task->pager != caller->tid
+                    && (task != caller || !lowers)) {
+                    ipc_reply_err(m.src, ERR_NOT_PERMITTED);
+                    break;
+                }
+
+                task->max_resident_pages = max_pages;
+                worker_set_limited(task, task->max_resident_pages != 0);
+                r.type = VM_SET_PAGE_LIMIT_REPLY_MSG;
+                ipc_reply(m.src, &r);
+                break;
+            }
+            case VM_STATS_MSG: {
+                struct task *task = task_find(m.vm_stats.task);
+                if (!task) {
+                    ipc_reply_err(m.src, ERR_NOT_FOUND);
+                    break;
+                }
+
+                r.type = VM_STATS_REPLY_MSG;
+                r.vm_stats_reply.resident_pages =
+                    task->num_resident_pages + worker_resident_pages(task);
+                r.vm_stats_reply.max_pages = task->max_resident_pages;
+                memory_stats(&r.vm_stats_reply.free_pages,
+                             &r.vm_stats_reply.total_pages);
+                ipc_reply(m.src, &r);
+                break;
+            }
+            case VM_WATCH_MEMORY_MSG: {
+                memory_watch(caller);
+                r.type = VM_WATCH_MEMORY_REPLY_MSG;
+                ipc_reply(m.src, &r);
+                break;
+            }
+            case VM_WORKER_READY_MSG: {
+                error_t err = worker_ready(caller);
+                if (err != OK) {
+                    ipc_reply_err(m.src, err);
+                    break;
+                }
+
+                r.type = VM_WORKER_READY_REPLY_MSG;
+                ipc_reply(m.src, &r);
+                if (worker_all_ready()) {
+                    spawn_servers();
+                }
+                break;
+            }
             case TASK_ALLOC_MSG: {
                 struct task *task = task_alloc(m.task_alloc.pager);
                 if (!task) {
@@ -320,14 +442,14 @@ void main(void) {
             case SHM_CREATE_MSG: {
                 struct task *task = task_lookup(m.src);
                 ASSERT(task);
-                int slot;
-                err = shm_create(task, m.shm_create.size, &slot);
+                int shm_id;
+                err = shm_create(task, m.shm_create.size, &shm_id);
                 if (err != OK) {
                     ipc_reply_err(m.src, err);
                     break;
                 }
                 m.type = SHM_CREATE_REPLY_MSG;
-                m.shm_create_reply.shm_id = slot;
+                m.shm_create_reply.shm_id = shm_id;
                 ipc_reply(m.src, &m);
                 break;
             }
@@ -347,7 +469,12 @@ void main(void) {
                 break;
             }
             case SHM_CLOSE_MSG: {
-                shm_close(m.shm_close.shm_id);
+                struct task *task = task_lookup(m.src);
+                error_t err = shm_close(task, m.shm_close.shm_id);
+                if (err != OK) {
+                    ipc_reply_err(m.src, err);
+                    break;
+                }
                 m.type = SHM_CLOSE_REPLY_MSG;
                 ipc_reply(m.src, &m);
                 break;
@@ -355,5 +482,10 @@ void main(void) {
             default:
                 discard_unknown_message(&m);
         }
+
+        // Zero free pages for upcoming page faults now that the caller has
+        // been replied.
+        zeroed_pool_refill(ZEROED_POOL_REFILL_BATCH);
+        memory_pressure_update();
     }
 }
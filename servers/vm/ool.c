@@ -1,44 +1,103 @@
 #include "ool.h"
+#include "page_alloc.h"
 #include "page_fault.h"
 #include "task.h"
+#include "worker.h"
 #include <message.h>
 #include <resea/ipc.h>
 #include <resea/task.h>
 #include <string.h>
 
-static uint8_t __src_page[PAGE_SIZE] __aligned(PAGE_SIZE);
-static uint8_t __dst_page[PAGE_SIZE] __aligned(PAGE_SIZE);
-
 static paddr_t vaddr2paddr(struct task *task, vaddr_t vaddr, bool write) {
-    LIST_FOR_EACH (area, &task->page_areas, struct page_area, next) {
-        if (area->vaddr <= vaddr
-            && vaddr < area->vaddr + area->num_pages * PAGE_SIZE) {
-            return area->paddr + (vaddr - area->vaddr);
+    struct page_area *area = page_area_lookup(task, vaddr);
+    if (area) {
+        if (write && area->readonly) {
+            return 0;
+        }
+
+        if (write && area->cow) {
+            // Give the task its own copy and replace the read-only mapping.
+            paddr_t paddr = task_page_cow_break(task, area, vaddr);
+            if (map_page(task, vaddr, paddr, MAP_TYPE_READWRITE, true) != OK) {
+                return 0;
+            }
+
+            return paddr;
         }
+
+        return area->paddr + (vaddr - area->vaddr);
     }
 
     // The page is not mapped. Try filling it with pager.
     unsigned fault = EXP_PF_USER;
     fault |= write ? EXP_PF_WRITE : 0;
-    return handle_page_fault(task, vaddr, 0, fault);
+    unsigned map_flags;
+    return handle_page_fault(task, vaddr, 0, fault, &map_flags);
 }
 
-error_t handle_ool_recv(struct message *m) {
-    struct task *task = task_lookup(m->src);
-    ASSERT(task);
+/// Copies memory between tasks through the physical memory window. If it
+/// fails, the faulting task is killed: it returns DONT_REPLY if it's `src_task`
+/// or ERR_UNAVAILABLE if it's `dst_task`.
+static error_t copy_between_tasks(struct task *dst_task, vaddr_t dst_buf,
+                                  struct task *src_task, vaddr_t src_buf,
+                                  size_t len) {
+    size_t remaining = len;
+    while (remaining > 0) {
+        offset_t src_off = src_buf % PAGE_SIZE;
+        offset_t dst_off = dst_buf % PAGE_SIZE;
+        size_t copy_len =
+            MIN(remaining, MIN(PAGE_SIZE - src_off, PAGE_SIZE - dst_off));
 
-    //    TRACE("accept: %s: %p %d (old=%p)",
-    //        task->name, m->ool_recv.addr, m->ool_recv.len, task->ool_buf);
-    if (task->ool_buf) {
-        return ERR_ALREADY_EXISTS;
+        paddr_t src_paddr = 0;
+        if (src_task != vm_task) {
+            src_paddr =
+                vaddr2paddr(src_task, ALIGN_DOWN(src_buf, PAGE_SIZE), false);
+            if (!src_paddr) {
+                task_kill(src_task);
+                return DONT_REPLY;
+            }
+        }
+
+        paddr_t dst_paddr = 0;
+        if (dst_task != vm_task) {
+            dst_paddr =
+                vaddr2paddr(dst_task, ALIGN_DOWN(dst_buf, PAGE_SIZE), true);
+            if (!dst_paddr) {
+                task_kill(dst_task);
+                return ERR_UNAVAILABLE;
+            }
+        }
+
+        // Copy between the tasks through the physical memory window: no
+        // temporary mappings are needed.
+        if (src_paddr && dst_paddr) {
+            phys_memcpy(dst_paddr + dst_off, src_paddr + src_off, copy_len);
+        } else if (src_paddr) {
+            memcpy((void *) dst_buf, paddr2ptr(src_paddr + src_off), copy_len);
+        } else if (dst_paddr) {
+            memcpy(paddr2ptr(dst_paddr + dst_off), (void *) src_buf, copy_len);
+        } else {
+            memcpy((void *) dst_buf, (void *) src_buf, copy_len);
+        }
+        remaining -= copy_len;
+        dst_buf += copy_len;
+        src_buf += copy_len;
     }
 
-    task->ool_buf = m->ool_recv.addr;
-    task->ool_len = m->ool_recv.len;
+    return OK;
+}
+
+/// Returns true if the task is ready to receive an OoL payload.
+static bool is_ool_ready(struct task *task) {
+    return task->num_ool_bufs > 0
+           && task->num_received_ools < OOL_RECV_BUFS_MAX;
+}
 
-    struct task *sender =
-        LIST_POP_FRONT(&task->ool_sender_queue, struct task, ool_sender_next);
-    if (sender) {
+/// Resumes senders waiting for the task to be ready to receive a payload.
+static void resume_ool_senders(struct task *task) {
+    while (is_ool_ready(task) && !list_is_empty(&task->ool_sender_queue)) {
+        struct task *sender = LIST_POP_FRONT(&task->ool_sender_queue,
+                                             struct task, ool_sender_next);
         struct message m;
         memcpy(&m, &sender->ool_sender_m, sizeof(m));
         //        TRACE("%s -> %s: src = %d / %d", task->name, sender->name,
@@ -56,6 +115,32 @@ error_t handle_ool_recv(struct message *m) {
                 ipc_reply_err(sender->tid, err);
         }
     }
+}
+
+error_t handle_ool_recv(struct message *m) {
+    struct task *task = task_lookup(m->src);
+    ASSERT(task);
+
+    size_t num_bufs = m->ool_recv.num_bufs;
+    size_t len = m->ool_recv.len;
+    size_t max_len = m->ool_recv.max_len;
+    //    TRACE("accept: %s: %d bufs, len=%d (registered=%d)",
+    //        task->name, num_bufs, len, task->num_ool_bufs);
+    if ((task->num_ool_bufs > 0 && len != task->ool_len) || max_len < len) {
+        return ERR_INVALID_ARG;
+    }
+
+    if (num_bufs > OOL_RECV_BUFS_MAX - task->num_ool_bufs) {
+        return ERR_TOO_LARGE;
+    }
+
+    OK_OR_RETURN(copy_between_tasks(
+        vm_task, (vaddr_t) &task->ool_bufs[task->num_ool_bufs], task,
+        m->ool_recv.bufs, sizeof(vaddr_t) * num_bufs));
+    task->num_ool_bufs += num_bufs;
+    task->ool_len = len;
+    task->ool_max_len = max_len;
+    resume_ool_senders(task);
 
     m->type = OOL_RECV_REPLY_MSG;
     return OK;
@@ -67,18 +152,41 @@ error_t handle_ool_verify(struct message *m) {
 
     //    TRACE("verify: %s: id=%p len=%d (src=%d)", task->name,
     //          m->ool_verify.id, m->ool_verify.len, m->src);
-    if (m->ool_verify.src != task->received_ool_from
-        || m->ool_verify.id != task->received_ool_buf
-        || m->ool_verify.len != task->received_ool_len) {
-        return ERR_INVALID_ARG;
+    for (unsigned i = 0; i < task->num_received_ools; i++) {
+        struct received_ool *r = &task->received_ools[i];
+        if (r->from == m->ool_verify.src && r->buf == m->ool_verify.id
+            && r->len == m->ool_verify.len) {
+            m->type = OOL_VERIFY_REPLY_MSG;
+            m->ool_verify_reply.received_at = r->buf;
+
+            *r = task->received_ools[--task->num_received_ools];
+            resume_ool_senders(task);
+            return OK;
+        }
+    }
+
+    return ERR_INVALID_ARG;
+}
+
+/// Allocates dedicated pages in the receiver for a payload which doesn't fit
+/// into its receive buffer. The receiver frees them by `vm.free_pages` once it
+/// has consumed the payload. A payload larger than the receiver accepts
+/// (`ool.recv`) is rejected.
+static error_t alloc_large_ool_buf(struct task *dst_task, size_t len,
+                                   vaddr_t *dst_buf) {
+    if (dst_task == vm_task || !task_is_paged_by_vm(dst_task)
+        || len > dst_task->ool_max_len) {
+        return ERR_TOO_LARGE;
     }
 
-    m->type = OOL_VERIFY_REPLY_MSG;
-    m->ool_verify_reply.received_at = task->received_ool_buf;
+    vaddr_t vaddr = 0;
+    paddr_t paddr = 0;
+    size_t num_pages = ALIGN_UP(len, PAGE_SIZE) / PAGE_SIZE;
+    OK_OR_RETURN(task_page_alloc(dst_task, &vaddr, &paddr, num_pages));
 
-    task->received_ool_buf = 0;
-    task->received_ool_len = 0;
-    task->received_ool_from = 0;
+    // Don't leak the previous contents of the last page.
+    memset(paddr2ptr(paddr + len), 0, num_pages * PAGE_SIZE - len);
+    *dst_buf = vaddr;
     return OK;
 }
 
@@ -86,80 +194,97 @@ error_t handle_ool_send(struct message *m) {
     struct task *src_task = task_lookup(m->src);
     ASSERT(src_task);
 
-    struct task *dst_task = task_lookup(m->ool_send.dst);
+    bool vectored = m->type == OOL_SENDV_MSG;
+    struct task *dst_task =
+        task_find(vectored ? m->ool_sendv.dst : m->ool_send.dst);
     if (!dst_task) {
         return ERR_NOT_FOUND;
     }
 
-    //    TRACE("do_copy: %s -> %s: %p -> %p, len=%d",
-    //        src_task->name, dst_task->name,
-    //        m->ool_send.addr, dst_task->ool_buf,
-    //        m->ool_send.len);
-    if (!dst_task->ool_buf) {
+    // Pager workers never receive OoL payloads: they never register receive
+    // buffers not to call us.
+    if (is_worker(dst_task)) {
+        return ERR_NOT_PERMITTED;
+    }
+
+    // Wait for the receiver to register a receive buffer and to consume
+    // received payloads.
+    if (!is_ool_ready(dst_task)) {
         memcpy(&src_task->ool_sender_m, m, sizeof(*m));
         list_push_back(&dst_task->ool_sender_queue, &src_task->ool_sender_next);
         return DONT_REPLY;
     }
 
-    size_t len = m->ool_send.len;
-    vaddr_t src_buf = m->ool_send.addr;
-    vaddr_t dst_buf = dst_task->ool_buf;
-    DEBUG_ASSERT(len <= dst_task->ool_len);
-
-    size_t remaining = len;
-    while (remaining > 0) {
-        offset_t src_off = src_buf % PAGE_SIZE;
-        offset_t dst_off = dst_buf % PAGE_SIZE;
-        size_t copy_len =
-            MIN(remaining, MIN(PAGE_SIZE - src_off, PAGE_SIZE - dst_off));
+    // Gather the payload segments.
+    struct ool_iovec iov[OOL_IOV_MAX];
+    size_t iov_count;
+    if (vectored) {
+        iov_count = m->ool_sendv.iov_count;
+        if (iov_count > OOL_IOV_MAX) {
+            return ERR_TOO_LARGE;
+        }
 
-        void *src_ptr;
-        if (src_task == vm_task) {
-            src_ptr = (void *) src_buf;
-        } else {
-            paddr_t src_paddr =
-                vaddr2paddr(src_task, ALIGN_DOWN(src_buf, PAGE_SIZE), false);
-            if (!src_paddr) {
-                task_kill(src_task);
-                return DONT_REPLY;
-            }
+        OK_OR_RETURN(copy_between_tasks(vm_task, (vaddr_t) iov, src_task,
+                                        m->ool_sendv.iov,
+                                        sizeof(*iov) * iov_count));
+    } else {
+        iov[0].base = (void *) m->ool_send.addr;
+        iov[0].len = m->ool_send.len;
+        iov_count = 1;
+    }
 
-            OK_OR_RETURN(map_page(vm_task, (vaddr_t) __src_page, src_paddr,
-                                  MAP_TYPE_READWRITE, true));
-            src_ptr = &__src_page[src_off];
+    size_t len = 0;
+    for (size_t i = 0; i < iov_count; i++) {
+        if (len + iov[i].len < len) {
+            return ERR_INVALID_ARG;
         }
 
-        void *dst_ptr;
-        if (dst_task == vm_task) {
-            dst_ptr = (void *) dst_buf;
-        } else {
-            paddr_t dst_paddr =
-                vaddr2paddr(dst_task, ALIGN_DOWN(dst_buf, PAGE_SIZE), true);
-            if (!dst_paddr) {
-                task_kill(dst_task);
-                return ERR_UNAVAILABLE;
+        len += iov[i].len;
+    }
+
+    //    TRACE("do_copy: %s -> %s: %d segments, len=%d (%d bufs)",
+    //        src_task->name, dst_task->name, iov_count, len,
+    //        dst_task->num_ool_bufs);
+    bool large = len > dst_task->ool_len;
+    vaddr_t dst_buf = dst_task->ool_bufs[dst_task->num_ool_bufs - 1];
+    if (large) {
+        OK_OR_RETURN(alloc_large_ool_buf(dst_task, len, &dst_buf));
+    }
+
+    vaddr_t dst_ptr = dst_buf;
+    for (size_t i = 0; i < iov_count; i++) {
+        error_t err = copy_between_tasks(dst_task, dst_ptr, src_task,
+                                         (vaddr_t) iov[i].base, iov[i].len);
+        if (err != OK) {
+            if (err == DONT_REPLY && large) {
+                // The sender has been killed.
+                task_page_free_range(dst_task, dst_buf,
+                                     ALIGN_UP(len, PAGE_SIZE) / PAGE_SIZE);
             }
 
-            // Temporarily map the pages into the our address space.
-            OK_OR_RETURN(map_page(vm_task, (vaddr_t) __dst_page, dst_paddr,
-                                  MAP_TYPE_READWRITE, true));
-            dst_ptr = &__dst_page[dst_off];
+            return err;
         }
 
-        // Copy between the tasks.
-        memcpy(dst_ptr, src_ptr, copy_len);
-        remaining -= copy_len;
-        dst_buf += copy_len;
-        src_buf += copy_len;
+        dst_ptr += iov[i].len;
+    }
+
+    if (!large) {
+        dst_task->num_ool_bufs--;
     }
 
-    dst_task->received_ool_buf = dst_task->ool_buf;
-    dst_task->received_ool_len = m->ool_send.len;
-    dst_task->received_ool_from = src_task->tid;
-    dst_task->ool_buf = 0;
-    dst_task->ool_len = 0;
+    struct received_ool *r =
+        &dst_task->received_ools[dst_task->num_received_ools++];
+    r->from = src_task->tid;
+    r->buf = dst_buf;
+    r->len = len;
+
+    if (vectored) {
+        m->type = OOL_SENDV_REPLY_MSG;
+        m->ool_sendv_reply.id = dst_buf;
+    } else {
+        m->type = OOL_SEND_REPLY_MSG;
+        m->ool_send_reply.id = dst_buf;
+    }
 
-    m->type = OOL_SEND_REPLY_MSG;
-    m->ool_send_reply.id = dst_task->received_ool_buf;
     return OK;
 }
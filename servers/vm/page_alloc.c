@@ -1,23 +1,162 @@
 #include "page_alloc.h"
 #include "page_fault.h"
 #include "task.h"
+#include "worker.h"
+#include <bitmap.h>
 #include <bootinfo.h>
+#include <resea/async.h>
 #include <resea/malloc.h>
 #include <resea/printf.h>
+#include <resea/task.h>
+#include <string.h>
 
+extern char __free_vaddr[];
 extern char __free_vaddr_end[];
 
 size_t num_unused_pages = 0;
 static struct page pages[PAGES_MAX];
 static list_t regions;
+/// Free lists indexed by the block order (a block of 2^order pages).
+static pfn_t free_lists[BUDDY_MAX_ORDER + 1];
+/// Per-page buddy metadata. It covers [0, num_buddy_pages) in pfn.
+static struct buddy_page *buddy_pages;
+static pfn_t num_buddy_pages = 0;
+/// A bitmap of pages managed by the buddy allocator (i.e. available RAM).
+static uint8_t *managed_bitmap;
+/// The number of pages in the free lists.
+static size_t num_free_pages = 0;
+/// The number of pages managed by the buddy allocator.
+static size_t num_total_pages = 0;
+/// Tasks notified on memory pressure changes (struct task_watcher).
+static list_t memory_watchers;
+static enum vm_pressure_level pressure_level = VM_PRESSURE_LEVEL_NONE;
+/// The physical memory window in the vm server: a direct-mapped cache of
+/// pages indexed by pfn. It covers all RAM if our virtual address space is
+/// large enough, i.e., pages are mapped only once.
+static vaddr_t window_base;
+static size_t window_num_pages;
+static pfn_t *window_tags;
+/// A page for page table structures not consumed by the last map_own_page().
+static paddr_t spare_kpage = 0;
+/// Whether the buddy allocator is ready.
+static bool buddy_ready = false;
+/// Pre-zeroed pages owned by the vm server until they are handed out.
+static paddr_t zeroed_pool[ZEROED_POOL_SIZE];
+static unsigned zeroed_pool_len = 0;
 
 pfn_t paddr2pfn(paddr_t paddr) {
     ASSERT(IS_ALIGNED(paddr, PAGE_SIZE) && paddr >= PAGES_BASE_ADDR);
     return (paddr - PAGES_BASE_ADDR) / PAGE_SIZE;
 }
 
-void page_incref(pfn_t pfn, size_t num_pages) {
-    ASSERT(pfn + num_pages <= PAGES_MAX);
+static bool is_managed(pfn_t pfn) {
+    return pfn < num_buddy_pages
+           && bitmap_get(managed_bitmap, BITMAP_SIZE(num_buddy_pages), pfn);
+}
+
+static void free_list_push(pfn_t pfn, int order) {
+    struct buddy_page *page = &buddy_pages[pfn];
+    page->order = order;
+    page->prev = PFN_NONE;
+    page->next = free_lists[order];
+    if (page->next != PFN_NONE) {
+        buddy_pages[page->next].prev = pfn;
+    }
+
+    free_lists[order] = pfn;
+    num_free_pages += 1U << order;
+}
+
+static void free_list_remove(pfn_t pfn) {
+    struct buddy_page *page = &buddy_pages[pfn];
+    DEBUG_ASSERT(page->order != BUDDY_NOT_FREE);
+
+    if (page->prev != PFN_NONE) {
+        buddy_pages[page->prev].next = page->next;
+    } else {
+        free_lists[(int) page->order] = page->next;
+    }
+
+    if (page->next != PFN_NONE) {
+        buddy_pages[page->next].prev = page->prev;
+    }
+
+    num_free_pages -= 1U << page->order;
+    page->order = BUDDY_NOT_FREE;
+}
+
+/// Returns a free block to the free lists, merging it with its buddy as long
+/// as the buddy is also a free block of the same order.
+static void buddy_free_block(pfn_t pfn, int order) {
+    while (order < BUDDY_MAX_ORDER) {
+        pfn_t buddy = pfn ^ (1U << order);
+        if (buddy >= num_buddy_pages || buddy_pages[buddy].order != order) {
+            break;
+        }
+
+        free_list_remove(buddy);
+        pfn = MIN(pfn, buddy);
+        order++;
+    }
+
+    free_list_push(pfn, order);
+}
+
+/// Returns an arbitrary range of pages by splitting it into maximal naturally
+/// aligned blocks.
+static void buddy_free_range(pfn_t pfn, size_t num_pages) {
+    pfn_t end = pfn + num_pages;
+    while (pfn < end) {
+        int order = 0;
+        while (order < BUDDY_MAX_ORDER && IS_ALIGNED(pfn, 1U << (order + 1))
+               && pfn + (1U << (order + 1)) <= end) {
+            order++;
+        }
+
+        buddy_free_block(pfn, order);
+        pfn += 1U << order;
+    }
+}
+
+/// Takes a page out of the free block which contains it.
+static void buddy_reserve(pfn_t pfn) {
+    for (int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+        pfn_t head = ALIGN_DOWN(pfn, 1U << order);
+        if (buddy_pages[head].order == order) {
+            free_list_remove(head);
+            buddy_free_range(head, pfn - head);
+            buddy_free_range(pfn + 1, head + (1U << order) - (pfn + 1));
+            return;
+        }
+    }
+
+    UNREACHABLE();
+}
+
+/// Removes a free block of 2^order pages from the free lists. Returns
+/// PFN_NONE if there's no sufficiently large free block.
+static pfn_t buddy_alloc(int order) {
+    for (int i = order; i <= BUDDY_MAX_ORDER; i++) {
+        pfn_t pfn = free_lists[i];
+        if (pfn == PFN_NONE) {
+            continue;
+        }
+
+        free_list_remove(pfn);
+
+        // Split the block and return the upper halves to the free lists.
+        while (i > order) {
+            i--;
+            free_list_push(pfn + (1U << i), i);
+        }
+
+        return pfn;
+    }
+
+    return PFN_NONE;
+}
+
+static void incref(pfn_t pfn, size_t num_pages) {
     for (size_t i = 0; i < num_pages; i++) {
         if (!pages[pfn + i].ref_count) {
             num_unused_pages--;
@@ -27,47 +166,144 @@ void page_incref(pfn_t pfn, size_t num_pages) {
     }
 }
 
+void page_incref(pfn_t pfn, size_t num_pages) {
+    ASSERT(pfn + num_pages <= PAGES_MAX);
+    for (size_t i = 0; i < num_pages; i++) {
+        // A free page in RAM is being mapped explicitly: don't let the buddy
+        // allocator hand it out.
+        if (!pages[pfn + i].ref_count && is_managed(pfn + i)) {
+            buddy_reserve(pfn + i);
+        }
+    }
+
+    incref(pfn, num_pages);
+}
+
 void page_decref(pfn_t pfn, size_t num_pages) {
     ASSERT(pfn + num_pages <= PAGES_MAX);
+    pfn_t run_start = 0;
+    size_t run_len = 0;
     for (size_t i = 0; i < num_pages; i++) {
         ASSERT(pages[pfn + i].ref_count > 0);
         pages[pfn + i].ref_count--;
 
         if (!pages[pfn + i].ref_count) {
             num_unused_pages++;
+            if (is_managed(pfn + i)) {
+                // Free consecutive pages at once to keep blocks large.
+                if (!run_len) {
+                    run_start = pfn + i;
+                }
+
+                run_len++;
+                continue;
+            }
+        }
+
+        if (run_len) {
+            buddy_free_range(run_start, run_len);
+            run_len = 0;
         }
     }
+
+    if (run_len) {
+        buddy_free_range(run_start, run_len);
+    }
 }
 
-/// Allocates continuous physical memory pages. It always returns a valid
-/// physical address: when it runs out of memory, it panics.
-paddr_t page_alloc(size_t num_pages) {
-    LIST_FOR_EACH (region, &regions, struct available_ram_region, next) {
-        pfn_t first = paddr2pfn(region->base);
-        pfn_t end = first + region->num_pages;
-        for (pfn_t base = first; base < end; base++) {
-            size_t i = 0;
-            while (base + i < end) {
-                if (pages[base + i].ref_count > 0) {
-                    break;
-                }
+/// Allocates continuous physical memory pages. Returns zero if there're no
+/// enough free pages.
+paddr_t page_try_alloc(size_t num_pages) {
+    int order = 0;
+    while ((1UL << order) < num_pages) {
+        order++;
+    }
 
-                i++;
-                if (i == num_pages) {
-                    break;
-                }
-            }
+    pfn_t pfn = (order <= BUDDY_MAX_ORDER) ? buddy_alloc(order) : PFN_NONE;
+    if (pfn == PFN_NONE) {
+        return 0;
+    }
 
-            if (i == num_pages) {
-                // Found sufficiently large free physical pages.
-                page_incref(base, num_pages);
-                paddr_t paddr = PAGES_BASE_ADDR + base * PAGE_SIZE;
-                return paddr;
-            }
-        }
+    // Return the unused tail of the block.
+    size_t block_size = 1UL << order;
+    if (num_pages < block_size) {
+        buddy_free_range(pfn + num_pages, block_size - num_pages);
+    }
+
+    incref(pfn, num_pages);
+    return PAGES_BASE_ADDR + pfn * PAGE_SIZE;
+}
+
+/// Returns a pointer to the physical memory address through the window. The
+/// pointer is valid until the next call for a page in the same window slot.
+void *paddr2ptr(paddr_t paddr) {
+    paddr_t page = ALIGN_DOWN(paddr, PAGE_SIZE);
+    pfn_t pfn = paddr2pfn(page);
+    size_t slot = pfn % window_num_pages;
+    vaddr_t vaddr = window_base + slot * PAGE_SIZE;
+    if (window_tags[slot] != pfn) {
+        ASSERT_OK(map_page(vm_task, vaddr, page, MAP_TYPE_READWRITE,
+                           window_tags[slot] != PFN_NONE));
+        window_tags[slot] = pfn;
+    }
+
+    return (void *) (vaddr + (paddr - page));
+}
+
+/// Copies data between physical memory addresses. Neither `dst` nor `src`
+/// may cross a page boundary. They may overlap (e.g. a shared memory page on
+/// both sides).
+void phys_memcpy(paddr_t dst, paddr_t src, size_t len) {
+    DEBUG_ASSERT(dst % PAGE_SIZE + len <= PAGE_SIZE);
+    DEBUG_ASSERT(src % PAGE_SIZE + len <= PAGE_SIZE);
+
+    pfn_t dst_pfn = paddr2pfn(ALIGN_DOWN(dst, PAGE_SIZE));
+    pfn_t src_pfn = paddr2pfn(ALIGN_DOWN(src, PAGE_SIZE));
+    if (dst_pfn != src_pfn
+        && dst_pfn % window_num_pages == src_pfn % window_num_pages) {
+        // Both pages share a window slot: copy through a bounce buffer.
+        static uint8_t buf[PAGE_SIZE];
+        memcpy(buf, paddr2ptr(src), len);
+        memcpy(paddr2ptr(dst), buf, len);
+        return;
+    }
+
+    if (dst_pfn == src_pfn) {
+        memmove(paddr2ptr(dst), paddr2ptr(src), len);
+        return;
     }
 
-    PANIC("out of memory");
+    memcpy(paddr2ptr(dst), paddr2ptr(src), len);
+}
+
+/// Allocates a zero-filled page. It takes one from the pool if available.
+/// Returns zero if we've run out of memory.
+static paddr_t zeroed_page_alloc(void) {
+    if (zeroed_pool_len > 0) {
+        return zeroed_pool[--zeroed_pool_len];
+    }
+
+    paddr_t paddr = page_try_alloc(1);
+    if (paddr) {
+        memset(paddr2ptr(paddr), 0, PAGE_SIZE);
+    }
+
+    return paddr;
+}
+
+/// Zeroes up to `num_pages` free pages into the pool. It's called when we're
+/// not serving a page fault.
+void zeroed_pool_refill(unsigned num_pages) {
+    while (num_pages-- > 0 && zeroed_pool_len < ZEROED_POOL_SIZE
+           && num_free_pages > ZEROED_POOL_SIZE) {
+        paddr_t paddr = page_try_alloc(1);
+        if (!paddr) {
+            break;
+        }
+
+        memset(paddr2ptr(paddr), 0, PAGE_SIZE);
+        zeroed_pool[zeroed_pool_len++] = paddr;
+    }
 }
 
 static bool is_mappable_paddr_range(paddr_t paddr, size_t num_pages) {
@@ -78,6 +314,53 @@ static bool is_mappable_paddr_range(paddr_t paddr, size_t num_pages) {
         ;
 }
 
+/// Returns true if allocating `num_pages` pages exceeds the task's limit.
+bool task_page_exceeds_limit(struct task *task, size_t num_pages) {
+    if (!task->max_resident_pages) {
+        return false;
+    }
+
+    // Pages held by the task's worker count as well.
+    size_t num_resident_pages =
+        task->num_resident_pages + worker_resident_pages(task);
+    return num_resident_pages + num_pages > task->max_resident_pages;
+}
+
+/// Charges pages not in the task's page areas (e.g. a shared memory region
+/// created by the task) to the task's resident pages.
+error_t task_page_charge(struct task *task, size_t num_pages) {
+    if (task_page_exceeds_limit(task, num_pages)) {
+        WARN_DBG("%s: reached the memory limit (%d pages)", task->name,
+                 task->max_resident_pages);
+        return ERR_NO_MEMORY;
+    }
+
+    task->num_resident_pages += num_pages;
+    return OK;
+}
+
+void task_page_uncharge(struct task *task, size_t num_pages) {
+    DEBUG_ASSERT(task->num_resident_pages >= num_pages);
+    task->num_resident_pages -= num_pages;
+}
+
+static struct page_area *add_page_area(struct task *task, vaddr_t vaddr,
+                                       paddr_t paddr, size_t num_pages) {
+    struct page_area *area = malloc(sizeof(*area));
+    area->vaddr = vaddr;
+    area->paddr = paddr;
+    area->num_pages = num_pages;
+    area->readonly = false;
+    area->shared = false;
+    area->cow = false;
+    task->num_resident_pages += num_pages;
+    if (area->vaddr) {
+        avl_insert(&task->page_areas_by_vaddr, &area->vaddr_node, area->vaddr);
+    }
+    avl_insert(&task->page_areas_by_paddr, &area->paddr_node, area->paddr);
+    return area;
+}
+
 /// Allocates a memory space for at task. Note that *vaddr and *paddr MUST BE
 /// initialized with proper values as described below.
 ///
@@ -90,8 +373,17 @@ static bool is_mappable_paddr_range(paddr_t paddr, size_t num_pages) {
 ///
 /// `vaddr` can be NULL and if it is, the allocated memory page is marked as
 /// non-mappable.
+///
+/// Allocating unused pages fails with ERR_NO_MEMORY if it exceeds the task's
+/// resident page limit or the system runs out of memory.
 error_t task_page_alloc(struct task *task, vaddr_t *vaddr, paddr_t *paddr,
                         size_t num_pages) {
+    if (!*paddr && task_page_exceeds_limit(task, num_pages)) {
+        WARN_DBG("%s: reached the memory limit (%d pages)", task->name,
+                 task->max_resident_pages);
+        return ERR_NO_MEMORY;
+    }
+
     if (*paddr) {
         if (!IS_ALIGNED(*paddr, PAGE_SIZE)) {
             WARN_DBG("%s: unaligned paddr %p", __func__, *paddr);
@@ -103,6 +395,13 @@ error_t task_page_alloc(struct task *task, vaddr_t *vaddr, paddr_t *paddr,
             return ERR_NOT_ACCEPTABLE;
         }
 
+        if (vaddr != NULL && !*vaddr) {
+            *vaddr = virt_page_alloc(task, num_pages);
+            if (!*vaddr) {
+                return ERR_NO_MEMORY;
+            }
+        }
+
         // Map the specified physical memory address.
         for (size_t i = 0; i < num_pages; i++) {
             offset_t off = i * PAGE_SIZE;
@@ -115,75 +414,617 @@ error_t task_page_alloc(struct task *task, vaddr_t *vaddr, paddr_t *paddr,
 
         page_incref(paddr2pfn(*paddr), num_pages);
     } else {
-        *paddr = page_alloc(num_pages);
+        *paddr = page_try_alloc(num_pages);
+        if (!*paddr) {
+            WARN_DBG("%s: out of memory (%d pages)", task->name, num_pages);
+            return ERR_NO_MEMORY;
+        }
     }
 
     if (vaddr != NULL && !*vaddr) {
         *vaddr = virt_page_alloc(task, num_pages);
         if (!*vaddr) {
+            page_decref(paddr2pfn(*paddr), num_pages);
+            *paddr = 0;
             return ERR_NO_MEMORY;
         }
     }
 
-    struct page_area *area = malloc(sizeof(*area));
-    area->vaddr = (vaddr != NULL) ? *vaddr : 0;
-    area->paddr = *paddr;
-    area->num_pages = num_pages;
-    list_push_back(&task->page_areas, &area->next);
+    add_page_area(task, (vaddr != NULL) ? *vaddr : 0, *paddr, num_pages);
     return OK;
 }
 
-/// Allocates a virtual address space by so-called the bump pointer allocation
-/// algorithm. Unlike task_page_alloc(), it doesn't maps to a physical memory
-/// pages.
-vaddr_t virt_page_alloc(struct task *task, size_t num_pages) {
-    vaddr_t vaddr = task->free_vaddr;
-    size_t size = num_pages * PAGE_SIZE;
+/// Adds pages shared with others (e.g. cached file pages or a shared memory
+/// region) at `vaddr` for the task. They're mapped on page faults.
+void task_page_share(struct task *task, vaddr_t vaddr, paddr_t paddr,
+                     size_t num_pages, bool writable) {
+    page_incref(paddr2pfn(paddr), num_pages);
+    struct page_area *area = add_page_area(task, vaddr, paddr, num_pages);
+    area->readonly = !writable;
+    area->shared = true;
+}
 
-    if (vaddr + size >= (vaddr_t) __free_vaddr_end) {
-        // Task's virtual memory space has been exhausted.
+/// Splits the page area so that the page at `vaddr` has its own area.
+static struct page_area *isolate_page(struct task *task,
+                                      struct page_area *area, vaddr_t vaddr) {
+    size_t index = (vaddr - area->vaddr) / PAGE_SIZE;
+    size_t num_pages_after = area->num_pages - index - 1;
+    // The pages moved into new areas are accounted again in add_page_area().
+    task->num_resident_pages -= area->num_pages - MAX(index, 1);
+    if (num_pages_after > 0) {
+        struct page_area *after =
+            add_page_area(task, vaddr + PAGE_SIZE,
+                          area->paddr + (index + 1) * PAGE_SIZE,
+                          num_pages_after);
+        after->readonly = area->readonly;
+        after->shared = area->shared;
+        after->cow = area->cow;
+    }
+
+    if (index == 0) {
+        area->num_pages = 1;
+        return area;
+    }
+
+    struct page_area *page =
+        add_page_area(task, vaddr, area->paddr + index * PAGE_SIZE, 1);
+    page->readonly = area->readonly;
+    page->shared = area->shared;
+    page->cow = area->cow;
+    area->num_pages = index;
+    return page;
+}
+
+/// Undoes a partially done `task_page_clone`: frees the pages cloned into
+/// `dst` and makes source pages that are no longer shared writable again.
+static void unclone_pages(struct task *task, vaddr_t vaddr, struct task *dst,
+                          vaddr_t dst_vaddr, size_t num_pages) {
+    OOPS_OK(task_page_free_range(dst, dst_vaddr, num_pages));
+    for (size_t i = 0; i < num_pages; i++) {
+        vaddr_t page = vaddr + i * PAGE_SIZE;
+        struct page_area *area = page_area_lookup(task, page);
+        if (!area || !area->cow
+            || pages[paddr2pfn(area->paddr)].ref_count != 1) {
+            continue;
+        }
+
+        area = isolate_page(task, area, page);
+        area->cow = false;
+        OOPS_OK(map_page(task, page, area->paddr, MAP_TYPE_READWRITE, true));
+    }
+}
+
+/// Clones the task's pages at `vaddr` into `dst` with copy-on-write: both
+/// tasks share the pages read-only until one of them writes into it. The
+/// address in `dst` is returned in `dst_vaddr`.
+error_t task_page_clone(struct task *task, vaddr_t vaddr, size_t num_pages,
+                        struct task *dst, vaddr_t *dst_vaddr) {
+    if (!IS_ALIGNED(vaddr, PAGE_SIZE) || !num_pages) {
+        return ERR_INVALID_ARG;
+    }
+
+    // Fill the pages not yet accessed so that both tasks share them.
+    for (size_t i = 0; i < num_pages; i++) {
+        vaddr_t page = vaddr + i * PAGE_SIZE;
+        unsigned map_flags;
+        if (!page_area_lookup(task, page)
+            && !handle_page_fault(task, page, 0, EXP_PF_USER, &map_flags)) {
+            return ERR_INVALID_ARG;
+        }
+    }
+
+    *dst_vaddr = virt_page_alloc(dst, num_pages);
+    if (!*dst_vaddr) {
+        return ERR_NO_MEMORY;
+    }
+
+    for (size_t i = 0; i < num_pages; i++) {
+        vaddr_t page = vaddr + i * PAGE_SIZE;
+        struct page_area *area =
+            isolate_page(task, page_area_lookup(task, page), page);
+        if (!area->readonly && !area->shared && !area->cow) {
+            // Write-protect the page to catch the first write.
+            area->cow = true;
+            error_t err =
+                map_page(task, page, area->paddr, MAP_TYPE_READONLY, true);
+            if (err != OK) {
+                area->cow = false;
+                unclone_pages(task, vaddr, dst, *dst_vaddr, num_pages);
+                return err;
+            }
+        }
+
+        page_incref(paddr2pfn(area->paddr), 1);
+        struct page_area *clone = add_page_area(
+            dst, *dst_vaddr + i * PAGE_SIZE, area->paddr, 1);
+        clone->readonly = area->readonly;
+        clone->shared = area->shared;
+        clone->cow = area->cow;
+    }
+
+    return OK;
+}
+
+/// Resolves a write into a copy-on-write page: gives the task its own copy
+/// of the page unless it's the last one sharing the page. Returns the
+/// physical address to be mapped read-write or zero if the task reached its
+/// memory limit or we've run out of memory.
+paddr_t task_page_cow_break(struct task *task, struct page_area *area,
+                            vaddr_t vaddr) {
+    area = isolate_page(task, area, vaddr);
+    pfn_t pfn = paddr2pfn(area->paddr);
+    if (pages[pfn].ref_count == 1) {
+        // No one else shares the page anymore.
+        area->cow = false;
+        return area->paddr;
+    }
+
+    // The task's own copy replaces its share of the page: it's accounted as
+    // a new page within the limit.
+    task->num_resident_pages--;
+    bool exceeds = task_page_exceeds_limit(task, 1);
+    task->num_resident_pages++;
+    if (exceeds) {
+        WARN_DBG("%s: reached the memory limit (%d pages)", task->name,
+                 task->max_resident_pages);
+        return 0;
+    }
+
+    paddr_t paddr = page_try_alloc(1);
+    if (!paddr) {
+        WARN_DBG("%s: out of memory", task->name);
+        return 0;
+    }
+
+    area->cow = false;
+    phys_memcpy(paddr, area->paddr, PAGE_SIZE);
+    page_decref(pfn, 1);
+
+    avl_remove(&task->page_areas_by_paddr, &area->paddr_node);
+    area->paddr = paddr;
+    avl_insert(&task->page_areas_by_paddr, &area->paddr_node, area->paddr);
+    return paddr;
+}
+
+/// Allocates a zero-filled page mapped at `vaddr` for the task. Returns its
+/// physical memory address or zero if the task reached its memory limit.
+paddr_t task_zeroed_page_alloc(struct task *task, vaddr_t vaddr) {
+    if (task_page_exceeds_limit(task, 1)) {
+        WARN("%s: reached the memory limit (%d pages)", task->name,
+             task->max_resident_pages);
+        return 0;
+    }
+
+    paddr_t paddr = zeroed_page_alloc();
+    if (!paddr) {
+        WARN_DBG("%s: out of memory", task->name);
+        return 0;
+    }
+
+    add_page_area(task, vaddr, paddr, 1);
+    return paddr;
+}
+
+/// Moves a page mapped at `src_vaddr` in `src` (e.g. a page filled by a pager
+/// worker) to `dst` at `dst_vaddr`. The page is unmapped from `src`. `*paddr`
+/// is set to the physical memory address of the page.
+error_t task_page_move(struct task *src, vaddr_t src_vaddr, struct task *dst,
+                       vaddr_t dst_vaddr, paddr_t *paddr) {
+    struct page_area *area = page_area_lookup(src, src_vaddr);
+    if (!area || area->shared || area->cow) {
+        return ERR_NOT_FOUND;
+    }
+
+    *paddr = area->paddr + (src_vaddr - area->vaddr);
+    page_incref(paddr2pfn(*paddr), 1);
+    add_page_area(dst, dst_vaddr, *paddr, 1);
+    return task_page_free_range(src, src_vaddr, 1);
+}
+
+/// Looks for the page area which contains `vaddr`.
+struct page_area *page_area_lookup(struct task *task, vaddr_t vaddr) {
+    struct avl_node *node = avl_find_le(&task->page_areas_by_vaddr, vaddr);
+    if (!node) {
+        return NULL;
+    }
+
+    struct page_area *area = AVL_CONTAINER(node, struct page_area, vaddr_node);
+    if (vaddr >= area->vaddr + area->num_pages * PAGE_SIZE) {
+        return NULL;
+    }
+
+    return area;
+}
+
+static void insert_vaddr_range(struct task *task, struct vaddr_range *range) {
+    avl_insert(&task->free_vaddrs_by_addr, &range->addr_node, range->base);
+    avl_insert(&task->free_vaddrs_by_size, &range->size_node,
+               range->num_pages);
+}
+
+static void remove_vaddr_range(struct task *task, struct vaddr_range *range) {
+    avl_remove(&task->free_vaddrs_by_addr, &range->addr_node);
+    avl_remove(&task->free_vaddrs_by_size, &range->size_node);
+}
+
+/// Allocates a virtual address space from the smallest free range which is
+/// large enough. Unlike task_page_alloc(), it doesn't maps to a physical
+/// memory pages. Returns zero if the task's address space has been exhausted.
+vaddr_t virt_page_alloc(struct task *task, size_t num_pages) {
+    struct avl_node *node = avl_find_ge(&task->free_vaddrs_by_size, num_pages);
+    if (!node || !num_pages) {
         WARN_DBG("%s: run out of virtual memory space", task->name);
-        task_kill(task);
         return 0;
     }
 
-    task->free_vaddr += size;
+    struct vaddr_range *range =
+        AVL_CONTAINER(node, struct vaddr_range, size_node);
+    vaddr_t vaddr = range->base;
+    remove_vaddr_range(task, range);
+    if (range->num_pages == num_pages) {
+        free(range);
+    } else {
+        range->base += num_pages * PAGE_SIZE;
+        range->num_pages -= num_pages;
+        insert_vaddr_range(task, range);
+    }
+
     return vaddr;
 }
 
-static void free_page_area(struct page_area *area) {
+/// Returns a virtual address range allocated by virt_page_alloc(). Adjacent
+/// free ranges are merged.
+error_t virt_page_free(struct task *task, vaddr_t vaddr, size_t num_pages) {
+    vaddr_t end = vaddr + num_pages * PAGE_SIZE;
+    if (!IS_ALIGNED(vaddr, PAGE_SIZE) || !num_pages
+        || vaddr < (vaddr_t) __free_vaddr || end > (vaddr_t) __free_vaddr_end
+        || end <= vaddr) {
+        return ERR_INVALID_ARG;
+    }
+
+    struct avl_node *prev_node = avl_find_le(&task->free_vaddrs_by_addr, vaddr);
+    struct avl_node *next_node = avl_find_ge(&task->free_vaddrs_by_addr, vaddr);
+    struct vaddr_range *prev =
+        prev_node ? AVL_CONTAINER(prev_node, struct vaddr_range, addr_node)
+                  : NULL;
+    struct vaddr_range *next =
+        next_node ? AVL_CONTAINER(next_node, struct vaddr_range, addr_node)
+                  : NULL;
+
+    // Reject double frees.
+    if ((prev && prev->base + prev->num_pages * PAGE_SIZE > vaddr)
+        || (next && next->base < end)) {
+        return ERR_INVALID_ARG;
+    }
+
+    struct vaddr_range *range;
+    if (prev && prev->base + prev->num_pages * PAGE_SIZE == vaddr) {
+        range = prev;
+        remove_vaddr_range(task, range);
+        range->num_pages += num_pages;
+    } else {
+        range = malloc(sizeof(*range));
+        range->base = vaddr;
+        range->num_pages = num_pages;
+    }
+
+    if (next && next->base == end) {
+        remove_vaddr_range(task, next);
+        range->num_pages += next->num_pages;
+        free(next);
+    }
+
+    insert_vaddr_range(task, range);
+    return OK;
+}
+
+/// Initializes the task's virtual address space allocator.
+void virt_page_init(struct task *task) {
+    avl_init(&task->free_vaddrs_by_addr);
+    avl_init(&task->free_vaddrs_by_size);
+
+    struct vaddr_range *range = malloc(sizeof(*range));
+    range->base = (vaddr_t) __free_vaddr;
+    range->num_pages =
+        ((vaddr_t) __free_vaddr_end - (vaddr_t) __free_vaddr) / PAGE_SIZE;
+    insert_vaddr_range(task, range);
+}
+
+/// Frees the task's virtual address space allocator.
+void virt_page_free_all(struct task *task) {
+    while (task->free_vaddrs_by_addr.root) {
+        struct vaddr_range *range = AVL_CONTAINER(
+            task->free_vaddrs_by_addr.root, struct vaddr_range, addr_node);
+        remove_vaddr_range(task, range);
+        free(range);
+    }
+}
+
+static void free_page_area(struct task *task, struct page_area *area) {
     page_decref(paddr2pfn(area->paddr), area->num_pages);
-    list_remove(&area->next);
+    task->num_resident_pages -= area->num_pages;
+    if (area->vaddr) {
+        avl_remove(&task->page_areas_by_vaddr, &area->vaddr_node);
+    }
+    avl_remove(&task->page_areas_by_paddr, &area->paddr_node);
     free(area);
 }
 
 /// Frees the physical memory pages allocated for the task. `paddr` is the
 /// beginning of the allocated physical memory area.
 void task_page_free(struct task *task, paddr_t paddr) {
-    LIST_FOR_EACH (area, &task->page_areas, struct page_area, next) {
-        if (area->paddr == paddr) {
-            free_page_area(area);
-            return;
+    struct avl_node *node = avl_find(&task->page_areas_by_paddr, paddr);
+    if (!node) {
+        OOPS("failed to free paddr=%p in %s (double free?)", paddr,
+             task->name);
+        return;
+    }
+
+    free_page_area(task, AVL_CONTAINER(node, struct page_area, paddr_node));
+}
+
+/// Returns true if any page in [vaddr, vaddr + num_pages * PAGE_SIZE) is
+/// shared with others (e.g. a mapping of a shared memory region).
+bool task_page_range_is_shared(struct task *task, vaddr_t vaddr,
+                               size_t num_pages) {
+    vaddr_t end = vaddr + num_pages * PAGE_SIZE;
+    vaddr_t page = vaddr;
+    while (page < end) {
+        // Look for the area containing `page` or the next one.
+        struct page_area *area = page_area_lookup(task, page);
+        if (!area) {
+            struct avl_node *node =
+                avl_find_ge(&task->page_areas_by_vaddr, page);
+            if (!node) {
+                break;
+            }
+
+            area = AVL_CONTAINER(node, struct page_area, vaddr_node);
+            if (area->vaddr >= end) {
+                break;
+            }
+        }
+
+        if (area->shared) {
+            return true;
         }
+
+        page = area->vaddr + area->num_pages * PAGE_SIZE;
     }
 
-    OOPS("failed to free paddr=%p in %s (double free?)", paddr, task->name);
+    return false;
+}
+
+/// Unmaps and frees the pages at [vaddr, vaddr + num_pages * PAGE_SIZE)
+/// allocated for the task, and returns the virtual address range.
+error_t task_page_free_range(struct task *task, vaddr_t vaddr,
+                             size_t num_pages) {
+    OK_OR_RETURN(virt_page_free(task, vaddr, num_pages));
+
+    vaddr_t end = vaddr + num_pages * PAGE_SIZE;
+    for (vaddr_t page = vaddr; page < end; page += PAGE_SIZE) {
+        vm_unmap(task->tid, page);
+
+        struct page_area *area = page_area_lookup(task, page);
+        if (!area) {
+            continue;
+        }
+
+        if (area->vaddr != page
+            || area->vaddr + area->num_pages * PAGE_SIZE > end) {
+            area = isolate_page(task, area, page);
+        }
+
+        free_page_area(task, area);
+    }
+
+    return OK;
 }
 
 /// Frees all memory areas allocated for the task.
 void task_page_free_all(struct task *task) {
-    LIST_FOR_EACH (area, &task->page_areas, struct page_area, next) {
-        free_page_area(area);
+    while (task->page_areas_by_paddr.root) {
+        struct avl_node *node = task->page_areas_by_paddr.root;
+        free_page_area(task, AVL_CONTAINER(node, struct page_area, paddr_node));
     }
 }
 
+/// Returns the number of free pages and the number of pages in RAM.
+void memory_stats(size_t *free_pages, size_t *total_pages) {
+    // Pre-zeroed pages are available as well.
+    *free_pages = num_free_pages + zeroed_pool_len;
+    *total_pages = num_total_pages;
+}
+
+/// Sends `vm.memory_pressure` to the task when the pressure level changes.
+void memory_watch(struct task *task) {
+    LIST_FOR_EACH (w, &memory_watchers, struct task_watcher, next) {
+        if (w->watcher == task) {
+            return;
+        }
+    }
+
+    struct task_watcher *w = malloc(sizeof(*w));
+    w->watcher = task;
+    list_push_back(&memory_watchers, &w->next);
+}
+
+void memory_unwatch(struct task *task) {
+    LIST_FOR_EACH (w, &memory_watchers, struct task_watcher, next) {
+        if (w->watcher == task) {
+            list_remove(&w->next);
+            free(w);
+            return;
+        }
+    }
+}
+
+static size_t watermark(enum vm_pressure_level level) {
+    switch (level) {
+        case VM_PRESSURE_LEVEL_LOW:
+            return num_total_pages / PRESSURE_LOW_WATERMARK_DIV;
+        case VM_PRESSURE_LEVEL_CRITICAL:
+            return num_total_pages / PRESSURE_CRITICAL_WATERMARK_DIV;
+        default:
+            return 0;
+    }
+}
+
+/// Checks if the free memory has crossed a watermark and notifies the
+/// watchers. To avoid flooding them, the level goes down only after the free
+/// memory recovers a quarter above the watermark.
+void memory_pressure_update(void) {
+    size_t free_pages, total_pages;
+    memory_stats(&free_pages, &total_pages);
+
+    enum vm_pressure_level level = VM_PRESSURE_LEVEL_NONE;
+    if (free_pages < watermark(VM_PRESSURE_LEVEL_CRITICAL)) {
+        level = VM_PRESSURE_LEVEL_CRITICAL;
+    } else if (free_pages < watermark(VM_PRESSURE_LEVEL_LOW)) {
+        level = VM_PRESSURE_LEVEL_LOW;
+    }
+
+    if (level == pressure_level) {
+        return;
+    }
+
+    if (level < pressure_level) {
+        size_t mark = watermark(pressure_level);
+        if (free_pages < mark + mark / 4) {
+            return;
+        }
+    }
+
+    pressure_level = level;
+    TRACE("memory pressure level: %d (%d free pages)", level, free_pages);
+    LIST_FOR_EACH (w, &memory_watchers, struct task_watcher, next) {
+        struct message m;
+        bzero(&m, sizeof(m));
+        m.type = VM_MEMORY_PRESSURE_MSG;
+        m.vm_memory_pressure.level = level;
+        m.vm_memory_pressure.free_pages = free_pages;
+        async_send(w->watcher->tid, &m);
+    }
+}
+
+/// Takes contiguous pages from the end of an available RAM region before the
+/// buddy allocator is ready. They're never freed.
+static paddr_t steal_pages(size_t num_pages) {
+    LIST_FOR_EACH (region, &regions, struct available_ram_region, next) {
+        if (region->num_pages >= num_pages) {
+            region->num_pages -= num_pages;
+            return region->base + region->num_pages * PAGE_SIZE;
+        }
+    }
+
+    return 0;
+}
+
+/// Maps a page into our own address space. We can't handle page faults in
+/// ourselves: pages must be mapped before being accessed. Unlike map_page(), it
+/// doesn't allocate memory from the heap.
+static error_t map_own_page(vaddr_t vaddr, paddr_t paddr) {
+    while (true) {
+        if (!spare_kpage) {
+            spare_kpage = buddy_ready ? page_try_alloc(1) : steal_pages(1);
+            if (!spare_kpage) {
+                return ERR_NO_MEMORY;
+            }
+        }
+
+        error_t err = vm_map(vm_task->tid, vaddr, paddr, spare_kpage,
+                             MAP_TYPE_READWRITE);
+        if (err != ERR_TRY_AGAIN) {
+            return err;
+        }
+
+        // The page has been consumed by the kernel.
+        spare_kpage = 0;
+    }
+}
+
+/// Allocates memory for the buddy allocator metadata, which grows with RAM and
+/// doesn't fit in the small bootstrap heap.
+static void *early_alloc(size_t len) {
+    size_t num_pages = ALIGN_UP(len, PAGE_SIZE) / PAGE_SIZE;
+    paddr_t paddr = steal_pages(num_pages);
+    vaddr_t vaddr = virt_page_alloc(vm_task, num_pages);
+    if (!paddr || !vaddr) {
+        PANIC("failed to allocate the page allocator metadata");
+    }
+
+    for (size_t i = 0; i < num_pages; i++) {
+        ASSERT_OK(map_own_page(vaddr + i * PAGE_SIZE, paddr + i * PAGE_SIZE));
+    }
+
+    return (void *) vaddr;
+}
+
+// for sparse
+vaddr_t malloc_alloc_pages(size_t num_pages);
+error_t malloc_free_pages(vaddr_t vaddr, size_t num_pages);
+
+/// Grows our heap. We can't ask ourselves for memory pages through IPC: map
+/// them directly instead.
+vaddr_t malloc_alloc_pages(size_t num_pages) {
+    if (!buddy_ready) {
+        return 0;
+    }
+
+    paddr_t paddr = page_try_alloc(num_pages);
+    if (!paddr) {
+        return 0;
+    }
+
+    vaddr_t vaddr = virt_page_alloc(vm_task, num_pages);
+    if (!vaddr) {
+        page_decref(paddr2pfn(paddr), num_pages);
+        return 0;
+    }
+
+    for (size_t i = 0; i < num_pages; i++) {
+        error_t err =
+            map_own_page(vaddr + i * PAGE_SIZE, paddr + i * PAGE_SIZE);
+        if (err != OK) {
+            for (size_t j = 0; j < i; j++) {
+                OOPS_OK(vm_unmap(vm_task->tid, vaddr + j * PAGE_SIZE));
+            }
+
+            // Leak the virtual address range: virt_page_free() may call
+            // malloc() and we're in it.
+            page_decref(paddr2pfn(paddr), num_pages);
+            return 0;
+        }
+    }
+
+    return vaddr;
+}
+
+/// The heap of vm never shrinks: freeing pages may need memory from the heap.
+error_t malloc_free_pages(vaddr_t vaddr, size_t num_pages) {
+    return ERR_NOT_PERMITTED;
+}
+
 extern struct bootinfo __bootinfo;
 
+/// Reserves the physical memory window in the vm server's address space.
+void phys_window_init(void) {
+    size_t num_free_vaddr_pages =
+        ((vaddr_t) __free_vaddr_end - (vaddr_t) __free_vaddr) / PAGE_SIZE;
+    window_num_pages = MIN(num_buddy_pages, num_free_vaddr_pages / 4);
+    window_base = virt_page_alloc(vm_task, window_num_pages);
+    window_tags = malloc(sizeof(*window_tags) * window_num_pages);
+    for (size_t i = 0; i < window_num_pages; i++) {
+        window_tags[i] = PFN_NONE;
+    }
+}
+
 void page_alloc_init(void) {
     struct bootinfo_memmap_entry *m =
         (struct bootinfo_memmap_entry *) &__bootinfo.memmap;
 
     list_init(&regions);
+    list_init(&memory_watchers);
     for (int i = 0; i < NUM_BOOTINFO_MEMMAP_MAX; i++, m++) {
         if (m->type != BOOTINFO_MEMMAP_TYPE_AVAILABLE) {
             continue;
@@ -210,10 +1051,35 @@ void page_alloc_init(void) {
               (size_mb > 0) ? size_mb : size_kb, (size_mb > 0) ? "MiB" : "KiB");
 
         list_push_back(&regions, &region->next);
+        num_buddy_pages = MAX(num_buddy_pages, paddr2pfn(region->base)
+                                                   + region->num_pages);
     }
 
     for (pfn_t i = 0; i < PAGES_MAX; i++) {
         pages[i].ref_count = 0;
         num_unused_pages++;
     }
+
+    buddy_pages = early_alloc(sizeof(*buddy_pages) * num_buddy_pages);
+    managed_bitmap = early_alloc(BITMAP_SIZE(num_buddy_pages));
+    bitmap_fill(managed_bitmap, BITMAP_SIZE(num_buddy_pages), 0);
+    for (pfn_t i = 0; i < num_buddy_pages; i++) {
+        buddy_pages[i].order = BUDDY_NOT_FREE;
+    }
+
+    for (int i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        free_lists[i] = PFN_NONE;
+    }
+
+    LIST_FOR_EACH (region, &regions, struct available_ram_region, next) {
+        pfn_t first = paddr2pfn(region->base);
+        for (pfn_t i = first; i < first + region->num_pages; i++) {
+            bitmap_set(managed_bitmap, BITMAP_SIZE(num_buddy_pages), i);
+        }
+
+        buddy_free_range(first, region->num_pages);
+        num_total_pages += region->num_pages;
+    }
+
+    buddy_ready = true;
 }
@@ -12,12 +12,36 @@ struct page {
     unsigned ref_count;
 };
 
+/// The maximum order of a buddy block (2^BUDDY_MAX_ORDER pages).
+#define BUDDY_MAX_ORDER 18
+#define BUDDY_NOT_FREE  (-1)
+#define PFN_NONE        ((pfn_t) -1)
+
+struct buddy_page {
+    /// Links in the free list. Valid only if the page is the head of a free
+    /// block.
+    pfn_t next;
+    pfn_t prev;
+    /// The order of the free block starting from this page or BUDDY_NOT_FREE.
+    int8_t order;
+};
+
 struct available_ram_region {
     list_elem_t next;
     paddr_t base;
     size_t num_pages;
 };
 
+/// The number of pre-zeroed pages kept in the pool.
+#define ZEROED_POOL_SIZE 64
+/// The number of pages zeroed into the pool per message in the mainloop.
+#define ZEROED_POOL_REFILL_BATCH 8
+
+/// Free memory watermarks (1/N of RAM). Tasks watching the memory are notified
+/// when the free memory crosses them.
+#define PRESSURE_LOW_WATERMARK_DIV      8
+#define PRESSURE_CRITICAL_WATERMARK_DIV 32
+
 extern char __straight_mapping[];
 #define PAGES_BASE_ADDR     ((paddr_t) __straight_mapping)
 #define PAGES_BASE_ADDR_END (PAGES_MAX * PAGE_SIZE)
@@ -27,13 +51,42 @@ extern size_t num_unused_pages;
 pfn_t paddr2pfn(paddr_t paddr);
 void page_incref(pfn_t pfn, size_t num_pages);
 void page_decref(pfn_t pfn, size_t num_pages);
-paddr_t page_alloc(size_t num_pages);
+paddr_t page_try_alloc(size_t num_pages);
+void *paddr2ptr(paddr_t paddr);
+void phys_memcpy(paddr_t dst, paddr_t src, size_t len);
+void zeroed_pool_refill(unsigned num_pages);
 struct task;
 error_t task_page_alloc(struct task *task, vaddr_t *vaddr, paddr_t *paddr,
                         size_t num_pages);
+bool task_page_exceeds_limit(struct task *task, size_t num_pages);
+error_t task_page_charge(struct task *task, size_t num_pages);
+void task_page_uncharge(struct task *task, size_t num_pages);
+void task_page_share(struct task *task, vaddr_t vaddr, paddr_t paddr,
+                     size_t num_pages, bool writable);
+paddr_t task_zeroed_page_alloc(struct task *task, vaddr_t vaddr);
+error_t task_page_clone(struct task *task, vaddr_t vaddr, size_t num_pages,
+                        struct task *dst, vaddr_t *dst_vaddr);
+error_t task_page_move(struct task *src, vaddr_t src_vaddr, struct task *dst,
+                       vaddr_t dst_vaddr, paddr_t *paddr);
+struct page_area;
+paddr_t task_page_cow_break(struct task *task, struct page_area *area,
+                            vaddr_t vaddr);
 vaddr_t virt_page_alloc(struct task *task, size_t num_pages);
+error_t virt_page_free(struct task *task, vaddr_t vaddr, size_t num_pages);
+void virt_page_init(struct task *task);
+void virt_page_free_all(struct task *task);
+struct page_area *page_area_lookup(struct task *task, vaddr_t vaddr);
 void task_page_free(struct task *task, paddr_t paddr);
+bool task_page_range_is_shared(struct task *task, vaddr_t vaddr,
+                               size_t num_pages);
+error_t task_page_free_range(struct task *task, vaddr_t vaddr,
+                             size_t num_pages);
 void task_page_free_all(struct task *task);
+void memory_stats(size_t *free_pages, size_t *total_pages);
+void memory_watch(struct task *task);
+void memory_unwatch(struct task *task);
+void memory_pressure_update(void);
+void phys_window_init(void);
 void page_alloc_init(void);
 
 #endif
@@ -2,6 +2,8 @@
 #include "bootfs.h"
 #include "page_alloc.h"
 #include "task.h"
+#include "worker.h"
+#include <bootinfo.h>
 #include <elf/elf.h>
 #include <resea/ipc.h>
 #include <resea/malloc.h>
@@ -9,11 +11,11 @@
 #include <string.h>
 
 extern char __cmdline[];
+extern char __kernel_info[];
+extern struct bootinfo __bootinfo;
 extern char __zeroed_pages[];
 extern char __zeroed_pages_end[];
 
-static vaddr_t tmp_page = 0;
-
 error_t map_page(struct task *task, vaddr_t vaddr, paddr_t paddr,
                  unsigned flags, bool overwrite) {
     if (overwrite) {
@@ -45,10 +47,78 @@ error_t map_page(struct task *task, vaddr_t vaddr, paddr_t paddr,
     }
 }
 
+/// Fills a page for `vaddr` with the file data. `map_flags` is set to the
+/// mapping type for the page.
+static paddr_t fill_file_page(struct task *task, struct elf64_phdr *phdr,
+                              vaddr_t vaddr, unsigned *map_flags) {
+    size_t offset_in_segment = (vaddr - phdr->p_vaddr) + phdr->p_offset;
+    if ((phdr->p_flags & PF_W) == 0
+        && IS_ALIGNED(offset_in_segment, PAGE_SIZE)
+        && offset_in_segment < task->file->len) {
+        // Read-only pages (.text and .rodata) are shared among the tasks
+        // spawned from the same file.
+        if (task_page_exceeds_limit(task, 1)) {
+            WARN_DBG("%s: reached the memory limit (%d pages)", task->name,
+                     task->max_resident_pages);
+            return 0;
+        }
+
+        paddr_t paddr = bootfs_cached_page(task->file, offset_in_segment);
+        if (!paddr) {
+            WARN_DBG("%s: out of memory", task->name);
+            return 0;
+        }
+
+        task_page_share(task, vaddr, paddr, 1, false);
+        *map_flags = MAP_TYPE_READONLY;
+        return paddr;
+    }
+
+    paddr_t paddr = 0;
+    if (task_page_alloc(task, &vaddr, &paddr, 1) != OK) {
+        return 0;
+    }
+
+    read_file(task->file, offset_in_segment, paddr2ptr(paddr), PAGE_SIZE);
+    *map_flags = MAP_TYPE_READWRITE;
+    return paddr;
+}
+
+/// Fills and maps pages following `vaddr` in the same segment so that the
+/// task won't fault on them. The window grows while the task faults
+/// sequentially (e.g. in the startup code) and shrinks back otherwise.
+static void fault_around(struct task *task, struct elf64_phdr *phdr,
+                         vaddr_t vaddr) {
+    if (vaddr == task->fault_around_next) {
+        task->fault_around_window =
+            MIN(task->fault_around_window * 2, FAULT_AROUND_PAGES_MAX);
+    } else {
+        task->fault_around_window = FAULT_AROUND_PAGES_MIN;
+    }
+
+    vaddr_t segment_end = ALIGN_UP(phdr->p_vaddr + phdr->p_memsz, PAGE_SIZE);
+    vaddr_t end =
+        MIN(vaddr + task->fault_around_window * PAGE_SIZE, segment_end);
+    task->fault_around_next = end;
+    for (vaddr_t page = vaddr + PAGE_SIZE; page < end; page += PAGE_SIZE) {
+        if (page_area_lookup(task, page)) {
+            // Already filled.
+            continue;
+        }
+
+        unsigned map_flags;
+        paddr_t paddr = fill_file_page(task, phdr, page, &map_flags);
+        if (!paddr || map_page(task, page, paddr, map_flags, false) != OK) {
+            break;
+        }
+    }
+}
+
 /// Tries to fill a page at `vaddr` for the task. Returns the allocated physical
-/// memory address on success or 0 on failure.
+/// memory address on success or 0 on failure. `map_flags` is set to the
+/// mapping type for the page.
 paddr_t handle_page_fault(struct task *task, vaddr_t vaddr, vaddr_t ip,
-                          unsigned fault) {
+                          unsigned fault, unsigned *map_flags) {
     if (vaddr < PAGE_SIZE) {
         WARN("%s (%d): null pointer dereference at vaddr=%p, ip=%p", task->name,
              task->tid, vaddr, ip);
@@ -59,6 +129,13 @@ paddr_t handle_page_fault(struct task *task, vaddr_t vaddr, vaddr_t ip,
     vaddr = ALIGN_DOWN(vaddr, PAGE_SIZE);
 
     if (fault & EXP_PF_PRESENT) {
+        struct page_area *area = page_area_lookup(task, vaddr);
+        if ((fault & EXP_PF_WRITE) && area && area->cow) {
+            // The first write into a copy-on-write page.
+            *map_flags = MAP_TYPE_READWRITE;
+            return task_page_cow_break(task, area, vaddr);
+        }
+
         // Invalid access. For instance the user thread has tried to write to
         // readonly area.
         WARN("%s: invalid memory access at %p (IP=%p, perhaps segfault?)",
@@ -66,43 +143,72 @@ paddr_t handle_page_fault(struct task *task, vaddr_t vaddr, vaddr_t ip,
         return 0;
     }
 
-    // The `cmdline` for main().
-    if (vaddr == (vaddr_t) __cmdline) {
-        paddr_t paddr = 0;
-        if (task_page_alloc(task, &vaddr, &paddr, 1) != OK) {
+    *map_flags = MAP_TYPE_READWRITE;
+
+    // The kernel info page (read-only).
+    if (vaddr == (vaddr_t) __kernel_info) {
+        if (fault & EXP_PF_WRITE) {
+            WARN("%s: tried to write into the kernel info page (IP=%p)",
+                 task->name, ip);
             return 0;
         }
-        if (map_page(vm_task, tmp_page, paddr, MAP_TYPE_READWRITE, false)
-            != OK) {
+
+        *map_flags = MAP_TYPE_READONLY;
+        return __bootinfo.kernel_info;
+    }
+
+    // The `cmdline` for main().
+    if (vaddr == (vaddr_t) __cmdline) {
+        paddr_t paddr = task_zeroed_page_alloc(task, vaddr);
+        if (!paddr) {
             return 0;
         }
-        memset((void *) tmp_page, 0, PAGE_SIZE);
-        strncpy2((void *) tmp_page, task->cmdline, PAGE_SIZE);
+
+        strncpy2(paddr2ptr(paddr), task->cmdline, PAGE_SIZE);
         return paddr;
     }
 
-    LIST_FOR_EACH (area, &task->page_areas, struct page_area, next) {
-        if (area->vaddr <= vaddr
-            && vaddr < area->vaddr + area->num_pages * PAGE_SIZE) {
-            return area->paddr + (vaddr - area->vaddr);
+    struct page_area *area = page_area_lookup(task, vaddr);
+    if (area) {
+        if (area->readonly) {
+            if (fault & EXP_PF_WRITE) {
+                WARN("%s: tried to write into a read-only page at %p (IP=%p)",
+                     task->name, vaddr_original, ip);
+                return 0;
+            }
+
+            *map_flags = MAP_TYPE_READONLY;
         }
+
+        if (area->cow) {
+            if (fault & EXP_PF_WRITE) {
+                return task_page_cow_break(task, area, vaddr);
+            }
+
+            *map_flags = MAP_TYPE_READONLY;
+        }
+
+        return area->paddr + (vaddr - area->vaddr);
     }
 
     // Zeroed pages.
     vaddr_t zeroed_pages_start = (vaddr_t) __zeroed_pages;
     vaddr_t zeroed_pages_end = (vaddr_t) __zeroed_pages_end;
     if (zeroed_pages_start <= vaddr && vaddr < zeroed_pages_end) {
-        // The accessed page is zeroed one (.bss section, stack, or heap).
-        paddr_t paddr = 0;
-        if (task_page_alloc(task, &vaddr, &paddr, 1) != OK) {
-            return 0;
-        }
-        if (map_page(vm_task, tmp_page, paddr, MAP_TYPE_READWRITE, false)
-            != OK) {
-            return 0;
+        // The accessed page is zeroed one (.bss section, stack, or heap). If
+        // the task is paged by a worker, the page may have been filled by it.
+        if (task->worker) {
+            paddr_t paddr;
+            if (worker_take_page(task, vaddr, &paddr) != OK) {
+                return 0;
+            }
+
+            if (paddr) {
+                return paddr;
+            }
         }
-        memset((void *) tmp_page, 0, PAGE_SIZE);
-        return paddr;
+
+        return task_zeroed_page_alloc(task, vaddr);
     }
 
     // Look for the associated program header.
@@ -123,18 +229,17 @@ paddr_t handle_page_fault(struct task *task, vaddr_t vaddr, vaddr_t ip,
         }
 
         if (phdr) {
-            // Allocate a page and fill it with the file data.
-            paddr_t paddr = 0;
-            if (task_page_alloc(task, &vaddr, &paddr, 1) != OK) {
+            if ((fault & EXP_PF_WRITE) && (phdr->p_flags & PF_W) == 0) {
+                WARN("%s: tried to write into a read-only segment at %p "
+                     "(IP=%p)",
+                     task->name, vaddr_original, ip);
                 return 0;
             }
-            if (map_page(vm_task, tmp_page, paddr, MAP_TYPE_READWRITE, false)
-                != OK) {
-                return 0;
+
+            paddr_t paddr = fill_file_page(task, phdr, vaddr, map_flags);
+            if (paddr) {
+                fault_around(task, phdr, vaddr);
             }
-            size_t offset_in_segment = (vaddr - phdr->p_vaddr) + phdr->p_offset;
-            read_file(task->file, offset_in_segment, (void *) tmp_page,
-                      PAGE_SIZE);
             return paddr;
         }
     }
@@ -144,6 +249,27 @@ paddr_t handle_page_fault(struct task *task, vaddr_t vaddr, vaddr_t ip,
     return 0;
 }
 
+/// Fills and maps the page for a page fault. The page is remapped if it's
+/// present (i.e. a copy-on-write fault).
+error_t page_fault_resolve(struct task *task, vaddr_t vaddr, vaddr_t ip,
+                           unsigned fault) {
+    unsigned map_flags;
+    paddr_t paddr = handle_page_fault(task, vaddr, ip, fault, &map_flags);
+    if (!paddr) {
+        return ERR_NOT_FOUND;
+    }
+
+    bool overwrite = (fault & EXP_PF_PRESENT) != 0;
+    return map_page(task, ALIGN_DOWN(vaddr, PAGE_SIZE), paddr, map_flags,
+                    overwrite);
+}
+
 void page_fault_init(void) {
-    tmp_page = virt_page_alloc(vm_task, 1);
+    phys_window_init();
+    zeroed_pool_refill(ZEROED_POOL_SIZE);
+
+    // Map the kernel info page into our address space. Other tasks get it
+    // on demand through page faults.
+    ASSERT_OK(map_page(vm_task, (vaddr_t) __kernel_info,
+                       __bootinfo.kernel_info, MAP_TYPE_READONLY, false));
 }
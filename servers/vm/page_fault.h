@@ -3,11 +3,18 @@
 
 #include <types.h>
 
+/// The minimum number of pages filled per fault in a file-backed segment.
+#define FAULT_AROUND_PAGES_MIN 4
+/// The maximum number of pages filled per fault in a file-backed segment.
+#define FAULT_AROUND_PAGES_MAX 64
+
 struct task;
 error_t map_page(struct task *task, vaddr_t vaddr, paddr_t paddr,
                  unsigned flags, bool overwrite);
 paddr_t handle_page_fault(struct task *task, vaddr_t vaddr, vaddr_t ip,
-                          unsigned fault);
+                          unsigned fault, unsigned *map_flags);
+error_t page_fault_resolve(struct task *task, vaddr_t vaddr, vaddr_t ip,
+                           unsigned fault);
 void page_fault_init(void);
 
 #endif
@@ -1,69 +1,188 @@
 #include "shm.h"
 #include "page_alloc.h"
-#include "page_fault.h"
+#include <resea/malloc.h>
+#include <resea/printf.h>
 #include <string.h>
 
-static struct shm shared_mems[NUM_SHARED_MEMS_MAX];
+static struct avl_tree shms;
+static int next_shm_id = 0;
 
-int shm_check_available(void) {
-    int i;
-    for (i = 0; i < NUM_SHARED_MEMS_MAX && shared_mems[i].inuse; i++);
-    
-    if (i == NUM_SHARED_MEMS_MAX) {
-        return -1;
+/// Returns the number of physically contiguous pages from `pages[0]`.
+static size_t contiguous_len(paddr_t *pages, size_t num_pages) {
+    size_t len = 1;
+    while (len < num_pages && pages[len] == pages[0] + len * PAGE_SIZE) {
+        len++;
     }
 
-    return i;
+    return len;
 }
 
-error_t shm_create(struct task *task, size_t size, int *slot) {
-    *slot = shm_check_available();
-    if (*slot < 0) {
-        return ERR_UNAVAILABLE;
+static void decref_pages(paddr_t *pages, size_t num_pages) {
+    size_t i = 0;
+    while (i < num_pages) {
+        size_t len = contiguous_len(&pages[i], num_pages - i);
+        page_decref(paddr2pfn(pages[i]), len);
+        i += len;
+    }
+}
+
+/// Allocates zero-filled pages. They don't have to be physically contiguous:
+/// it takes the largest contiguous blocks available.
+static error_t alloc_pages(paddr_t *pages, size_t num_pages) {
+    size_t i = 0;
+    size_t chunk = num_pages;
+    while (i < num_pages) {
+        chunk = MIN(chunk, num_pages - i);
+        paddr_t paddr = page_try_alloc(chunk);
+        if (!paddr) {
+            if (chunk == 1) {
+                decref_pages(pages, i);
+                return ERR_NO_MEMORY;
+            }
+
+            chunk /= 2;
+            continue;
+        }
+
+        // The pages are mapped by shm_map() and may contain old data.
+        for (size_t j = 0; j < chunk; j++) {
+            pages[i] = paddr + j * PAGE_SIZE;
+            memset(paddr2ptr(pages[i]), 0, PAGE_SIZE);
+            i++;
+        }
+    }
+
+    return OK;
+}
+
+/// Creates a shared memory region of `size` bytes owned by the task. The pages
+/// are charged to the task until it closes the region.
+error_t shm_create(struct task *task, size_t size, int *shm_id) {
+    size_t num_pages = ALIGN_UP(size, PAGE_SIZE) / PAGE_SIZE;
+    if (!num_pages) {
+        return ERR_INVALID_ARG;
+    }
+
+    size_t free_pages, total_pages;
+    memory_stats(&free_pages, &total_pages);
+    if (num_pages > free_pages) {
+        return ERR_NO_MEMORY;
     }
 
-    paddr_t paddr = 0;
-    vaddr_t vaddr;
-    error_t err = task_page_alloc(task, &vaddr, &paddr, size);
+    OK_OR_RETURN(task_page_charge(task, num_pages));
+    paddr_t *pages = malloc(num_pages * sizeof(*pages));
+    error_t err = alloc_pages(pages, num_pages);
     if (err != OK) {
+        free(pages);
+        task_page_uncharge(task, num_pages);
         return err;
     }
 
-    shared_mems[*slot].inuse = true;
-    shared_mems[*slot].shm_id = *slot;
-    shared_mems[*slot].len = size;
-    shared_mems[*slot].paddr = paddr;
+    struct shm *shm = malloc(sizeof(*shm));
+    shm->shm_id = next_shm_id++;
+    shm->owner = task;
+    shm->pages = pages;
+    shm->num_pages = num_pages;
+    shm->closed = false;
+    list_init(&shm->mappings);
+    list_push_back(&task->shms, &shm->owner_next);
+    avl_insert(&shms, &shm->node, shm->shm_id);
+    *shm_id = shm->shm_id;
     return OK;
 }
 
+/// Maps the whole region into the task. Pages are mapped on demand through
+/// page faults.
 error_t shm_map(struct task *task, int shm_id, bool writable, vaddr_t *vaddr) {
-    struct shm* shm = shm_lookup(shm_id);
-    if (shm == NULL) {
+    struct shm *shm = shm_lookup(shm_id);
+    if (shm == NULL || shm->closed) {
         return ERR_NOT_FOUND;
     }
 
-    *vaddr = virt_page_alloc(task, shm->len);
-    int flag = (writable) ? MAP_TYPE_READWRITE : MAP_TYPE_READONLY;
-    error_t err = map_page(task, *vaddr, shm->paddr, flag, true);
-    return err;
+    *vaddr = virt_page_alloc(task, shm->num_pages);
+    if (!*vaddr) {
+        return ERR_NO_MEMORY;
+    }
+
+    size_t i = 0;
+    while (i < shm->num_pages) {
+        size_t len = contiguous_len(&shm->pages[i], shm->num_pages - i);
+        task_page_share(task, *vaddr + i * PAGE_SIZE, shm->pages[i], len,
+                        writable);
+        i += len;
+    }
+
+    struct shm_mapping *mapping = malloc(sizeof(*mapping));
+    mapping->shm = shm;
+    mapping->task = task;
+    mapping->vaddr = *vaddr;
+    list_push_back(&shm->mappings, &mapping->shm_next);
+    list_push_back(&task->shm_mappings, &mapping->task_next);
+    return OK;
 }
 
-void shm_close(int shm_id) {
-    struct shm* shm = shm_lookup(shm_id);
-    if (shm != NULL) {
-        shm->inuse = false;
+/// Frees the region once it's closed by the owner and no one maps it.
+static void try_free(struct shm *shm) {
+    if (shm->closed && list_is_empty(&shm->mappings)) {
+        avl_remove(&shms, &shm->node);
+        free(shm->pages);
+        free(shm);
     }
 }
 
-struct shm* shm_lookup(int shm_id) {
-    int i;
-    for (i = 0; i < NUM_SHARED_MEMS_MAX; i++) {
-        if (shared_mems[i].shm_id == shm_id) {
-            if (shared_mems[i].inuse == false) {
-                return NULL;
-            }
-            return &shared_mems[i];
+static void close_by_owner(struct shm *shm) {
+    shm->closed = true;
+    list_remove(&shm->owner_next);
+    task_page_uncharge(shm->owner, shm->num_pages);
+    // Mappings keep their own references to the pages.
+    decref_pages(shm->pages, shm->num_pages);
+}
+
+/// Unmaps the region from the task. If the task is the owner, the region
+/// can no longer be mapped and is freed when the last mapping is closed.
+error_t shm_close(struct task *task, int shm_id) {
+    struct shm *shm = shm_lookup(shm_id);
+    if (shm == NULL) {
+        return ERR_NOT_FOUND;
+    }
+
+    LIST_FOR_EACH (mapping, &shm->mappings, struct shm_mapping, shm_next) {
+        if (mapping->task == task) {
+            OOPS_OK(
+                task_page_free_range(task, mapping->vaddr, shm->num_pages));
+            list_remove(&mapping->shm_next);
+            list_remove(&mapping->task_next);
+            free(mapping);
         }
     }
-    return NULL;
+
+    if (shm->owner == task && !shm->closed) {
+        close_by_owner(shm);
+    }
+
+    try_free(shm);
+    return OK;
+}
+
+/// Drops the regions mapped or owned by an exiting task. The mapped pages
+/// are freed along with the task's page areas.
+void shm_task_exit(struct task *task) {
+    LIST_FOR_EACH (mapping, &task->shm_mappings, struct shm_mapping,
+                   task_next) {
+        struct shm *shm = mapping->shm;
+        list_remove(&mapping->shm_next);
+        list_remove(&mapping->task_next);
+        free(mapping);
+        try_free(shm);
+    }
+
+    LIST_FOR_EACH (shm, &task->shms, struct shm, owner_next) {
+        close_by_owner(shm);
+        try_free(shm);
+    }
+}
+
+struct shm *shm_lookup(int shm_id) {
+    struct avl_node *node = avl_find(&shms, shm_id);
+    return node ? AVL_CONTAINER(node, struct shm, node) : NULL;
 }
@@ -1,20 +1,43 @@
 #ifndef __SHM_H__
 #define __SHM_H__
 
+#include "avl.h"
 #include "task.h"
+#include <list.h>
 #include <types.h>
 
+/// A shared memory region.
 struct shm {
-    bool inuse;
+    /// The node in the shm table keyed by `shm_id`.
+    struct avl_node node;
+    /// The element in the owner's `shms`.
+    list_elem_t owner_next;
     int shm_id;
-    paddr_t paddr;
-    size_t len;
+    struct task *owner;
+    /// The physical addresses of the pages. They're not contiguous.
+    paddr_t *pages;
+    size_t num_pages;
+    /// Closed by the owner: it can no longer be mapped.
+    bool closed;
+    /// Mappings of the region (struct shm_mapping).
+    list_t mappings;
 };
 
-#define NUM_SHARED_MEMS_MAX 32
-int shm_check_available(void);
-error_t shm_create(struct task* task, size_t size, int* slot);
-error_t shm_map(struct task* task, int shm_id, bool writable, vaddr_t* vaddr);
-void shm_close(int shm_id);
-struct shm* shm_lookup(int shm_id);
+/// A mapping of a shared memory region in a task.
+struct shm_mapping {
+    /// The element in `shm->mappings`.
+    list_elem_t shm_next;
+    /// The element in the task's `shm_mappings`.
+    list_elem_t task_next;
+    struct shm *shm;
+    struct task *task;
+    vaddr_t vaddr;
+};
+
+error_t shm_create(struct task *task, size_t size, int *shm_id);
+error_t shm_map(struct task *task, int shm_id, bool writable, vaddr_t *vaddr);
+error_t shm_close(struct task *task, int shm_id);
+void shm_task_exit(struct task *task);
+struct shm *shm_lookup(int shm_id);
+
 #endif
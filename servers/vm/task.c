@@ -1,6 +1,9 @@
 #include "task.h"
 #include "bootfs.h"
 #include "page_alloc.h"
+#include "page_fault.h"
+#include "shm.h"
+#include "worker.h"
 #include <elf/elf.h>
 #include <message.h>
 #include <resea/async.h>
@@ -9,10 +12,10 @@
 #include <resea/task.h>
 #include <string.h>
 
-extern char __free_vaddr[];
 
 static struct task tasks[CONFIG_NUM_TASKS];
-static list_t services;
+/// A hash table of services (struct service).
+static list_t services[SERVICE_HASH_SIZE];
 
 /// Look for the task in the our task table.
 struct task *task_lookup(task_t tid) {
@@ -25,6 +28,16 @@ struct task *task_lookup(task_t tid) {
     return task;
 }
 
+/// Look for the task in the our task table. Unlike `task_lookup`, it returns
+/// NULL if `tid` is not a valid task (e.g. given by another task).
+struct task *task_find(task_t tid) {
+    if (tid <= 0 || tid > CONFIG_NUM_TASKS || !tasks[tid - 1].in_use) {
+        return NULL;
+    }
+
+    return &tasks[tid - 1];
+}
+
 /// Allocates a task ID.
 struct task *task_alloc(task_t pager) {
     // Look for an unused task ID.
@@ -34,6 +47,9 @@ struct task *task_alloc(task_t pager) {
             task = &tasks[i];
             task->in_use = true;
             task->pager = pager;
+            task->worker = NULL;
+            task->num_resident_pages = 0;
+            task->max_resident_pages = 0;
             return task;
         }
     }
@@ -59,20 +75,26 @@ static void init_task_struct(struct task *task, const char *name,
     }
 
     task->pager = vm_task->tid;
+    task->worker = NULL;
     task->in_use = true;
-    task->free_vaddr = (vaddr_t) __free_vaddr;
-    task->ool_buf = 0;
+    task->fault_around_next = 0;
+    task->fault_around_window = FAULT_AROUND_PAGES_MIN;
+    task->num_ool_bufs = 0;
     task->ool_len = 0;
-    task->received_ool_buf = 0;
-    task->received_ool_len = 0;
-    task->received_ool_from = 0;
+    task->ool_max_len = 0;
+    task->num_received_ools = 0;
     list_init(&task->ool_sender_queue);
     list_nullify(&task->ool_sender_next);
     strncpy2(task->name, name, sizeof(task->name));
     strncpy2(task->cmdline, cmdline, sizeof(task->cmdline));
-    strncpy2(task->waiting_for, "", sizeof(task->waiting_for));
-    list_init(&task->page_areas);
+    avl_init(&task->page_areas_by_vaddr);
+    avl_init(&task->page_areas_by_paddr);
+    task->num_resident_pages = 0;
+    task->max_resident_pages = 0;
+    virt_page_init(task);
     list_init(&task->watchers);
+    list_init(&task->shms);
+    list_init(&task->shm_mappings);
 }
 
 /// Execute a ELF file. Returns an task ID on success or an error on failure.
@@ -94,15 +116,26 @@ task_t task_spawn(struct bootfs_file *file, const char *cmdline) {
                4)
         != 0) {
         WARN("%s: invalid ELF magic, ignoring...", file->name);
+        free(file_header);
+        task_free(task);
         return ERR_NOT_ACCEPTABLE;
     }
 
     init_task_struct(task, file->name, file, file_header, ehdr, cmdline);
 
+    // Let a worker page the task if available.
+    error_t err = worker_assign(task);
+    if (err != OK) {
+        // Free the task ID and the pages allocated for the task.
+        task_kill(task);
+        return err;
+    }
+
     // Create a new task for the server.
-    error_t err = task_create(task->tid, file->name, ehdr->e_entry, task_self(),
-                              TASK_ALL_CAPS);
+    err = task_create(task->tid, file->name, ehdr->e_entry, task->pager,
+                      TASK_ALL_CAPS);
     if (err != OK) {
+        task_kill(task);
         return err;
     }
 
@@ -149,21 +182,41 @@ void task_kill(struct task *task) {
         free(w);
     }
 
-    LIST_FOR_EACH (service, &services, struct service, next) {
-        if (service->task == task->tid) {
-            list_remove(&service->next);
-            free(service);
-        }
-    }
-
+    service_task_exit(task);
+    memory_unwatch(task);
+    shm_task_exit(task);
     task_page_free_all(task);
+    virt_page_free_all(task);
     task_destroy(task->tid);
+    // The task's pages held by its worker are freed after the task is gone.
+    worker_release(task);
     task->in_use = false;
     if (task->file_header) {
         free(task->file_header);
     }
 }
 
+/// Handles an exception in a task paged by us or a worker: the task is killed.
+void task_handle_exception(struct task *task, enum exception_type exception) {
+    if (is_worker(task)) {
+        PANIC("%s: exception occurred in a pager worker", task->name);
+    }
+
+    if (exception == EXP_GRACE_EXIT) {
+        INFO("%s: terminated its execution", task->name);
+    } else {
+        WARN("%s: exception occurred, killing the task...", task->name);
+    }
+
+    task_kill(task);
+}
+
+/// Returns true if the task's pages are managed by us, i.e. it's paged by us
+/// or a worker.
+bool task_is_paged_by_vm(struct task *task) {
+    return task->pager == vm_task->tid || task->worker;
+}
+
 void task_watch(struct task *watcher, struct task *task) {
     struct task_watcher *w = malloc(sizeof(*w));
     w->watcher = watcher;
@@ -180,52 +233,152 @@ void task_unwatch(struct task *watcher, struct task *task) {
     }
 }
 
-void service_register(struct task *task, const char *name) {
-    // Add the server into the service list.
+/// Computes the hash of a service name (FNV-1a).
+static unsigned service_hash(const char *name) {
+    uint32_t hash = 2166136261;
+    for (int i = 0; name[i] != '\0'; i++) {
+        hash = (hash ^ (uint8_t) name[i]) * 16777619;
+    }
+
+    return hash % SERVICE_HASH_SIZE;
+}
+
+static struct service *service_lookup(const char *name, bool create) {
+    list_t *bucket = &services[service_hash(name)];
+    LIST_FOR_EACH (s, bucket, struct service, next) {
+        if (!strncmp(s->name, name, sizeof(s->name))) {
+            return s;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
     struct service *service = malloc(sizeof(*service));
-    service->task = task->tid;
     strncpy2(service->name, name, sizeof(service->name));
-    list_nullify(&service->next);
-    list_push_back(&services, &service->next);
+    service->task = 0;
+    list_init(&service->waiters);
+    list_init(&service->lookers);
+    list_push_back(bucket, &service->next);
+    return service;
+}
 
-    // Look for tasks waiting for the service...
-    for (int i = 0; i < CONFIG_NUM_TASKS; i++) {
-        struct task *task = &tasks[i];
-        if (!strcmp(task->waiting_for, name)) {
-            struct message m;
-            bzero(&m, sizeof(m));
+/// Frees the entry if it's no longer referenced.
+static void service_gc(struct service *service) {
+    if (!service->task && list_is_empty(&service->waiters)
+        && list_is_empty(&service->lookers)) {
+        list_remove(&service->next);
+        free(service);
+    }
+}
+
+/// Adds the task into `list` (struct task_watcher) unless it's already in.
+static struct task_watcher *add_task_watcher(list_t *list, struct task *task) {
+    LIST_FOR_EACH (w, list, struct task_watcher, next) {
+        if (w->watcher == task) {
+            return w;
+        }
+    }
+
+    struct task_watcher *w = malloc(sizeof(*w));
+    w->watcher = task;
+    w->notify_exit = false;
+    list_push_back(list, &w->next);
+    return w;
+}
+
+static void remove_task_watcher(list_t *list, struct task *task) {
+    LIST_FOR_EACH (w, list, struct task_watcher, next) {
+        if (w->watcher == task) {
+            list_remove(&w->next);
+            free(w);
+            return;
+        }
+    }
+}
+
+void service_register(struct task *task, const char *name) {
+    struct service *service = service_lookup(name, true);
+    if (service->task) {
+        WARN("%s: service '%s' is already provided by #%d, ignoring",
+             task->name, name, service->task);
+        return;
+    }
 
-            m.type = DISCOVERY_LOOKUP_REPLY_MSG;
-            m.discovery_lookup_reply.task = service->task;
-            ipc_reply(task->tid, &m);
+    service->task = task->tid;
+
+    // Wake up tasks waiting for the service.
+    LIST_FOR_EACH (w, &service->waiters, struct task_watcher, next) {
+        struct message m;
+        bzero(&m, sizeof(m));
+        m.type = DISCOVERY_LOOKUP_REPLY_MSG;
+        m.discovery_lookup_reply.task = service->task;
+        ipc_reply(w->watcher->tid, &m);
 
-            // The task no longer wait for the service. Clear the field.
-            strncpy2(task->waiting_for, "", sizeof(task->waiting_for));
+        list_remove(&w->next);
+        if (w->notify_exit) {
+            add_task_watcher(&service->lookers, w->watcher);
         }
+        free(w);
     }
 }
 
-task_t service_wait(struct task *task, const char *name) {
-    LIST_FOR_EACH (s, &services, struct service, next) {
-        if (!strcmp(s->name, name)) {
-            return s->task;
+task_t service_wait(struct task *task, const char *name, bool notify_exit) {
+    struct service *service = service_lookup(name, true);
+    if (service->task) {
+        // Notify the task when the server exits so that it can invalidate
+        // its lookup cache. Only tasks which asked for it: others may never
+        // receive async messages from us.
+        if (notify_exit) {
+            add_task_watcher(&service->lookers, task);
         }
+
+        return service->task;
     }
 
     // The service is not yet available. Block the caller task until the
     // server is registered by `ipc_serve()`.
-    strncpy2(task->waiting_for, name, sizeof(task->waiting_for));
+    struct task_watcher *w = add_task_watcher(&service->waiters, task);
+    w->notify_exit = notify_exit;
     return ERR_WOULD_BLOCK;
 }
 
+/// Unregisters services provided by the task and forgets the task in waiter
+/// lists.
+void service_task_exit(struct task *task) {
+    for (int i = 0; i < SERVICE_HASH_SIZE; i++) {
+        LIST_FOR_EACH (s, &services[i], struct service, next) {
+            remove_task_watcher(&s->waiters, task);
+            remove_task_watcher(&s->lookers, task);
+            if (s->task == task->tid) {
+                LIST_FOR_EACH (w, &s->lookers, struct task_watcher, next) {
+                    struct message m;
+                    bzero(&m, sizeof(m));
+                    m.type = DISCOVERY_SERVICE_EXITED_MSG;
+                    m.discovery_service_exited.task = task->tid;
+                    async_send(w->watcher->tid, &m);
+                    list_remove(&w->next);
+                    free(w);
+                }
+
+                s->task = 0;
+            }
+
+            service_gc(s);
+        }
+    }
+}
+
 void service_warn_deadlocked_tasks(void) {
-    for (int i = 0; i < CONFIG_NUM_TASKS; i++) {
-        struct task *task = &tasks[i];
-        if (strlen(task->waiting_for) > 0) {
-            WARN(
-                "%s still waiting for a missing service '%s', "
-                "did you forgot to enable a server in the build config?",
-                task->name, task->waiting_for);
+    for (int i = 0; i < SERVICE_HASH_SIZE; i++) {
+        LIST_FOR_EACH (s, &services[i], struct service, next) {
+            LIST_FOR_EACH (w, &s->waiters, struct task_watcher, next) {
+                WARN(
+                    "%s still waiting for a missing service '%s', "
+                    "did you forgot to enable a server in the build config?",
+                    w->watcher->name, s->name);
+            }
         }
     }
 }
@@ -241,5 +394,7 @@ void task_init(void) {
     // Initialize a task struct for myself.
     vm_task = &tasks[INIT_TASK - 1];
     init_task_struct(vm_task, "vm", NULL, NULL, NULL, "");
-    list_init(&services);
+    for (int i = 0; i < SERVICE_HASH_SIZE; i++) {
+        list_init(&services[i]);
+    }
 }
@@ -1,19 +1,48 @@
 #ifndef __TASK_H__
 #define __TASK_H__
 
+#include "avl.h"
 #include <list.h>
 #include <message.h>
 #include <types.h>
 
-#define SERVICE_NAME_LEN 32
+#define SERVICE_NAME_LEN  32
+#define SERVICE_HASH_SIZE 64
 
 /// A page area allocated for a task. It is mainly used to free memory pages
 /// when the task exit.
 struct page_area {
-    list_elem_t next;
+    /// The node in the task's vaddr index. Unused if `vaddr` is zero.
+    struct avl_node vaddr_node;
+    /// The node in the task's paddr index.
+    struct avl_node paddr_node;
     vaddr_t vaddr;
     paddr_t paddr;
     size_t num_pages;
+    /// Write accesses are not allowed.
+    bool readonly;
+    /// Pages intentionally shared with other tasks (e.g. shared memory). They
+    /// stay shared when cloned.
+    bool shared;
+    /// Pages shared until written (copy-on-write).
+    bool cow;
+};
+
+/// An OoL payload received by a task but not yet verified by the task.
+struct received_ool {
+    task_t from;
+    vaddr_t buf;
+    size_t len;
+};
+
+/// A free range in a task's virtual address space.
+struct vaddr_range {
+    /// The node in the index keyed by the address.
+    struct avl_node addr_node;
+    /// The node in the index keyed by the size.
+    struct avl_node size_node;
+    vaddr_t base;
+    size_t num_pages;
 };
 
 /// Task Control Block (TCB).
@@ -21,35 +50,64 @@ struct task {
     bool in_use;
     task_t tid;
     task_t pager;
+    /// The pager worker paging the task or NULL if it's paged by us.
+    struct task *worker;
     char name[32];
     char cmdline[512];
     struct bootfs_file *file;
     void *file_header;
     struct elf64_ehdr *ehdr;
     struct elf64_phdr *phdrs;
-    vaddr_t free_vaddr;
-    list_t page_areas;
-    vaddr_t ool_buf;
+    struct avl_tree free_vaddrs_by_addr;
+    struct avl_tree free_vaddrs_by_size;
+    /// The page next to the last fault-around window.
+    vaddr_t fault_around_next;
+    /// The current fault-around window size in pages.
+    unsigned fault_around_window;
+    struct avl_tree page_areas_by_vaddr;
+    struct avl_tree page_areas_by_paddr;
+    /// The number of physical pages held in the page areas.
+    size_t num_resident_pages;
+    /// The maximum number of resident pages or zero if it's unlimited.
+    size_t max_resident_pages;
+    /// Registered OoL receive buffers (`ool_len` bytes each).
+    vaddr_t ool_bufs[OOL_RECV_BUFS_MAX];
+    unsigned num_ool_bufs;
     size_t ool_len;
-    task_t received_ool_from;
-    vaddr_t received_ool_buf;
-    size_t received_ool_len;
+    /// The maximum length of an OoL payload the task accepts.
+    size_t ool_max_len;
+    /// Received OoL payloads waiting for `ool.verify`.
+    struct received_ool received_ools[OOL_RECV_BUFS_MAX];
+    unsigned num_received_ools;
     list_t ool_sender_queue;
     list_elem_t ool_sender_next;
     struct message ool_sender_m;
-    char waiting_for[SERVICE_NAME_LEN];
     list_t watchers;
+    /// Shared memory regions owned by the task (struct shm).
+    list_t shms;
+    /// Shared memory regions mapped in the task (struct shm_mapping).
+    list_t shm_mappings;
 };
 
+/// A service name entry. It's kept while the service is registered or
+/// someone is interested in it.
 struct service {
     list_elem_t next;
     char name[SERVICE_NAME_LEN];
+    /// The server task or zero if it's not yet registered.
     task_t task;
+    /// Tasks blocked in `discovery.lookup` (struct task_watcher).
+    list_t waiters;
+    /// Tasks which have looked up the service with `notify_exit` (struct
+    /// task_watcher). They're notified when the server exits.
+    list_t lookers;
 };
 
 struct task_watcher {
     list_elem_t next;
     struct task *watcher;
+    /// Used in `struct service`: notify the task when the server exits.
+    bool notify_exit;
 };
 
 extern struct task *vm_task;
@@ -59,11 +117,15 @@ void task_free(struct task *task);
 task_t task_spawn(struct bootfs_file *file, const char *cmdline);
 task_t task_spawn_by_cmdline(const char *name_with_cmdline);
 struct task *task_lookup(task_t tid);
+struct task *task_find(task_t tid);
 void task_kill(struct task *task);
+void task_handle_exception(struct task *task, enum exception_type exception);
+bool task_is_paged_by_vm(struct task *task);
 void task_watch(struct task *watcher, struct task *task);
 void task_unwatch(struct task *watcher, struct task *task);
 void service_register(struct task *task, const char *name);
-task_t service_wait(struct task *task, const char *name);
+task_t service_wait(struct task *task, const char *name, bool notify_exit);
+void service_task_exit(struct task *task);
 void service_warn_deadlocked_tasks(void);
 void task_init(void);
 
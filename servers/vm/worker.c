@@ -0,0 +1,361 @@
+#include "worker.h"
+#include "bootfs.h"
+#include "page_alloc.h"
+#include "page_fault.h"
+#include "task.h"
+#include <elf/elf.h>
+#include <resea/ipc.h>
+#include <resea/printf.h>
+#include <resea/task.h>
+#include <string.h>
+
+extern char __cmdline[];
+extern char __kernel_info[];
+extern char __stack[];
+extern char __stack_end[];
+
+/// Pager workers. Each of them pages a disjoint set of tasks spawned by us and
+/// fills their zero-filled pages in parallel. We call workers synchronously
+/// but they never call us except `vm_worker.ready`: events such as forwarded
+/// page faults are taken by `vm_worker.poll`.
+static struct task *workers[NUM_WORKERS_MAX];
+static bool workers_ready[NUM_WORKERS_MAX];
+static int num_workers = 0;
+static int num_ready_workers = 0;
+/// The next worker to be assigned a task.
+static int next_worker = 0;
+
+static int worker_index(struct task *task) {
+    for (int i = 0; i < num_workers; i++) {
+        if (workers[i] == task) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+bool is_worker(struct task *task) {
+    return worker_index(task) >= 0;
+}
+
+static error_t call_worker(struct task *worker, struct message *m) {
+    error_t err = ipc_call(worker->tid, m);
+    if (err != OK) {
+        WARN_DBG("%s: %s failed: %s", worker->name, msgtype2str(m->type),
+                 err2str(err));
+    }
+
+    return err;
+}
+
+/// Fills and maps a page in the worker before it accesses the page.
+static error_t wire_page(struct task *worker, vaddr_t vaddr) {
+    if (page_area_lookup(worker, vaddr)) {
+        // Already filled and mapped.
+        return OK;
+    }
+
+    unsigned map_flags;
+    paddr_t paddr =
+        handle_page_fault(worker, vaddr, 0, EXP_PF_USER, &map_flags);
+    if (!paddr) {
+        return ERR_NO_MEMORY;
+    }
+
+    return map_page(worker, vaddr, paddr, map_flags, false);
+}
+
+/// Maps all pages of the worker in advance except the unused part of the
+/// stack: if it page faults while we're calling it, both of us would wait for
+/// each other forever.
+static error_t wire_worker(struct task *worker) {
+    vaddr_t unused_stack_start = (vaddr_t) __stack;
+    vaddr_t unused_stack_end = (vaddr_t) __stack_end - WORKER_STACK_LEN;
+    OK_OR_RETURN(wire_page(worker, (vaddr_t) __kernel_info));
+    OK_OR_RETURN(wire_page(worker, (vaddr_t) __cmdline));
+    for (unsigned i = 0; i < worker->ehdr->e_phnum; i++) {
+        struct elf64_phdr *phdr = &worker->phdrs[i];
+        if (phdr->p_type != PT_LOAD || !phdr->p_vaddr) {
+            continue;
+        }
+
+        vaddr_t start = ALIGN_DOWN(phdr->p_vaddr, PAGE_SIZE);
+        vaddr_t end = ALIGN_UP(phdr->p_vaddr + phdr->p_memsz, PAGE_SIZE);
+        for (vaddr_t vaddr = start; vaddr < end; vaddr += PAGE_SIZE) {
+            if (unused_stack_start <= vaddr && vaddr < unused_stack_end) {
+                continue;
+            }
+
+            OK_OR_RETURN(wire_page(worker, vaddr));
+        }
+    }
+
+    return OK;
+}
+
+/// Spawns pager workers. Returns the number of spawned workers. They start
+/// paging new tasks once they become ready.
+int worker_init(void) {
+    struct bootfs_file *file;
+    for (int i = 0; (file = bootfs_open(i)) != NULL; i++) {
+        if (!strcmp(file->name, "vm_worker")) {
+            break;
+        }
+    }
+
+    if (!file) {
+        if (CONFIG_VM_NUM_WORKERS > 0) {
+            WARN("vm_worker is not in bootfs, handling all page faults in vm");
+        }
+
+        return 0;
+    }
+
+    for (int i = 0; i < MIN(CONFIG_VM_NUM_WORKERS, NUM_WORKERS_MAX); i++) {
+        task_t tid = task_spawn(file, "");
+        if (IS_ERROR(tid)) {
+            PANIC("failed to spawn vm_worker: %s", err2str(tid));
+        }
+
+        struct task *worker = task_lookup(tid);
+        if (wire_worker(worker) != OK) {
+            PANIC("failed to map pages for vm_worker");
+        }
+
+        workers[num_workers] = worker;
+        workers_ready[num_workers] = false;
+        num_workers++;
+    }
+
+    return num_workers;
+}
+
+/// Handles `vm_worker.ready`. The worker asks for pages by itself.
+error_t worker_ready(struct task *worker) {
+    int index = worker_index(worker);
+    if (index < 0 || workers_ready[index]) {
+        return ERR_NOT_PERMITTED;
+    }
+
+    workers_ready[index] = true;
+    num_ready_workers++;
+    return OK;
+}
+
+bool worker_all_ready(void) {
+    return num_ready_workers == num_workers;
+}
+
+/// Picks a ready worker in a round-robin fashion. Returns NULL if no workers
+/// are ready.
+static struct task *pick_worker(void) {
+    for (int i = 0; i < num_workers; i++) {
+        int index = next_worker;
+        next_worker = (next_worker + 1) % num_workers;
+        if (workers_ready[index]) {
+            return workers[index];
+        }
+    }
+
+    return NULL;
+}
+
+/// Lets a worker page the task if any. It must be called before the task is
+/// created: the task's pager is set to the worker.
+error_t worker_assign(struct task *task) {
+    struct task *worker = pick_worker();
+    if (!worker) {
+        return OK;
+    }
+
+    struct message m;
+    m.type = VM_WORKER_ASSIGN_MSG;
+    m.vm_worker_assign.task = task->tid;
+    OK_OR_RETURN(call_worker(worker, &m));
+    task->worker = worker;
+    task->pager = worker->tid;
+    return OK;
+}
+
+/// Returns free pages exceeding the worker's pool size.
+static void reclaim_pages(struct task *worker) {
+    while (true) {
+        struct message m;
+        m.type = VM_WORKER_RECLAIM_MSG;
+        if (call_worker(worker, &m) != OK) {
+            return;
+        }
+
+        size_t num_pages = m.vm_worker_reclaim_reply.num_pages;
+        size_t max = sizeof(m.vm_worker_reclaim_reply.pages)
+                     / sizeof(m.vm_worker_reclaim_reply.pages[0]);
+        for (size_t i = 0; i < MIN(num_pages, max); i++) {
+            OOPS_OK(task_page_free_range(
+                worker, m.vm_worker_reclaim_reply.pages[i], 1));
+        }
+
+        if (num_pages < max) {
+            return;
+        }
+    }
+}
+
+/// Frees the pages held by the worker for the task. The task must have been
+/// destroyed.
+void worker_release(struct task *task) {
+    struct task *worker = task->worker;
+    if (!worker) {
+        return;
+    }
+
+    struct message m;
+    m.type = VM_WORKER_RELEASE_MSG;
+    m.vm_worker_release.task = task->tid;
+    OOPS_OK(call_worker(worker, &m));
+    task->worker = NULL;
+    reclaim_pages(worker);
+}
+
+/// Makes the worker forward all page faults of the task to us so that we
+/// enforce its resident page limit.
+void worker_set_limited(struct task *task, bool limited) {
+    if (!task->worker) {
+        return;
+    }
+
+    struct message m;
+    m.type = VM_WORKER_SET_LIMITED_MSG;
+    m.vm_worker_set_limited.task = task->tid;
+    m.vm_worker_set_limited.limited = limited;
+    OOPS_OK(call_worker(task->worker, &m));
+}
+
+/// Takes the zero-filled page at `vaddr` over from the task's worker to manage
+/// it in the task's page areas like other pages. `*paddr` is set to zero if the
+/// worker has not allocated the page: we allocate it by ourselves.
+error_t worker_take_page(struct task *task, vaddr_t vaddr, paddr_t *paddr) {
+    struct message m;
+    m.type = VM_WORKER_TAKE_MSG;
+    m.vm_worker_take.task = task->tid;
+    m.vm_worker_take.vaddr = vaddr;
+    OK_OR_RETURN(call_worker(task->worker, &m));
+
+    *paddr = 0;
+    vaddr_t page = m.vm_worker_take_reply.page;
+    return page ? task_page_move(task->worker, page, task, vaddr, paddr) : OK;
+}
+
+/// Returns the number of pages held by the worker for the task.
+size_t worker_resident_pages(struct task *task) {
+    if (!task->worker) {
+        return 0;
+    }
+
+    struct message m;
+    m.type = VM_WORKER_STATS_MSG;
+    m.vm_worker_stats.task = task->tid;
+    if (call_worker(task->worker, &m) != OK) {
+        return 0;
+    }
+
+    return m.vm_worker_stats_reply.resident_pages;
+}
+
+/// Allocates pages for the worker's pool and maps them into the worker.
+static void refill_pages(struct task *worker, size_t num_pages) {
+    vaddr_t vaddr = num_pages ? virt_page_alloc(worker, num_pages) : 0;
+    size_t num_mapped = 0;
+    while (vaddr && num_mapped < num_pages) {
+        vaddr_t page = vaddr + num_mapped * PAGE_SIZE;
+        paddr_t paddr = 0;
+        if (task_page_alloc(worker, &page, &paddr, 1) != OK) {
+            break;
+        }
+
+        if (map_page(worker, page, paddr, MAP_TYPE_READWRITE, false) != OK) {
+            task_page_free(worker, paddr);
+            break;
+        }
+
+        num_mapped++;
+    }
+
+    if (vaddr && num_mapped < num_pages) {
+        OOPS_OK(virt_page_free(worker, vaddr + num_mapped * PAGE_SIZE,
+                               num_pages - num_mapped));
+    }
+
+    // Reply even if we've run out of memory: the worker asks again later.
+    struct message m;
+    m.type = VM_WORKER_REFILL_MSG;
+    m.vm_worker_refill.vaddr = num_mapped ? vaddr : 0;
+    m.vm_worker_refill.num_pages = num_mapped;
+    OOPS_OK(call_worker(worker, &m));
+}
+
+/// Handles an event. If it's a forwarded page fault, `*done_task` and
+/// `*done_error` are set to reply to it in the next `vm_worker.poll`.
+static void handle_event(struct task *worker, struct message *m,
+                         task_t *done_task, error_t *done_error) {
+    struct task *task = NULL;
+    switch (m->vm_worker_poll_reply.type) {
+        case VM_WORKER_EVENT_PAGE_FAULT:
+        case VM_WORKER_EVENT_EXCEPTION:
+            task = task_find(m->vm_worker_poll_reply.task);
+            if (!task || task->worker != worker) {
+                WARN_DBG("%s: an event for a task not paged by the worker",
+                         worker->name);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+
+    switch (m->vm_worker_poll_reply.type) {
+        case VM_WORKER_EVENT_PAGE_FAULT:
+            *done_task = task->tid;
+            *done_error = page_fault_resolve(
+                task, m->vm_worker_poll_reply.vaddr, m->vm_worker_poll_reply.ip,
+                m->vm_worker_poll_reply.fault);
+            break;
+        case VM_WORKER_EVENT_EXCEPTION:
+            task_handle_exception(task, m->vm_worker_poll_reply.exception);
+            break;
+        case VM_WORKER_EVENT_LOW_PAGES:
+            refill_pages(worker, m->vm_worker_poll_reply.num_pages);
+            break;
+        default:
+            WARN_DBG("%s: unknown event %d", worker->name,
+                     m->vm_worker_poll_reply.type);
+    }
+}
+
+/// Handles events from workers. Workers notify us (NOTIFY_ASYNC) when they
+/// have events.
+void worker_poll(void) {
+    for (int i = 0; i < num_workers; i++) {
+        if (!workers_ready[i]) {
+            continue;
+        }
+
+        // The reply to a forwarded page fault is piggybacked on the next poll
+        // to save a round trip.
+        task_t done_task = 0;
+        error_t done_error = OK;
+        while (true) {
+            struct message m;
+            m.type = VM_WORKER_POLL_MSG;
+            m.vm_worker_poll.done_task = done_task;
+            m.vm_worker_poll.done_error = done_error;
+            if (call_worker(workers[i], &m) != OK
+                || m.vm_worker_poll_reply.type == VM_WORKER_EVENT_NONE) {
+                break;
+            }
+
+            done_task = 0;
+            handle_event(workers[i], &m, &done_task, &done_error);
+        }
+    }
+}
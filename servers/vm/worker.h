@@ -0,0 +1,24 @@
+#ifndef __WORKER_H__
+#define __WORKER_H__
+
+#include <types.h>
+
+/// The maximum number of pager workers (`CONFIG_VM_NUM_WORKERS`).
+#define NUM_WORKERS_MAX 8
+/// The size of the stack mapped in advance for a worker. The rest of the stack
+/// is never used.
+#define WORKER_STACK_LEN (64 * 1024)
+
+struct task;
+int worker_init(void);
+error_t worker_ready(struct task *worker);
+bool worker_all_ready(void);
+bool is_worker(struct task *task);
+error_t worker_assign(struct task *task);
+void worker_release(struct task *task);
+void worker_set_limited(struct task *task, bool limited);
+error_t worker_take_page(struct task *task, vaddr_t vaddr, paddr_t *paddr);
+size_t worker_resident_pages(struct task *task);
+void worker_poll(void);
+
+#endif
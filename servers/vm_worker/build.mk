@@ -0,0 +1,3 @@
+name := vm_worker
+description := A pager worker of the vm server (started by vm)
+objs-y := main.o
@@ -0,0 +1,510 @@
+#include <resea/ipc.h>
+#include <resea/malloc.h>
+#include <resea/printf.h>
+#include <resea/task.h>
+#include <string.h>
+
+extern char __zeroed_pages[];
+extern char __zeroed_pages_end[];
+
+/// The number of entries in a table page.
+#define ENTRIES_PER_TABLE (PAGE_SIZE / sizeof(vaddr_t))
+/// An entry of a page handed over to vm: page faults on it are forwarded.
+#define VM_OWNED ((vaddr_t) 1)
+/// The maximum number of page directories (above the last-level page tables)
+/// the kernel allocates for the zeroed pages area of a task.
+#define NUM_UPPER_KPAGES_MAX 4
+/// We ask vm for more pages when the pool falls below this.
+#define POOL_LOW 32
+/// The number of free pages we keep in the pool.
+#define POOL_TARGET 128
+
+/// A task paged by us.
+struct owned_task {
+    bool in_use;
+    /// Page faults are forwarded to vm to enforce the resident page limit.
+    bool limited;
+    /// A page fault to be forwarded to vm (i.e. not yet taken by `poll`).
+    bool fault_pending;
+    vaddr_t fault_vaddr;
+    vaddr_t fault_ip;
+    unsigned fault;
+    /// A page fault has been forwarded to vm and not yet replied.
+    bool forwarded;
+    /// An exception to be forwarded to vm.
+    bool exception_pending;
+    enum exception_type exception;
+    /// The number of pages held for the task including page tables.
+    size_t num_pages;
+    /// Pages (our address or VM_OWNED) in the zeroed pages area indexed by
+    /// the page number. Each table is a page from the pool.
+    vaddr_t *tables;
+    /// Pages consumed by the kernel for the task's page table.
+    vaddr_t *kpages;
+    size_t num_kpages;
+};
+
+static struct owned_task tasks[CONFIG_NUM_TASKS + 1];
+/// The number of tables per task and the capacity of `kpages`.
+static size_t num_tables;
+static size_t max_kpages;
+/// Free pages mapped in our address space, linked through their first word.
+static vaddr_t pool = 0;
+static size_t pool_len = 0;
+/// We've asked vm for more pages but not yet received.
+static bool refill_requested = false;
+/// A page not consumed by the last vm_map().
+static vaddr_t spare_kpage = 0;
+/// The task ID to look for pending events from in the next `poll`.
+static task_t next_event_task = 1;
+
+// for sparse
+error_t ipc_call_pager(struct message *m);
+vaddr_t malloc_alloc_pages(size_t num_pages);
+
+/// vm calls us synchronously, so we must not call vm: we don't register ool
+/// receive buffers since vm rejects ool payloads sent to us.
+error_t ipc_call_pager(struct message *m) {
+    switch (m->type) {
+        case OOL_RECV_MSG:
+            m->type = OOL_RECV_REPLY_MSG;
+            return OK;
+        default:
+            return ERR_NOT_PERMITTED;
+    }
+}
+
+/// Our heap doesn't grow: it needs a call to vm.
+vaddr_t malloc_alloc_pages(size_t num_pages) {
+    return 0;
+}
+
+static struct owned_task *get_task(task_t tid) {
+    if (tid <= 0 || tid > CONFIG_NUM_TASKS || !tasks[tid].in_use) {
+        return NULL;
+    }
+
+    return &tasks[tid];
+}
+
+static vaddr_t pool_pop(void) {
+    vaddr_t page = pool;
+    if (page) {
+        pool = *((vaddr_t *) page);
+        pool_len--;
+    }
+
+    return page;
+}
+
+/// Allocates a zero-filled page from the pool. Returns zero if it's empty.
+static vaddr_t pool_alloc(void) {
+    vaddr_t page = pool_pop();
+    if (page) {
+        memset((void *) page, 0, PAGE_SIZE);
+    }
+
+    return page;
+}
+
+static void pool_free(vaddr_t page) {
+    *((vaddr_t *) page) = pool;
+    pool = page;
+    pool_len++;
+}
+
+/// Takes a pending event in a round-robin fashion. Events are kept in the
+/// tasks, so they never overflow: a task has at most one page fault (it's
+/// blocked until we reply) and one exception pending.
+static bool pop_event(struct message *m) {
+    for (int i = 0; i < CONFIG_NUM_TASKS; i++) {
+        task_t tid = next_event_task;
+        next_event_task = (next_event_task % CONFIG_NUM_TASKS) + 1;
+        struct owned_task *task = get_task(tid);
+        if (!task) {
+            continue;
+        }
+
+        if (task->exception_pending) {
+            task->exception_pending = false;
+            m->vm_worker_poll_reply.type = VM_WORKER_EVENT_EXCEPTION;
+            m->vm_worker_poll_reply.task = tid;
+            m->vm_worker_poll_reply.exception = task->exception;
+            return true;
+        }
+
+        if (task->fault_pending) {
+            task->fault_pending = false;
+            task->forwarded = true;
+            m->vm_worker_poll_reply.type = VM_WORKER_EVENT_PAGE_FAULT;
+            m->vm_worker_poll_reply.task = tid;
+            m->vm_worker_poll_reply.vaddr = task->fault_vaddr;
+            m->vm_worker_poll_reply.ip = task->fault_ip;
+            m->vm_worker_poll_reply.fault = task->fault;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// Returns the entry for the page at `vaddr` in the zeroed pages area. The
+/// table is allocated if `alloc` is true. Returns NULL if it's not allocated.
+static vaddr_t *lookup_entry(struct owned_task *task, vaddr_t vaddr,
+                             bool alloc) {
+    size_t index = (vaddr - (vaddr_t) __zeroed_pages) / PAGE_SIZE;
+    vaddr_t *table = &task->tables[index / ENTRIES_PER_TABLE];
+    if (!*table) {
+        if (!alloc) {
+            return NULL;
+        }
+
+        *table = pool_alloc();
+        if (!*table) {
+            return NULL;
+        }
+
+        task->num_pages++;
+    }
+
+    return &((vaddr_t *) *table)[index % ENTRIES_PER_TABLE];
+}
+
+/// Maps our page into the task. Pages for the task's page table are taken
+/// from the pool.
+static error_t map_into(struct owned_task *task, task_t tid, vaddr_t vaddr,
+                        vaddr_t page) {
+    while (true) {
+        if (!spare_kpage) {
+            spare_kpage = pool_alloc();
+            if (!spare_kpage) {
+                return ERR_NO_MEMORY;
+            }
+        }
+
+        if (task->num_kpages == max_kpages) {
+            return ERR_NO_MEMORY;
+        }
+
+        error_t err = vm_map(tid, vaddr, page, spare_kpage, MAP_TYPE_READWRITE);
+        if (err != ERR_TRY_AGAIN) {
+            return err;
+        }
+
+        // The kernel has consumed the page. We free it when the task is
+        // released (i.e. destroyed).
+        task->kpages[task->num_kpages++] = spare_kpage;
+        task->num_pages++;
+        spare_kpage = 0;
+    }
+}
+
+/// Fills and maps a zero-filled page. Returns an error if the page fault
+/// should be handled by vm instead.
+static error_t fill_zeroed_page(struct owned_task *task, task_t tid,
+                                vaddr_t vaddr, unsigned fault) {
+    if ((fault & EXP_PF_PRESENT) || task->limited
+        || vaddr < (vaddr_t) __zeroed_pages
+        || vaddr >= (vaddr_t) __zeroed_pages_end) {
+        return ERR_NOT_ACCEPTABLE;
+    }
+
+    vaddr = ALIGN_DOWN(vaddr, PAGE_SIZE);
+    vaddr_t *entry = lookup_entry(task, vaddr, true);
+    if (!entry || *entry == VM_OWNED) {
+        return ERR_NOT_ACCEPTABLE;
+    }
+
+    if (!*entry) {
+        *entry = pool_alloc();
+        if (!*entry) {
+            return ERR_NO_MEMORY;
+        }
+
+        task->num_pages++;
+    }
+
+    // If it fails, vm takes the page over from us and maps it.
+    return map_into(task, tid, vaddr, *entry);
+}
+
+static void handle_page_fault(task_t tid, vaddr_t vaddr, vaddr_t ip,
+                              unsigned fault) {
+    struct owned_task *task = get_task(tid);
+    if (!task) {
+        WARN_DBG("page fault in an unknown task #%d", tid);
+        ipc_reply_err(tid, ERR_NOT_FOUND);
+        return;
+    }
+
+    if (fill_zeroed_page(task, tid, vaddr, fault) == OK) {
+        struct message r;
+        r.type = PAGE_FAULT_REPLY_MSG;
+        ipc_reply(tid, &r);
+        return;
+    }
+
+    if (task->fault_pending || task->forwarded) {
+        // The task must be blocked until we reply to the previous one.
+        WARN_DBG("#%d: page fault while handling another one", tid);
+        ipc_reply_err(tid, ERR_TRY_AGAIN);
+        return;
+    }
+
+    // Let vm handle it. We reply to the task in the next `vm_worker.poll`.
+    task->fault_pending = true;
+    task->fault_vaddr = vaddr;
+    task->fault_ip = ip;
+    task->fault = fault;
+    OOPS_OK(ipc_notify(VM_TASK, NOTIFY_ASYNC));
+}
+
+static void release_task(struct owned_task *task) {
+    for (size_t i = 0; i < num_tables; i++) {
+        vaddr_t *table = (vaddr_t *) task->tables[i];
+        if (!table) {
+            continue;
+        }
+
+        for (size_t j = 0; j < ENTRIES_PER_TABLE; j++) {
+            if (table[j] && table[j] != VM_OWNED) {
+                pool_free(table[j]);
+            }
+        }
+
+        pool_free((vaddr_t) table);
+    }
+
+    for (size_t i = 0; i < task->num_kpages; i++) {
+        pool_free(task->kpages[i]);
+    }
+
+    free(task->tables);
+    free(task->kpages);
+    task->in_use = false;
+}
+
+/// Replies to the page fault forwarded to vm.
+static error_t complete_fault(task_t tid, error_t err) {
+    struct owned_task *task = get_task(tid);
+    if (!task || !task->forwarded) {
+        return ERR_INVALID_ARG;
+    }
+
+    task->forwarded = false;
+    if (err != OK) {
+        ipc_reply_err(tid, err);
+    } else {
+        struct message r;
+        r.type = PAGE_FAULT_REPLY_MSG;
+        ipc_reply(tid, &r);
+    }
+
+    return OK;
+}
+
+/// Handles a message from vm. Returns an error to be replied or OK if it has
+/// filled the reply.
+static error_t handle_vm_message(struct message *m) {
+    switch (m->type) {
+        case VM_WORKER_POLL_MSG: {
+            task_t done_task = m->vm_worker_poll.done_task;
+            if (done_task) {
+                OK_OR_RETURN(
+                    complete_fault(done_task, m->vm_worker_poll.done_error));
+            }
+
+            bzero(m, sizeof(*m));
+            m->type = VM_WORKER_POLL_REPLY_MSG;
+            if (pop_event(m)) {
+                return OK;
+            }
+
+            if (refill_requested && pool_len < POOL_TARGET) {
+                m->vm_worker_poll_reply.type = VM_WORKER_EVENT_LOW_PAGES;
+                m->vm_worker_poll_reply.num_pages = POOL_TARGET - pool_len;
+            } else {
+                m->vm_worker_poll_reply.type = VM_WORKER_EVENT_NONE;
+            }
+            return OK;
+        }
+        case VM_WORKER_REFILL_MSG: {
+            vaddr_t vaddr = m->vm_worker_refill.vaddr;
+            for (size_t i = 0; i < m->vm_worker_refill.num_pages; i++) {
+                pool_free(vaddr + i * PAGE_SIZE);
+            }
+
+            // Ask again when the pool runs low even if vm had no pages.
+            refill_requested = false;
+            m->type = VM_WORKER_REFILL_REPLY_MSG;
+            return OK;
+        }
+        case VM_WORKER_RECLAIM_MSG: {
+            size_t max = sizeof(m->vm_worker_reclaim_reply.pages)
+                         / sizeof(m->vm_worker_reclaim_reply.pages[0]);
+            size_t num_pages = 0;
+            while (num_pages < max && pool_len > POOL_TARGET) {
+                m->vm_worker_reclaim_reply.pages[num_pages++] = pool_pop();
+            }
+
+            m->type = VM_WORKER_RECLAIM_REPLY_MSG;
+            m->vm_worker_reclaim_reply.num_pages = num_pages;
+            return OK;
+        }
+        case VM_WORKER_ASSIGN_MSG: {
+            task_t tid = m->vm_worker_assign.task;
+            if (tid <= 0 || tid > CONFIG_NUM_TASKS || tasks[tid].in_use) {
+                return ERR_INVALID_ARG;
+            }
+
+            struct owned_task *task = &tasks[tid];
+            task->tables = malloc(sizeof(*task->tables) * num_tables);
+            task->kpages = malloc(sizeof(*task->kpages) * max_kpages);
+            bzero(task->tables, sizeof(*task->tables) * num_tables);
+            task->num_kpages = 0;
+            task->num_pages = 0;
+            task->limited = false;
+            task->fault_pending = false;
+            task->forwarded = false;
+            task->exception_pending = false;
+            task->in_use = true;
+            m->type = VM_WORKER_ASSIGN_REPLY_MSG;
+            return OK;
+        }
+        case VM_WORKER_RELEASE_MSG: {
+            task_t tid = m->vm_worker_release.task;
+            struct owned_task *task = get_task(tid);
+            if (!task) {
+                return ERR_NOT_FOUND;
+            }
+
+            release_task(task);
+            m->type = VM_WORKER_RELEASE_REPLY_MSG;
+            return OK;
+        }
+        case VM_WORKER_SET_LIMITED_MSG: {
+            struct owned_task *task = get_task(m->vm_worker_set_limited.task);
+            if (!task) {
+                return ERR_NOT_FOUND;
+            }
+
+            task->limited = m->vm_worker_set_limited.limited;
+            m->type = VM_WORKER_SET_LIMITED_REPLY_MSG;
+            return OK;
+        }
+        case VM_WORKER_TAKE_MSG: {
+            struct owned_task *task = get_task(m->vm_worker_take.task);
+            vaddr_t vaddr = m->vm_worker_take.vaddr;
+            if (!task) {
+                return ERR_NOT_FOUND;
+            }
+
+            if (!IS_ALIGNED(vaddr, PAGE_SIZE)
+                || vaddr < (vaddr_t) __zeroed_pages
+                || vaddr >= (vaddr_t) __zeroed_pages_end) {
+                return ERR_INVALID_ARG;
+            }
+
+            vaddr_t *entry = lookup_entry(task, vaddr, true);
+            if (!entry) {
+                return ERR_NO_MEMORY;
+            }
+
+            vaddr_t page = (*entry == VM_OWNED) ? 0 : *entry;
+            if (page) {
+                task->num_pages--;
+            }
+
+            *entry = VM_OWNED;
+            m->type = VM_WORKER_TAKE_REPLY_MSG;
+            m->vm_worker_take_reply.page = page;
+            return OK;
+        }
+        case VM_WORKER_STATS_MSG: {
+            struct owned_task *task = get_task(m->vm_worker_stats.task);
+            if (!task) {
+                return ERR_NOT_FOUND;
+            }
+
+            m->type = VM_WORKER_STATS_REPLY_MSG;
+            m->vm_worker_stats_reply.resident_pages = task->num_pages;
+            return OK;
+        }
+        default:
+            return ERR_NOT_ACCEPTABLE;
+    }
+}
+
+void main(void) {
+    TRACE("starting...");
+    size_t area_len = (vaddr_t) __zeroed_pages_end - (vaddr_t) __zeroed_pages;
+    num_tables = ALIGN_UP(area_len / PAGE_SIZE, ENTRIES_PER_TABLE)
+                 / ENTRIES_PER_TABLE;
+    max_kpages = num_tables + NUM_UPPER_KPAGES_MAX;
+
+    // We never call vm after this: vm calls us.
+    struct message m;
+    m.type = VM_WORKER_READY_MSG;
+    ASSERT_OK(ipc_call(VM_TASK, &m));
+
+    INFO("ready");
+    while (true) {
+        if (pool_len < POOL_LOW && !refill_requested) {
+            refill_requested = true;
+            OOPS_OK(ipc_notify(VM_TASK, NOTIFY_ASYNC));
+        }
+
+        bzero(&m, sizeof(m));
+        ASSERT_OK(ipc_recv(IPC_ANY, &m));
+
+        switch (m.type) {
+            case PAGE_FAULT_MSG:
+                if (m.src != KERNEL_TASK) {
+                    WARN("forged page fault message from #%d, ignoring...",
+                         m.src);
+                    break;
+                }
+
+                handle_page_fault(m.page_fault.task, m.page_fault.vaddr,
+                                  m.page_fault.ip, m.page_fault.fault);
+                break;
+            case EXCEPTION_MSG: {
+                if (m.src != KERNEL_TASK) {
+                    WARN("forged exception message from #%d, ignoring...",
+                         m.src);
+                    break;
+                }
+
+                struct owned_task *task = get_task(m.exception.task);
+                if (!task) {
+                    WARN_DBG("exception in an unknown task #%d",
+                             m.exception.task);
+                    break;
+                }
+
+                // vm kills the task: keep only the first one.
+                if (!task->exception_pending) {
+                    task->exception_pending = true;
+                    task->exception = m.exception.exception;
+                }
+
+                OOPS_OK(ipc_notify(VM_TASK, NOTIFY_ASYNC));
+                break;
+            }
+            default: {
+                if (m.src != VM_TASK) {
+                    discard_unknown_message(&m);
+                    break;
+                }
+
+                error_t err = handle_vm_message(&m);
+                if (err != OK) {
+                    ipc_reply_err(VM_TASK, err);
+                    break;
+                }
+
+                ipc_reply(VM_TASK, &m);
+            }
+        }
+    }
+}
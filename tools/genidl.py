@@ -482,6 +482,20 @@ struct {{ msg | msg_name }}_reply_fields {{ "{" }}
     {% endfor %} \\
     {{ "}" }}
 
+// The size of message fields for messages with an ool payload. A small
+// payload is inlined into the message right after the fields.
+#define IDL_MSGID2FIELDS_LEN \\
+    (const size_t[IDL_MSGID_MAX + 1]){{ "{" }} \\
+    {%- for m in msgs %}
+        {%- if m.args.ool %}
+        [{{ m.args_id }}] = sizeof(struct {{ m | msg_name }}_fields), \\
+        {%- endif %}
+        {%- if not m.oneway and m.rets.ool %}
+        [{{ m.rets_id }}] = sizeof(struct {{ m | msg_name }}_reply_fields), \\
+        {%- endif %}
+    {%- endfor %}
+    {{ "}" }}
+
 #endif
 
 """)
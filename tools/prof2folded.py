@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""
+    Converts profiler samples (`@prof` lines) in the kernel log into folded
+    stacks, the input format of flamegraph.pl.
+"""
+import argparse
+import bisect
+import os
+import re
+from collections import Counter
+
+KERNEL_BASE_ADDR = 0xffff800000000000
+
+
+class SymbolTable:
+    def __init__(self, path):
+        symbols = {}
+        for line in open(path).read().strip().split("\n"):
+            cols = line.split(" ", 1)
+            try:
+                addr = int(cols[0], 16)
+            except ValueError:
+                continue
+            symbols[addr] = cols[1].strip()
+        self.symbols = sorted(symbols.items(), key=lambda s: s[0])
+        self.addrs = [addr for addr, _ in self.symbols]
+
+    def resolve(self, addr):
+        i = bisect.bisect_right(self.addrs, addr) - 1
+        if i < 0:
+            return hex(addr)
+        return self.symbols[i][1]
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Converts profiler samples into folded stacks.")
+    parser.add_argument("--build-dir", default="build",
+                        help="The directory containing *.symbols files.")
+    parser.add_argument("log_file")
+    args = parser.parse_args()
+
+    tables = {}
+
+    def lookup(task, addr):
+        name = "resea" if addr >= KERNEL_BASE_ADDR else task
+        if name not in tables:
+            path = os.path.join(args.build_dir, f"{name}.symbols")
+            tables[name] = SymbolTable(path) if os.path.exists(path) else None
+        table = tables[name]
+        return table.resolve(addr) if table else hex(addr)
+
+    stacks = Counter()
+    for line in open(args.log_file).readlines():
+        m = re.search(r"@prof (?P<task>\S+) (?P<addrs>[0-9a-f ]+)", line)
+        if not m:
+            continue
+        task = m.group("task")
+        addrs = [int(addr, 16) for addr in m.group("addrs").split()]
+        # Return addresses point to the next instruction of the call.
+        frames = [lookup(task, addrs[0])]
+        frames += [lookup(task, addr - 1) for addr in addrs[1:]]
+        stacks[";".join([task] + list(reversed(frames)))] += 1
+
+    for stack, count in sorted(stacks.items()):
+        print(f"{stack} {count}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""
+    Converts kernel trace events (`@trace` lines) in the kernel log into the
+    Chrome trace event format. Open the output in chrome://tracing or Perfetto.
+"""
+import argparse
+import json
+import re
+from collections import defaultdict, deque
+
+TRACE_IPC_SEND = 1
+TRACE_IPC_RECV = 2
+TRACE_SWITCH = 3
+TRACE_IRQ = 4
+TRACE_PAGE_FAULT = 5
+TRACE_PAGE_FAULT_DONE = 6
+TRACE_FLAG_FASTPATH = 1 << 0
+
+KERNEL_TASK = 0
+CPUS_PID = 0
+TASKS_PID = 1
+
+
+def load_msg_names(idl_header):
+    names = {}
+    try:
+        for line in open(idl_header).readlines():
+            m = re.match(r"#define (?P<name>\w+)_MSG \((?P<id>\d+)", line)
+            if m:
+                names[int(m.group("id"))] = m.group("name").lower()
+    except FileNotFoundError:
+        pass
+    return names
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Converts kernel trace events into Chrome trace JSON.")
+    parser.add_argument("--idl-header", default="build/include/idl.h",
+                        help="The generated IDL header to resolve message names.")
+    parser.add_argument("log_file")
+    args = parser.parse_args()
+
+    msg_names = load_msg_names(args.idl_header)
+    hz = 0
+    tasks = {KERNEL_TASK: "(idle)"}
+    events = []
+    for line in open(args.log_file).readlines():
+        m = re.search(r"@trace-hz ([0-9a-f]+)", line)
+        if m:
+            hz = int(m.group(1), 16)
+            continue
+        m = re.search(r"@trace-task ([0-9a-f]+) (\S+)", line)
+        if m:
+            tasks[int(m.group(1), 16)] = m.group(2)
+            continue
+        m = re.search(r"@trace ((?:[0-9a-f]+ ?){7})", line)
+        if m:
+            events.append([int(col, 16) for col in m.group(1).split()])
+
+    if not hz:
+        parser.error("@trace-hz not found in the log")
+
+    def usec(timestamp):
+        return timestamp * 1000000 / hz
+
+    def task_name(tid):
+        return tasks.get(tid, f"#{tid}")
+
+    def msg_name(type_):
+        return msg_names.get(type_ & 0xffff, str(type_ & 0xffff))
+
+    out = []
+    for tid, name in tasks.items():
+        out.append({"ph": "M", "name": "thread_name", "pid": TASKS_PID,
+                    "tid": tid, "args": {"name": f"{name} (#{tid})"}})
+    running = {}
+    flows = defaultdict(deque)
+    next_flow_id = 1
+    for cpu, ts, type_, flags, task, arg0, arg1 in sorted(
+            events, key=lambda e: e[1]):
+        ts = usec(ts)
+        path = "fastpath" if flags & TRACE_FLAG_FASTPATH else "slowpath"
+        ev = {"pid": TASKS_PID, "tid": task, "ts": ts}
+        if type_ == TRACE_IPC_SEND:
+            name = msg_name(arg1)
+            out.append({**ev, "ph": "i", "s": "t", "name": f"send {name}",
+                        "args": {"dst": task_name(arg0), "path": path}})
+            flows[(task, arg0, arg1)].append(next_flow_id)
+            out.append({**ev, "ph": "s", "name": name, "cat": "ipc",
+                        "id": next_flow_id})
+            next_flow_id += 1
+        elif type_ == TRACE_IPC_RECV:
+            name = msg_name(arg1)
+            out.append({**ev, "ph": "i", "s": "t", "name": f"recv {name}",
+                        "args": {"src": task_name(arg0), "path": path}})
+            queue = flows.get((arg0, task, arg1))
+            if queue:
+                out.append({**ev, "ph": "f", "bp": "e", "name": name,
+                            "cat": "ipc", "id": queue.popleft()})
+        elif type_ == TRACE_SWITCH:
+            if cpu in running:
+                prev, start = running[cpu]
+                out.append({"pid": CPUS_PID, "tid": cpu, "ts": start,
+                            "dur": ts - start, "ph": "X",
+                            "name": task_name(prev)})
+            running[cpu] = (arg0, ts)
+        elif type_ == TRACE_IRQ:
+            out.append({**ev, "ph": "i", "s": "t", "name": f"irq {arg0}",
+                        "args": {"owner": task_name(arg1)}})
+        elif type_ == TRACE_PAGE_FAULT:
+            out.append({**ev, "ph": "B", "name": "page fault",
+                        "args": {"addr": hex(arg0), "ip": hex(arg1)}})
+        elif type_ == TRACE_PAGE_FAULT_DONE:
+            out.append({**ev, "ph": "E", "name": "page fault"})
+
+    for cpu in sorted(set(e[0] for e in events)):
+        out.append({"ph": "M", "name": "thread_name", "pid": CPUS_PID,
+                    "tid": cpu, "args": {"name": f"CPU #{cpu}"}})
+    out.append({"ph": "M", "name": "process_name", "pid": CPUS_PID,
+                "args": {"name": "CPUs"}})
+    out.append({"ph": "M", "name": "process_name", "pid": TASKS_PID,
+                "args": {"name": "Tasks"}})
+    print(json.dumps({"traceEvents": out, "displayTimeUnit": "ns"}))
+
+
+if __name__ == "__main__":
+    main()